@@ -0,0 +1,340 @@
+/*
+ * ff-rknn - CPU burn-in of detections
+ *
+ * Boxes, fills and labels are drawn straight into the RGB24 or NV12 frame
+ * buffer so they end up in anything downstream of it (recording, shared
+ * memory consumers) and not only on screen. Every primitive reduces to a
+ * horizontal span filled or blended against a 48 byte colour pattern
+ * (16 RGB pixels, 48 luma samples or 24 UV pairs), which is what the
+ * NEON/SSE2 kernels work on.
+ */
+
+#include "annotate.h"
+
+#include <string.h>
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ANNOTATE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ANNOTATE_SSE2 1
+#endif
+
+#include "font5x7.h"
+
+#define PATTERN_LEN 48
+
+const uint8_t annotate_palette[ANNOTATE_COLORS][3] = {
+    { 0, 0, 255 },     // everything else
+    { 255, 0, 0 },     // person
+    { 0, 255, 0 },     // car
+    { 255, 0, 255 },   // bus
+    { 255, 255, 0 },   // bicycle
+    { 128, 155, 255 }, // motorcycle
+    { 128, 128, 128 }, // backpack, book
+    { 255, 255, 255 }, // umbrella
+};
+
+static uint8_t class_color[OBJ_CLASS_NUM]; // palette index per class id, read-only once filled
+
+static int name_color(const char *name)
+{
+    if (name[0] == 'p' && name[1] == 'e')
+        return 1;
+    if (name[0] == 'c' && name[1] == 'a')
+        return 2;
+    if (name[0] == 'b' && name[1] == 'u')
+        return 3;
+    if (name[0] == 'b' && name[1] == 'i')
+        return 4;
+    if (name[0] == 'm' && name[1] == 'o')
+        return 5;
+    if (name[0] == 'b' && name[3] == 'k')
+        return 6;
+    if (name[0] == 'u' && name[1] == 'm')
+        return 7;
+    return 0;
+}
+
+void annotate_colors_init(void)
+{
+    for (int id = 0; id < OBJ_CLASS_NUM; id++) {
+        const char *name = postprocess_label(id);
+
+        class_color[id] = name ? name_color(name) : 0;
+    }
+}
+
+int annotate_class_color(const detect_result_t *det_result)
+{
+    int id = det_result->cls_id;
+
+    return id >= 0 && id < OBJ_CLASS_NUM ? class_color[id] : 0;
+}
+
+typedef struct _plane_t
+{
+    uint8_t *data;
+    int stride;
+    int bpp; // bytes per sample unit: 3 RGB24, 1 Y, 2 UV
+    int width;
+    int height;
+} plane_t;
+
+/* round(x / 255) for x in [0, 255 * 255], same result in every path */
+static inline uint8_t div255(unsigned x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+void annotate_blend_span_c(uint8_t *dst, int n, const uint8_t pattern[48], int alpha)
+{
+    unsigned ia = 255 - alpha;
+
+    for (int i = 0; i < n; i++)
+        dst[i] = div255(dst[i] * ia + pattern[i % PATTERN_LEN] * alpha);
+}
+
+void annotate_blend_span(uint8_t *dst, int n, const uint8_t pattern[48], int alpha)
+{
+#if defined(ANNOTATE_NEON)
+    uint8x8_t ia = vdup_n_u8(255 - alpha);
+    uint16x8_t ca[6];
+    int i = 0;
+
+    for (int k = 0; k < 6; k++) {
+        uint16x8_t c = vmovl_u8(vld1_u8(pattern + k * 8));
+        ca[k] = vaddq_u16(vmulq_n_u16(c, alpha), vdupq_n_u16(128));
+    }
+    for (; i + PATTERN_LEN <= n; i += PATTERN_LEN) {
+        for (int k = 0; k < 3; k++) {
+            uint8x16_t d = vld1q_u8(dst + i + k * 16);
+            uint16x8_t lo = vmlal_u8(ca[2 * k], vget_low_u8(d), ia);
+            uint16x8_t hi = vmlal_u8(ca[2 * k + 1], vget_high_u8(d), ia);
+
+            lo = vsraq_n_u16(lo, lo, 8);
+            hi = vsraq_n_u16(hi, hi, 8);
+            vst1q_u8(dst + i + k * 16, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+        }
+    }
+    annotate_blend_span_c(dst + i, n - i, pattern, alpha);
+#elif defined(ANNOTATE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ia = _mm_set1_epi16(255 - alpha);
+    __m128i ca[6];
+    int i = 0;
+
+    for (int k = 0; k < 3; k++) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(pattern + k * 16));
+        __m128i a = _mm_set1_epi16(alpha);
+        __m128i r = _mm_set1_epi16(128);
+
+        ca[2 * k] = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), a), r);
+        ca[2 * k + 1] = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), a), r);
+    }
+    for (; i + PATTERN_LEN <= n; i += PATTERN_LEN) {
+        for (int k = 0; k < 3; k++) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(dst + i + k * 16));
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia), ca[2 * k]);
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia), ca[2 * k + 1]);
+
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+            _mm_storeu_si128((__m128i *)(dst + i + k * 16), _mm_packus_epi16(lo, hi));
+        }
+    }
+    annotate_blend_span_c(dst + i, n - i, pattern, alpha);
+#else
+    annotate_blend_span_c(dst, n, pattern, alpha);
+#endif
+}
+
+static void fill_span(uint8_t *dst, int n, const uint8_t *pattern)
+{
+    for (; n >= PATTERN_LEN; n -= PATTERN_LEN, dst += PATTERN_LEN)
+        memcpy(dst, pattern, PATTERN_LEN);
+    memcpy(dst, pattern, n);
+}
+
+static void make_pattern(uint8_t pattern[PATTERN_LEN], const uint8_t *unit, int bpp)
+{
+    for (int i = 0; i < PATTERN_LEN; i++)
+        pattern[i] = unit[i % bpp];
+}
+
+/* BT.601 limited range, what RGA and SDL assume for NV12 */
+static void rgb_to_yuv(const uint8_t rgb[3], uint8_t *y, uint8_t uv[2])
+{
+    int r = rgb[0], g = rgb[1], b = rgb[2];
+
+    *y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    uv[0] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    uv[1] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+/* fill (alpha 255) or blend the inclusive rectangle x0,y0 - x1,y1 */
+static void plane_fill(const plane_t *p, int x0, int y0, int x1, int y1,
+                       const uint8_t *pattern, int alpha)
+{
+    int n;
+
+    if (x0 < 0)
+        x0 = 0;
+    if (y0 < 0)
+        y0 = 0;
+    if (x1 >= p->width)
+        x1 = p->width - 1;
+    if (y1 >= p->height)
+        y1 = p->height - 1;
+    if (x0 > x1 || y0 > y1 || alpha <= 0)
+        return;
+
+    n = (x1 - x0 + 1) * p->bpp;
+    for (int y = y0; y <= y1; y++) {
+        uint8_t *dst = p->data + (size_t)y * p->stride + x0 * p->bpp;
+
+        if (alpha >= 255)
+            fill_span(dst, n, pattern);
+        else
+            annotate_blend_span(dst, n, pattern, alpha);
+    }
+}
+
+static void plane_outline(const plane_t *p, int x0, int y0, int x1, int y1, int line,
+                          const uint8_t *pattern)
+{
+    plane_fill(p, x0, y0, x1, y0 + line - 1, pattern, 255);
+    plane_fill(p, x0, y1 - line + 1, x1, y1, pattern, 255);
+    plane_fill(p, x0, y0 + line, x0 + line - 1, y1 - line, pattern, 255);
+    plane_fill(p, x1 - line + 1, y0 + line, x1, y1 - line, pattern, 255);
+}
+
+static void plane_text(const plane_t *p, int x, int y, const char *label, int scale,
+                       const uint8_t *pattern)
+{
+    for (const char *s = label; *s; s++, x += FONT_CELL_W * scale) {
+        int c = (unsigned char)*s;
+
+        if (c <= FONT_FIRST || c > FONT_LAST)
+            continue;
+        if (x >= p->width)
+            break;
+        c -= FONT_FIRST;
+        for (int gy = 0; gy < FONT_H; gy++) {
+            uint8_t bits = font5x7[c][gy];
+
+            for (int gx = 0; gx < FONT_W; gx++) {
+                int px = x + gx * scale;
+                int py = y + gy * scale;
+
+                if ((bits >> (FONT_W - 1 - gx)) & 1)
+                    plane_fill(p, px, py, px + scale - 1, py + scale - 1, pattern, 255);
+            }
+        }
+    }
+}
+
+/* same placement as the SDL overlay: on top of the box, inside if no room */
+static void label_rect(const annotate_box_t *box, int scale, int *x0, int *y0, int *x1, int *y1)
+{
+    int ch = FONT_CELL_H * scale;
+
+    *x0 = box->left;
+    *y0 = box->top >= ch ? box->top - ch : box->top;
+    *x1 = *x0 + (int)strlen(box->label) * FONT_CELL_W * scale + scale - 1;
+    *y1 = *y0 + ch - 1;
+}
+
+static void label_fg(const uint8_t bg[3], uint8_t fg[3])
+{
+    /* dark label backgrounds get white text */
+    uint8_t v = bg[0] * 299 + bg[1] * 587 + bg[2] * 114 < 128000 ? 255 : 0;
+
+    fg[0] = fg[1] = fg[2] = v;
+}
+
+void annotate_rgb(uint8_t *buf, int width, int height, int stride,
+                  const annotate_box_t *boxes, int count,
+                  int alphablend, int line, int label_scale)
+{
+    plane_t p = { buf, stride, 3, width, height };
+    uint8_t pattern[PATTERN_LEN];
+
+    if (line < 1)
+        line = 1;
+
+    if (alphablend) {
+        for (int i = 0; i < count; i++) {
+            const annotate_box_t *b = &boxes[i];
+
+            make_pattern(pattern, b->rgb, 3);
+            plane_fill(&p, b->left, b->top, b->right, b->bottom, pattern, alphablend);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        const annotate_box_t *b = &boxes[i];
+        uint8_t fg[3];
+        int x0, y0, x1, y1;
+
+        make_pattern(pattern, b->rgb, 3);
+        plane_outline(&p, b->left, b->top, b->right, b->bottom, line, pattern);
+        if (!b->label || label_scale <= 0)
+            continue;
+
+        label_rect(b, label_scale, &x0, &y0, &x1, &y1);
+        plane_fill(&p, x0, y0, x1, y1, pattern, 255);
+        label_fg(b->rgb, fg);
+        make_pattern(pattern, fg, 3);
+        plane_text(&p, x0 + label_scale, y0 + label_scale, b->label, label_scale, pattern);
+    }
+}
+
+void annotate_nv12(uint8_t *y_plane, int y_stride, uint8_t *uv_plane, int uv_stride,
+                   int width, int height,
+                   const annotate_box_t *boxes, int count,
+                   int alphablend, int line, int label_scale)
+{
+    plane_t py = { y_plane, y_stride, 1, width, height };
+    plane_t puv = { uv_plane, uv_stride, 2, width / 2, height / 2 };
+    uint8_t ypat[PATTERN_LEN], uvpat[PATTERN_LEN];
+    int cline;
+
+    if (line < 1)
+        line = 1;
+    cline = (line + 1) / 2;
+
+    for (int i = 0; alphablend && i < count; i++) {
+        const annotate_box_t *b = &boxes[i];
+        uint8_t y, uv[2];
+
+        rgb_to_yuv(b->rgb, &y, uv);
+        make_pattern(ypat, &y, 1);
+        make_pattern(uvpat, uv, 2);
+        plane_fill(&py, b->left, b->top, b->right, b->bottom, ypat, alphablend);
+        plane_fill(&puv, b->left / 2, b->top / 2, b->right / 2, b->bottom / 2, uvpat, alphablend);
+    }
+    for (int i = 0; i < count; i++) {
+        const annotate_box_t *b = &boxes[i];
+        uint8_t y, uv[2], fg[3];
+        int x0, y0, x1, y1;
+
+        rgb_to_yuv(b->rgb, &y, uv);
+        make_pattern(ypat, &y, 1);
+        make_pattern(uvpat, uv, 2);
+        plane_outline(&py, b->left, b->top, b->right, b->bottom, line, ypat);
+        plane_outline(&puv, b->left / 2, b->top / 2, b->right / 2, b->bottom / 2, cline, uvpat);
+        if (!b->label || label_scale <= 0)
+            continue;
+
+        label_rect(b, label_scale, &x0, &y0, &x1, &y1);
+        plane_fill(&py, x0, y0, x1, y1, ypat, 255);
+        plane_fill(&puv, x0 / 2, y0 / 2, x1 / 2, y1 / 2, uvpat, 255);
+        /* glyphs only touch luma, the label background keeps the chroma */
+        label_fg(b->rgb, fg);
+        rgb_to_yuv(fg, &y, uv);
+        make_pattern(ypat, &y, 1);
+        plane_text(&py, x0 + label_scale, y0 + label_scale, b->label, label_scale, ypat);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef _FF_RKNN_ANNOTATE_H_
+#define _FF_RKNN_ANNOTATE_H_
+
+#include <stdint.h>
+
+#include "postprocess.h"
+
+#define ANNOTATE_COLORS 8
+
+/* class colours (index into annotate_palette), shared with the SDL overlay */
+extern const uint8_t annotate_palette[ANNOTATE_COLORS][3];
+/* fills the class id table from the labels: after initPostProcess(), before any thread reads it */
+void annotate_colors_init(void);
+int annotate_class_color(const detect_result_t *det_result);
+
+/* one box to burn in, coordinates in pixels of the target buffer */
+typedef struct _annotate_box_t
+{
+    int left;
+    int top;
+    int right;
+    int bottom;
+    uint8_t rgb[3];
+    const char *label; // NULL: no label
+} annotate_box_t;
+
+/*
+ * CPU burn-in of detection boxes into the pixel buffer itself: optional
+ * alpha blended fill (same semantics as SDL blending with -b alpha),
+ * opaque outline of `line` pixels and a 5x7 bitmap label scaled by
+ * label_scale. Only rows covered by the boxes are touched. Blending uses
+ * NEON on aarch64, SSE2 on x86 and is bit-exact with the C fallback.
+ */
+void annotate_rgb(uint8_t *buf, int width, int height, int stride,
+                  const annotate_box_t *boxes, int count,
+                  int alphablend, int line, int label_scale);
+
+void annotate_nv12(uint8_t *y_plane, int y_stride, uint8_t *uv_plane, int uv_stride,
+                   int width, int height,
+                   const annotate_box_t *boxes, int count,
+                   int alphablend, int line, int label_scale);
+
+/* alpha blend n bytes against a colour pattern repeating every 48 bytes */
+void annotate_blend_span(uint8_t *dst, int n, const uint8_t pattern[48], int alpha);
+void annotate_blend_span_c(uint8_t *dst, int n, const uint8_t pattern[48], int alpha);
+
+#endif //_FF_RKNN_ANNOTATE_H_
@@ -0,0 +1,48 @@
+/*
+ * ff-rknn - inference backends
+ *
+ * The rknn table points straight at librknnrt. Pools keep the backend they
+ * were created with, so the selection only has to happen before the models
+ * are loaded.
+ */
+
+#include "backend.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if HAVE_RKNN
+const npu_backend_t backend_rknn = {
+    "rknn",
+    rknn_init,
+    rknn_dup_context,
+    rknn_destroy,
+    rknn_query,
+    rknn_set_core_mask,
+    rknn_set_input_shape,
+    rknn_inputs_set,
+    rknn_run,
+    rknn_outputs_get,
+    rknn_outputs_release,
+};
+
+const npu_backend_t *npu_backend = &backend_rknn;
+#else
+const npu_backend_t *npu_backend = &backend_mock;
+#endif
+
+int backend_select(const char *spec)
+{
+#if HAVE_RKNN
+    if (!strcmp(spec, "rknn")) {
+        npu_backend = &backend_rknn;
+        return 0;
+    }
+#endif
+    if (!strncmp(spec, "mock", 4) && (spec[4] == '\0' || spec[4] == ':')) {
+        npu_backend = &backend_mock;
+        return backend_mock_config(spec[4] ? spec + 5 : "");
+    }
+    fprintf(stderr, "Unknown inference backend: %s\n", spec);
+    return -1;
+}
@@ -0,0 +1,53 @@
+#ifndef _FF_RKNN_BACKEND_H_
+#define _FF_RKNN_BACKEND_H_
+
+#include "rknn_api.h"
+
+#ifndef HAVE_RKNN
+#define HAVE_RKNN 1 // 0: build without librknnrt, mock backend only
+#endif
+
+/*
+ * Inference backend: the rknn_* calls of ff-rknn as a table with the same
+ * signatures. "rknn" is librknnrt on the NPU; "mock" runs anywhere, it
+ * emulates the NPU cores (latency, jitter, one inference per core at a
+ * time) and returns synthetic YOLOv5 outputs, or replays a -dump file
+ * given as the model.
+ */
+typedef struct _npu_backend_t
+{
+    const char *name;
+    int (*init)(rknn_context *context, void *model, uint32_t size, uint32_t flag,
+                rknn_init_extend *extend);
+    int (*dup_context)(rknn_context *context_in, rknn_context *context_out);
+    int (*destroy)(rknn_context context);
+    int (*query)(rknn_context context, rknn_query_cmd cmd, void *info, uint32_t size);
+    int (*set_core_mask)(rknn_context context, rknn_core_mask core_mask);
+    int (*set_input_shape)(rknn_context context, rknn_tensor_attr *attr);
+    int (*inputs_set)(rknn_context context, uint32_t n_inputs, rknn_input inputs[]);
+    int (*run)(rknn_context context, rknn_run_extend *extend);
+    int (*outputs_get)(rknn_context context, uint32_t n_outputs, rknn_output outputs[],
+                       rknn_output_extend *extend);
+    int (*outputs_release)(rknn_context context, uint32_t n_outputs, rknn_output outputs[]);
+} npu_backend_t;
+
+#if HAVE_RKNN
+extern const npu_backend_t backend_rknn;
+#endif
+extern const npu_backend_t backend_mock;
+
+/* used by the pools created from now on */
+extern const npu_backend_t *npu_backend;
+
+/*
+ * "rknn", or "mock[:key=value,...]" with
+ *   ms=N      inference time of a 640x640 input, scaled by the input area (default 25)
+ *   jitter=N  +/- uniform jitter in ms (default 0)
+ *   cores=N   emulated NPU cores, 1 to 3 (default 3)
+ *   objects=N objects per synthetic frame (default 4)
+ *   size=N    synthetic model input size (default 640)
+ */
+int backend_select(const char *spec);
+int backend_mock_config(const char *options);
+
+#endif //_FF_RKNN_BACKEND_H_
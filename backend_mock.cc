@@ -0,0 +1,520 @@
+/*
+ * ff-rknn - mock inference backend
+ *
+ * A model is either a tensor dump (ff-rknn -dump), whose frames are handed
+ * out round robin, or anything else, which stands for a YOLOv5 detector
+ * with a few synthetic frames of int8 outputs. rknn_run() waits for an
+ * emulated core (the one of the core mask, or any with RKNN_NPU_CORE_AUTO),
+ * holds it for the configured latency and frees it, so contention between
+ * contexts and streams behaves like on the NPU. Outputs point into the
+ * model; want_float outputs are dequantized into a buffer of the context.
+ */
+
+#include "backend.h"
+#include "postprocess.h"
+#include "tensordump.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#define MOCK_MAX_CTX   64
+#define MOCK_MAX_CORES 3
+#define MOCK_SYNTH     4 // synthetic frames per model
+#define MOCK_REF_AREA  (640 * 640)
+
+/* synthetic outputs: zero point, scale and the two levels used */
+#define MOCK_ZP    0
+#define MOCK_SCALE 0.05f
+#define MOCK_LOW   -100
+#define MOCK_HIGH  50
+
+typedef struct _mock_model_t
+{
+    int refs;
+    rknn_input_output_num io_num;
+    rknn_tensor_attr input_attr;
+    rknn_tensor_attr output_attrs[TENSORDUMP_MAX_OUTPUTS];
+    uint8_t *data; // copy of the dump, or the synthetic frames
+    std::vector<const int8_t *> frames; // io_num.n_output per frame
+    std::atomic<uint64_t> next;
+} mock_model_t;
+
+typedef struct _mock_ctx_t
+{
+    mock_model_t *model;
+    int core; // -1: any
+    int width; // input shape
+    int height;
+    uint64_t frame; // of the last run
+    uint32_t seed;
+    float *floats[TENSORDUMP_MAX_OUTPUTS];
+} mock_ctx_t;
+
+static float mock_ms = 25;
+static float mock_jitter;
+static int mock_cores = MOCK_MAX_CORES;
+static int mock_objects = 4;
+static int mock_size = 640;
+
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mock_cond = PTHREAD_COND_INITIALIZER;
+static mock_ctx_t *contexts[MOCK_MAX_CTX]; // handle - 1
+static int core_busy[MOCK_MAX_CORES];
+
+int backend_mock_config(const char *options)
+{
+    char buf[256], *save = NULL;
+
+    snprintf(buf, sizeof(buf), "%s", options);
+    for (char *opt = strtok_r(buf, ",", &save); opt; opt = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(opt, '=');
+
+        if (!value) {
+            fprintf(stderr, "mock: expected key=value: %s\n", opt);
+            return -1;
+        }
+        *value++ = '\0';
+        if (!strcmp(opt, "ms"))
+            mock_ms = atof(value);
+        else if (!strcmp(opt, "jitter"))
+            mock_jitter = atof(value);
+        else if (!strcmp(opt, "cores"))
+            mock_cores = atoi(value);
+        else if (!strcmp(opt, "objects"))
+            mock_objects = atoi(value);
+        else if (!strcmp(opt, "size"))
+            mock_size = atoi(value) & ~31;
+        else {
+            fprintf(stderr, "mock: unknown option %s\n", opt);
+            return -1;
+        }
+    }
+    if (mock_cores < 1 || mock_cores > MOCK_MAX_CORES || mock_size < 64 || mock_ms < 0) {
+        fprintf(stderr, "mock: cores 1 to %d, size from 64, ms >= 0\n", MOCK_MAX_CORES);
+        return -1;
+    }
+    fprintf(stderr, "mock backend: %.1f ms +/- %.1f per %dx%d, %d core(s)\n", mock_ms, mock_jitter,
+            640, 640, mock_cores);
+    return 0;
+}
+
+static uint32_t rnd(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static void set_attr(rknn_tensor_attr *attr, int index, uint32_t d0, uint32_t d1, uint32_t d2,
+                     uint32_t d3, rknn_tensor_format fmt, rknn_tensor_type type)
+{
+    memset(attr, 0, sizeof(*attr));
+    attr->index = index;
+    attr->n_dims = 4;
+    attr->dims[0] = d0;
+    attr->dims[1] = d1;
+    attr->dims[2] = d2;
+    attr->dims[3] = d3;
+    attr->n_elems = d0 * d1 * d2 * d3;
+    attr->size = attr->n_elems * (type == RKNN_TENSOR_FLOAT32 ? 4 : 1);
+    attr->fmt = fmt;
+    attr->type = type;
+    attr->qnt_type = RKNN_TENSOR_QNT_AFFINE_ASYMMETRIC;
+    attr->zp = MOCK_ZP;
+    attr->scale = MOCK_SCALE;
+    snprintf(attr->name, sizeof(attr->name), "mock%d", index);
+}
+
+/* YOLOv5 heads at strides 8, 16, 32; each object lights up one cell and anchor */
+static int synth_model(mock_model_t *m)
+{
+    size_t frame_size = 0, offset = 0;
+    uint32_t seed = 1;
+
+    m->io_num.n_input = 1;
+    m->io_num.n_output = 3;
+    set_attr(&m->input_attr, 0, 1, mock_size, mock_size, 3, RKNN_TENSOR_NHWC, RKNN_TENSOR_UINT8);
+    for (int h = 0; h < 3; h++) {
+        int grid = mock_size / (8 << h);
+
+        set_attr(&m->output_attrs[h], h, 1, PROP_BOX_SIZE * 3, grid, grid, RKNN_TENSOR_NCHW,
+                 RKNN_TENSOR_INT8);
+        frame_size += m->output_attrs[h].size;
+    }
+    m->data = (uint8_t *)malloc(frame_size * MOCK_SYNTH);
+    if (!m->data)
+        return -1;
+    memset(m->data, (uint8_t)MOCK_LOW, frame_size * MOCK_SYNTH);
+    for (int f = 0; f < MOCK_SYNTH; f++) {
+        int8_t *heads[3];
+
+        for (int h = 0; h < 3; h++) {
+            heads[h] = (int8_t *)m->data + offset;
+            m->frames.push_back(heads[h]);
+            offset += m->output_attrs[h].size;
+        }
+        for (int o = 0; o < mock_objects; o++) {
+            int h = rnd(&seed) % 3, grid = mock_size / (8 << h), grid_len = grid * grid;
+            int i = rnd(&seed) % grid, j = rnd(&seed) % grid, a = rnd(&seed) % 3;
+            int cls = rnd(&seed) % OBJ_CLASS_NUM;
+            int8_t *p = heads[h] + PROP_BOX_SIZE * a * grid_len + i * grid + j;
+
+            for (int c = 0; c < 4; c++)
+                p[c * grid_len] = (int8_t)(rnd(&seed) % 21) - 10;
+            p[4 * grid_len] = MOCK_HIGH;
+            p[(5 + cls) * grid_len] = MOCK_HIGH;
+        }
+    }
+    return 0;
+}
+
+/* frames of the dump with the size and outputs of its first frame */
+static int dump_model(mock_model_t *m, void *model, uint32_t size)
+{
+    tensordump_reader_t reader;
+    tensordump_view_t v;
+    const tensordump_frame_t *first = NULL;
+
+    m->data = (uint8_t *)malloc(size);
+    if (!m->data)
+        return -1;
+    memcpy(m->data, model, size);
+    tensordump_reader_init(&reader, m->data, size);
+    while (tensordump_next(&reader, &v)) {
+        const tensordump_frame_t *f = v.frame;
+        int same = 1;
+
+        if (!first) {
+            first = f;
+            m->io_num.n_input = 1;
+            m->io_num.n_output = f->n_outputs;
+            set_attr(&m->input_attr, 0, 1, f->model_height, f->model_width, 3, RKNN_TENSOR_NHWC,
+                     RKNN_TENSOR_UINT8);
+            for (int i = 0; i < f->n_outputs; i++) {
+                const tensordump_tensor_t *t = &v.tensors[i];
+                rknn_tensor_attr *attr = &m->output_attrs[i];
+
+                memset(attr, 0, sizeof(*attr));
+                attr->index = t->index;
+                attr->n_dims = t->n_dims;
+                memcpy(attr->dims, t->dims, t->n_dims * sizeof(uint32_t));
+                attr->n_elems = t->size; // int8
+                attr->size = t->size;
+                attr->fmt = (rknn_tensor_format)t->fmt;
+                attr->type = (rknn_tensor_type)t->type;
+                attr->qnt_type = (rknn_tensor_qnt_type)t->qnt_type;
+                attr->fl = t->fl;
+                attr->zp = t->zp;
+                attr->scale = t->scale;
+                snprintf(attr->name, sizeof(attr->name), "dump%d", i);
+            }
+        }
+        if (f->model_width != first->model_width || f->model_height != first->model_height ||
+            f->n_outputs != first->n_outputs)
+            continue;
+        for (int i = 0; i < f->n_outputs; i++)
+            same &= v.tensors[i].size == m->output_attrs[i].size;
+        for (int i = 0; same && i < f->n_outputs; i++)
+            m->frames.push_back(v.data[i]);
+    }
+    if (!first || first->n_outputs < 1 || m->frames.empty()) {
+        fprintf(stderr, "mock: no usable frame in the tensor dump\n");
+        return -1;
+    }
+    fprintf(stderr, "mock: replaying %zu frames of %dx%d\n", m->frames.size() / first->n_outputs,
+            first->model_width, first->model_height);
+    return 0;
+}
+
+static mock_ctx_t *ctx_of(rknn_context context)
+{
+    mock_ctx_t *c = NULL;
+
+    pthread_mutex_lock(&mock_lock);
+    if (context >= 1 && context <= MOCK_MAX_CTX)
+        c = contexts[context - 1];
+    pthread_mutex_unlock(&mock_lock);
+    return c;
+}
+
+static int ctx_new(mock_model_t *m, rknn_context *context)
+{
+    mock_ctx_t *c = (mock_ctx_t *)calloc(1, sizeof(mock_ctx_t));
+    int ret = RKNN_ERR_MALLOC_FAIL;
+
+    if (!c)
+        return ret;
+    c->model = m;
+    c->core = -1;
+    c->width = m->input_attr.dims[2];
+    c->height = m->input_attr.dims[1];
+    pthread_mutex_lock(&mock_lock);
+    for (int i = 0; i < MOCK_MAX_CTX; i++) {
+        if (!contexts[i]) {
+            contexts[i] = c;
+            c->seed = i + 1;
+            m->refs++;
+            *context = i + 1;
+            ret = RKNN_SUCC;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mock_lock);
+    if (ret != RKNN_SUCC)
+        free(c);
+    return ret;
+}
+
+static int mock_init(rknn_context *context, void *model, uint32_t size, uint32_t /* flag */,
+                     rknn_init_extend * /* extend */)
+{
+    mock_model_t *m = new mock_model_t();
+    const tensordump_header_t *hdr = (const tensordump_header_t *)model;
+    int ret;
+
+    m->next.store(0);
+    if (model && size >= sizeof(*hdr) && hdr->magic == TENSORDUMP_MAGIC)
+        ret = dump_model(m, model, size);
+    else
+        ret = synth_model(m);
+    if (ret == 0 && ctx_new(m, context) == RKNN_SUCC)
+        return RKNN_SUCC;
+    free(m->data);
+    delete m;
+    return RKNN_ERR_MODEL_INVALID;
+}
+
+static int mock_dup_context(rknn_context *context_in, rknn_context *context_out)
+{
+    mock_ctx_t *c = ctx_of(*context_in);
+
+    return c ? ctx_new(c->model, context_out) : RKNN_ERR_CTX_INVALID;
+}
+
+static int mock_destroy(rknn_context context)
+{
+    mock_ctx_t *c = ctx_of(context);
+    mock_model_t *m;
+    int last;
+
+    if (!c)
+        return RKNN_ERR_CTX_INVALID;
+    m = c->model;
+    pthread_mutex_lock(&mock_lock);
+    contexts[context - 1] = NULL;
+    last = --m->refs == 0;
+    pthread_mutex_unlock(&mock_lock);
+    for (int i = 0; i < TENSORDUMP_MAX_OUTPUTS; i++)
+        free(c->floats[i]);
+    free(c);
+    if (last) {
+        free(m->data);
+        delete m;
+    }
+    return RKNN_SUCC;
+}
+
+static int mock_query(rknn_context context, rknn_query_cmd cmd, void *info, uint32_t size)
+{
+    mock_ctx_t *c = ctx_of(context);
+    mock_model_t *m;
+    rknn_tensor_attr *attr = (rknn_tensor_attr *)info;
+
+    if (!c)
+        return RKNN_ERR_CTX_INVALID;
+    m = c->model;
+    switch (cmd) {
+    case RKNN_QUERY_IN_OUT_NUM:
+        if (size < sizeof(rknn_input_output_num))
+            return RKNN_ERR_PARAM_INVALID;
+        memcpy(info, &m->io_num, sizeof(m->io_num));
+        return RKNN_SUCC;
+    case RKNN_QUERY_SDK_VERSION:
+    {
+        rknn_sdk_version *version = (rknn_sdk_version *)info;
+
+        if (size < sizeof(rknn_sdk_version))
+            return RKNN_ERR_PARAM_INVALID;
+        snprintf(version->api_version, sizeof(version->api_version), "mock");
+        snprintf(version->drv_version, sizeof(version->drv_version), "mock, %d core(s)", mock_cores);
+        return RKNN_SUCC;
+    }
+    case RKNN_QUERY_INPUT_ATTR:
+    case RKNN_QUERY_CURRENT_INPUT_ATTR:
+        if (size < sizeof(rknn_tensor_attr) || attr->index >= m->io_num.n_input)
+            return RKNN_ERR_PARAM_INVALID;
+        *attr = m->input_attr;
+        return RKNN_SUCC;
+    case RKNN_QUERY_OUTPUT_ATTR:
+    case RKNN_QUERY_CURRENT_OUTPUT_ATTR:
+        if (size < sizeof(rknn_tensor_attr) || attr->index >= m->io_num.n_output)
+            return RKNN_ERR_PARAM_INVALID;
+        *attr = m->output_attrs[attr->index];
+        return RKNN_SUCC;
+    default:
+        /* no dynamic shapes, no custom strings, ... */
+        return RKNN_ERR_FAIL;
+    }
+}
+
+/* like single core NPUs, one core rejects any mask */
+static int mock_set_core_mask(rknn_context context, rknn_core_mask core_mask)
+{
+    mock_ctx_t *c = ctx_of(context);
+    int core;
+
+    if (!c)
+        return RKNN_ERR_CTX_INVALID;
+    if (mock_cores == 1)
+        return RKNN_ERR_DEVICE_UNMATCH;
+    switch (core_mask) {
+    case RKNN_NPU_CORE_0:
+        core = 0;
+        break;
+    case RKNN_NPU_CORE_1:
+        core = 1;
+        break;
+    case RKNN_NPU_CORE_2:
+        core = 2;
+        break;
+    default:
+        core = -1;
+        break;
+    }
+    if (core >= mock_cores)
+        return RKNN_ERR_PARAM_INVALID;
+    c->core = core;
+    return RKNN_SUCC;
+}
+
+static int mock_set_input_shape(rknn_context context, rknn_tensor_attr *attr)
+{
+    mock_ctx_t *c = ctx_of(context);
+
+    if (!c)
+        return RKNN_ERR_CTX_INVALID;
+    if (attr->fmt == RKNN_TENSOR_NCHW) {
+        c->height = attr->dims[2];
+        c->width = attr->dims[3];
+    } else {
+        c->height = attr->dims[1];
+        c->width = attr->dims[2];
+    }
+    return RKNN_SUCC;
+}
+
+static int mock_inputs_set(rknn_context context, uint32_t n_inputs, rknn_input inputs[])
+{
+    mock_ctx_t *c = ctx_of(context);
+
+    if (!c)
+        return RKNN_ERR_CTX_INVALID;
+    if (n_inputs < c->model->io_num.n_input || !inputs[0].buf)
+        return RKNN_ERR_INPUT_INVALID;
+    return RKNN_SUCC;
+}
+
+static int free_core(int core)
+{
+    if (core >= 0)
+        return core_busy[core] ? -1 : core;
+    for (int i = 0; i < mock_cores; i++) {
+        if (!core_busy[i])
+            return i;
+    }
+    return -1;
+}
+
+static int mock_run(rknn_context context, rknn_run_extend * /* extend */)
+{
+    mock_ctx_t *c = ctx_of(context);
+    mock_model_t *m;
+    struct timespec ts;
+    double ms;
+    int core;
+
+    if (!c)
+        return RKNN_ERR_CTX_INVALID;
+    m = c->model;
+    ms = (double)mock_ms * c->width * c->height / MOCK_REF_AREA;
+    if (mock_jitter > 0)
+        ms += mock_jitter * ((rnd(&c->seed) % 2001) / 1000.0 - 1.0);
+    if (ms < 0)
+        ms = 0;
+
+    pthread_mutex_lock(&mock_lock);
+    while ((core = free_core(c->core)) < 0)
+        pthread_cond_wait(&mock_cond, &mock_lock);
+    core_busy[core] = 1;
+    pthread_mutex_unlock(&mock_lock);
+
+    ts.tv_sec = (time_t)(ms / 1000);
+    ts.tv_nsec = (long)((ms - ts.tv_sec * 1000.0) * 1e6);
+    while (nanosleep(&ts, &ts) < 0)
+        ;
+
+    pthread_mutex_lock(&mock_lock);
+    core_busy[core] = 0;
+    pthread_cond_broadcast(&mock_cond);
+    pthread_mutex_unlock(&mock_lock);
+
+    c->frame = m->next.fetch_add(1) % (m->frames.size() / m->io_num.n_output);
+    return RKNN_SUCC;
+}
+
+static int mock_outputs_get(rknn_context context, uint32_t n_outputs, rknn_output outputs[],
+                            rknn_output_extend * /* extend */)
+{
+    mock_ctx_t *c = ctx_of(context);
+    mock_model_t *m;
+
+    if (!c)
+        return RKNN_ERR_CTX_INVALID;
+    m = c->model;
+    if (n_outputs > m->io_num.n_output)
+        return RKNN_ERR_OUTPUT_INVALID;
+    for (uint32_t i = 0; i < n_outputs; i++) {
+        const rknn_tensor_attr *attr = &m->output_attrs[i];
+        const int8_t *q = m->frames[c->frame * m->io_num.n_output + i];
+
+        outputs[i].index = i;
+        if (!outputs[i].want_float || attr->type != RKNN_TENSOR_INT8) {
+            outputs[i].buf = (void *)q;
+            outputs[i].size = attr->size;
+            continue;
+        }
+        if (!c->floats[i])
+            c->floats[i] = (float *)malloc(attr->size * sizeof(float));
+        if (!c->floats[i])
+            return RKNN_ERR_MALLOC_FAIL;
+        for (uint32_t j = 0; j < attr->size; j++)
+            c->floats[i][j] = ((float)q[j] - attr->zp) * attr->scale;
+        outputs[i].buf = c->floats[i];
+        outputs[i].size = attr->size * sizeof(float);
+    }
+    return RKNN_SUCC;
+}
+
+static int mock_outputs_release(rknn_context context, uint32_t /* n_outputs */,
+                                rknn_output /* outputs */[])
+{
+    return ctx_of(context) ? RKNN_SUCC : RKNN_ERR_CTX_INVALID;
+}
+
+const npu_backend_t backend_mock = {
+    "mock",
+    mock_init,
+    mock_dup_context,
+    mock_destroy,
+    mock_query,
+    mock_set_core_mask,
+    mock_set_input_shape,
+    mock_inputs_set,
+    mock_run,
+    mock_outputs_get,
+    mock_outputs_release,
+};
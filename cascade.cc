@@ -0,0 +1,117 @@
+/*
+ * ff-rknn - second stage classifier
+ *
+ * Classifier outputs are read as float (the runtime dequantizes), one row
+ * of `classes` scores per crop. Rows that do not look like probabilities
+ * are turned into them with a softmax.
+ */
+
+#include "cascade.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+int cascade_init(cascade_t *c, unsigned char *model_data, int model_data_size, int contexts)
+{
+    rknn_tensor_attr *in, *out;
+
+    c->runs.store(0);
+    c->crops.store(0);
+    if (npu_pool_init(&c->pool, model_data, model_data_size, contexts) < 0)
+        return -1;
+
+    in = &c->pool.input_attr;
+    out = &c->pool.output_attrs[0];
+    c->batch = in->n_dims == 4 && in->dims[0] > 0 ? in->dims[0] : 1;
+    if (c->batch > CASCADE_MAX_CROPS)
+        c->batch = CASCADE_MAX_CROPS;
+    c->crop_size = c->pool.width * c->pool.height * c->pool.channel;
+    c->classes = out->n_elems / c->batch;
+    if (c->pool.io_num.n_output < 1 || c->classes < 1) {
+        fprintf(stderr, "cascade: model output not usable as classifier\n");
+        return -1;
+    }
+    fprintf(stderr, "cascade: %dx%dx%d, batch %d, %d classes\n", c->pool.width, c->pool.height,
+            c->pool.channel, c->batch, c->classes);
+    return 0;
+}
+
+static void best_class(const float *score, int classes, int *cls, float *prop)
+{
+    float max = score[0], sum = 0;
+    int probabilities = 1;
+    int best = 0;
+
+    for (int i = 0; i < classes; i++) {
+        if (score[i] > max) {
+            max = score[i];
+            best = i;
+        }
+        if (score[i] < 0 || score[i] > 1)
+            probabilities = 0;
+        sum += score[i];
+    }
+    *cls = best;
+    if (probabilities && fabsf(sum - 1.0f) < 0.05f) {
+        *prop = max;
+        return;
+    }
+    sum = 0;
+    for (int i = 0; i < classes; i++)
+        sum += expf(score[i] - max);
+    *prop = 1.0f / sum;
+}
+
+/*
+ * crops holds count crops and room for a full last batch; the padding of
+ * a short batch is run too but its rows are ignored.
+ */
+int cascade_classify(cascade_t *c, uint8_t *crops, int count, int *cls, float *prop)
+{
+    npu_pool_t *pool = &c->pool;
+
+    for (int first = 0; first < count; first += c->batch) {
+        int n = count - first < c->batch ? count - first : c->batch;
+        rknn_input inputs[1];
+        rknn_output outputs[1];
+        npu_ctx_t *nctx;
+        int ret;
+
+        memset(inputs, 0, sizeof(inputs));
+        inputs[0].index = 0;
+        inputs[0].type = RKNN_TENSOR_UINT8;
+        inputs[0].size = c->crop_size * c->batch;
+        inputs[0].fmt = RKNN_TENSOR_NHWC;
+        inputs[0].pass_through = 0;
+        inputs[0].buf = crops + (size_t)first * c->crop_size;
+
+        memset(outputs, 0, sizeof(outputs));
+        outputs[0].want_float = 1;
+
+        nctx = npu_pool_acquire(pool);
+        ret = pool->backend->inputs_set(nctx->ctx, 1, inputs);
+        if (ret >= 0)
+            ret = pool->backend->run(nctx->ctx, NULL);
+        if (ret >= 0)
+            ret = pool->backend->outputs_get(nctx->ctx, 1, outputs, NULL);
+        if (ret < 0) {
+            npu_pool_release(pool, nctx);
+            fprintf(stderr, "cascade: rknn error ret=%d\n", ret);
+            return -1;
+        }
+        for (int i = 0; i < n; i++)
+            best_class((float *)outputs[0].buf + i * c->classes, c->classes,
+                       &cls[first + i], &prop[first + i]);
+        pool->backend->outputs_release(nctx->ctx, 1, outputs);
+        npu_pool_release(pool, nctx);
+        c->runs++;
+        c->crops += n;
+    }
+    return 0;
+}
+
+void cascade_deinit(cascade_t *c)
+{
+    npu_pool_deinit(&c->pool);
+}
@@ -0,0 +1,31 @@
+#ifndef _FF_RKNN_CASCADE_H_
+#define _FF_RKNN_CASCADE_H_
+
+#include <atomic>
+#include <stdint.h>
+
+#include "npu_pool.h"
+
+#define CASCADE_MAX_CROPS 64
+
+/*
+ * Second stage classifier run on the detections of the first model:
+ * crops are packed back to back (NHWC, RGB) and run in batches of the
+ * model batch size on a context of its own pool, so the detector keeps
+ * its NPU contexts.
+ */
+typedef struct _cascade_t
+{
+    npu_pool_t pool;
+    int batch;     // crops per rknn_run, dims[0] of the model input
+    int crop_size; // bytes per crop
+    int classes;
+    std::atomic<uint64_t> runs;
+    std::atomic<uint64_t> crops;
+} cascade_t;
+
+int cascade_init(cascade_t *c, unsigned char *model_data, int model_data_size, int contexts);
+int cascade_classify(cascade_t *c, uint8_t *crops, int count, int *cls, float *prop);
+void cascade_deinit(cascade_t *c);
+
+#endif //_FF_RKNN_CASCADE_H_
@@ -0,0 +1,134 @@
+/*
+ * detlog-query - read a binary detection log written by ff-rknn -D
+ *
+ *   detlog-query [-c class] [-s stream] [-f from_sec] [-t to_sec] [-a min_perc]
+ *                [-l labels] [-n] log.bin
+ *
+ * Prints "stream pts frame class score left top right bottom" per match,
+ * -n only counts. Blocks ruled out by the index are never touched.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "detlog.h"
+
+#define LABELS_DEFAULT "./model/coco_80_labels_list.txt"
+
+static char labels[OBJ_CLASS_NUM][64];
+
+static void load_labels(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    int n = 0;
+
+    if (!fp)
+        return;
+    while (n < OBJ_CLASS_NUM && fgets(labels[n], sizeof(labels[n]), fp)) {
+        labels[n][strcspn(labels[n], "\r\n")] = 0;
+        n++;
+    }
+    fclose(fp);
+}
+
+static int class_id(const char *name)
+{
+    char *end;
+    long id = strtol(name, &end, 10);
+
+    if (!*end)
+        return id;
+    for (int i = 0; i < OBJ_CLASS_NUM; i++) {
+        if (!strcmp(labels[i], name))
+            return i;
+    }
+    return -2;
+}
+
+static void print_record(const detlog_record_t *rec, void * /* opaque */)
+{
+    const char *name = rec->cls_id < OBJ_CLASS_NUM && labels[rec->cls_id][0] ? labels[rec->cls_id] : "?";
+
+    printf("%u %.6f %u %s %.2f %d %d %d %d\n", rec->stream,
+           rec->pts == INT64_MIN ? -1.0 : rec->pts / 1e6, rec->frame, name, rec->score / 255.0,
+           rec->box[0], rec->box[1], rec->box[2], rec->box[3]);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: detlog-query [-c class] [-s stream] [-f from_sec] [-t to_sec]\n"
+                    "                    [-a min_perc] [-l labels] [-n] log.bin\n");
+}
+
+int main(int argc, char *argv[])
+{
+    detlog_reader_t reader;
+    detlog_query_t query;
+    const char *labels_path = LABELS_DEFAULT;
+    const char *cls = NULL;
+    uint64_t found, scanned;
+    int count_only = 0;
+    int opt;
+
+    query.t0 = INT64_MIN;
+    query.t1 = INT64_MAX;
+    query.cls_id = -1;
+    query.stream = -1;
+    query.min_score = 0;
+    while ((opt = getopt(argc, argv, "c:s:f:t:a:l:n")) != -1) {
+        switch (opt) {
+        case 'c':
+            cls = optarg;
+            break;
+        case 's':
+            query.stream = atoi(optarg);
+            break;
+        case 'f':
+            query.t0 = (int64_t)(atof(optarg) * 1e6);
+            break;
+        case 't':
+            query.t1 = (int64_t)(atof(optarg) * 1e6);
+            break;
+        case 'a':
+            query.min_score = atoi(optarg) * 255 / 100;
+            break;
+        case 'l':
+            labels_path = optarg;
+            break;
+        case 'n':
+            count_only = 1;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        return 1;
+    }
+
+    load_labels(labels_path);
+    if (cls) {
+        query.cls_id = class_id(cls);
+        if (query.cls_id < 0 || query.cls_id >= OBJ_CLASS_NUM) {
+            fprintf(stderr, "Unknown class: %s\n", cls);
+            return 1;
+        }
+    }
+    if (detlog_reader_open(&reader, argv[optind]) < 0) {
+        fprintf(stderr, "Cannot read detection log %s\n", argv[optind]);
+        return 1;
+    }
+
+    found = detlog_query(&reader, &query, count_only ? NULL : print_record, NULL, &scanned);
+    fprintf(stderr, "%llu match(es), %llu of %llu records read, %llu index entries\n",
+            (unsigned long long)found, (unsigned long long)scanned,
+            (unsigned long long)reader.count, (unsigned long long)reader.nb_index);
+    if (count_only)
+        printf("%llu\n", (unsigned long long)found);
+    detlog_reader_close(&reader);
+    return 0;
+}
@@ -0,0 +1,289 @@
+/*
+ * ff-rknn - binary detection log
+ *
+ * Fixed size records appended in blocks of up to DETLOG_BLOCK, one
+ * write() per block. Every block also appends a zone map entry (pts
+ * range, class and stream bits) to <log>.idx so readers skip the blocks
+ * that cannot match. Records past the last index entry, e.g. after a
+ * crash, are still found by scanning them.
+ */
+
+#include "detlog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    while (size) {
+        ssize_t n = write(fd, p, size);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int write_header(int fd, uint32_t magic, uint16_t record_size)
+{
+    detlog_header_t hdr;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = magic;
+    hdr.version = DETLOG_VERSION;
+    hdr.record_size = record_size;
+    hdr.header_size = sizeof(hdr);
+    hdr.created = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    return write_all(fd, &hdr, sizeof(hdr));
+}
+
+static void block_reset(detlog_t *log)
+{
+    memset(&log->block, 0, sizeof(log->block));
+    log->block.first = log->records;
+    log->block.min_pts = INT64_MAX;
+    log->block.max_pts = INT64_MIN;
+    log->batch_count = 0;
+}
+
+detlog_t *detlog_open(const char *path)
+{
+    detlog_t *log = (detlog_t *)calloc(1, sizeof(detlog_t));
+    char idx_path[4096];
+
+    if (!log)
+        return NULL;
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+    log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    log->idx_fd = open(idx_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (log->fd < 0 || log->idx_fd < 0 ||
+        write_header(log->fd, DETLOG_MAGIC, sizeof(detlog_record_t)) < 0 ||
+        write_header(log->idx_fd, DETLOG_INDEX_MAGIC, sizeof(detlog_index_t)) < 0) {
+        fprintf(stderr, "detlog: %s: %s\n", path, strerror(errno));
+        if (log->fd >= 0)
+            close(log->fd);
+        if (log->idx_fd >= 0)
+            close(log->idx_fd);
+        free(log);
+        return NULL;
+    }
+    pthread_mutex_init(&log->lock, NULL);
+    log->last_flush = now_ms();
+    block_reset(log);
+    return log;
+}
+
+/* records first, so an index entry never points past the end of the log */
+static void detlog_flush(detlog_t *log)
+{
+    log->last_flush = now_ms();
+    if (!log->batch_count)
+        return;
+    if (write_all(log->fd, log->batch, log->batch_count * sizeof(detlog_record_t)) < 0) {
+        fprintf(stderr, "detlog: write failed: %s\n", strerror(errno));
+    } else {
+        log->records += log->batch_count;
+        log->block.count = log->batch_count;
+        write_all(log->idx_fd, &log->block, sizeof(log->block));
+    }
+    block_reset(log);
+}
+
+static int16_t clamp16(int v)
+{
+    return v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v;
+}
+
+void detlog_append(detlog_t *log, int stream, uint32_t frame, const detect_result_group_t *group)
+{
+    pthread_mutex_lock(&log->lock);
+    for (int i = 0; i < group->count; i++) {
+        const detect_result_t *det_result = &group->results[i];
+        detlog_record_t *rec = &log->batch[log->batch_count++];
+        float prop = det_result->prop < 0 ? 0 : det_result->prop > 1 ? 1 : det_result->prop;
+
+        rec->pts = group->pts;
+        rec->frame = frame;
+        rec->stream = stream;
+        rec->cls_id = det_result->cls_id;
+        rec->score = (uint8_t)(prop * 255.0f + 0.5f);
+        rec->box[0] = clamp16(det_result->box.left);
+        rec->box[1] = clamp16(det_result->box.top);
+        rec->box[2] = clamp16(det_result->box.right);
+        rec->box[3] = clamp16(det_result->box.bottom);
+
+        if (rec->pts < log->block.min_pts)
+            log->block.min_pts = rec->pts;
+        if (rec->pts > log->block.max_pts)
+            log->block.max_pts = rec->pts;
+        log->block.classes[(rec->cls_id >> 6) & 1] |= 1ULL << (rec->cls_id & 63);
+        log->block.streams |= 1U << (stream & 31);
+
+        if (log->batch_count == DETLOG_BLOCK)
+            detlog_flush(log);
+    }
+    if (now_ms() - log->last_flush >= DETLOG_FLUSH_MS)
+        detlog_flush(log);
+    pthread_mutex_unlock(&log->lock);
+}
+
+void detlog_close(detlog_t *log)
+{
+    if (!log)
+        return;
+    detlog_flush(log);
+    close(log->fd);
+    close(log->idx_fd);
+    pthread_mutex_destroy(&log->lock);
+    free(log);
+}
+
+static const uint8_t *map_file(const char *path, uint32_t magic, size_t *size)
+{
+    const detlog_header_t *hdr;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(detlog_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    hdr = (const detlog_header_t *)map;
+    if (hdr->magic != magic || hdr->version != DETLOG_VERSION) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *size = st.st_size;
+    return (const uint8_t *)map;
+}
+
+int detlog_reader_open(detlog_reader_t *reader, const char *path)
+{
+    const detlog_header_t *hdr;
+    char idx_path[4096];
+
+    memset(reader, 0, sizeof(*reader));
+    reader->map = map_file(path, DETLOG_MAGIC, &reader->size);
+    if (!reader->map)
+        return -1;
+    hdr = (const detlog_header_t *)reader->map;
+    if (hdr->record_size != sizeof(detlog_record_t) || hdr->header_size > reader->size) {
+        detlog_reader_close(reader);
+        return -1;
+    }
+    reader->records = (const detlog_record_t *)(reader->map + hdr->header_size);
+    reader->count = (reader->size - hdr->header_size) / sizeof(detlog_record_t);
+
+    /* without an index every record is scanned */
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+    reader->idx_map = map_file(idx_path, DETLOG_INDEX_MAGIC, &reader->idx_size);
+    if (reader->idx_map) {
+        hdr = (const detlog_header_t *)reader->idx_map;
+        reader->index = (const detlog_index_t *)(reader->idx_map + hdr->header_size);
+        reader->nb_index = (reader->idx_size - hdr->header_size) / sizeof(detlog_index_t);
+    }
+    return 0;
+}
+
+static int record_match(const detlog_record_t *rec, const detlog_query_t *q)
+{
+    return rec->pts >= q->t0 && rec->pts <= q->t1 &&
+           (q->cls_id < 0 || rec->cls_id == q->cls_id) &&
+           (q->stream < 0 || rec->stream == q->stream) &&
+           rec->score >= q->min_score;
+}
+
+static int block_match(const detlog_index_t *idx, const detlog_query_t *q)
+{
+    if (idx->max_pts < q->t0 || idx->min_pts > q->t1)
+        return 0;
+    if (q->cls_id >= 0 && !(idx->classes[(q->cls_id >> 6) & 1] & (1ULL << (q->cls_id & 63))))
+        return 0;
+    if (q->stream >= 0 && !(idx->streams & (1U << (q->stream & 31))))
+        return 0;
+    return 1;
+}
+
+static uint64_t scan(const detlog_reader_t *reader, uint64_t first, uint64_t count,
+                     const detlog_query_t *q, void (*cb)(const detlog_record_t *, void *),
+                     void *opaque)
+{
+    uint64_t found = 0;
+
+    if (first >= reader->count)
+        return 0;
+    if (count > reader->count - first)
+        count = reader->count - first;
+    for (uint64_t i = first; i < first + count; i++) {
+        if (record_match(&reader->records[i], q)) {
+            found++;
+            if (cb)
+                cb(&reader->records[i], opaque);
+        }
+    }
+    return found;
+}
+
+uint64_t detlog_query(const detlog_reader_t *reader, const detlog_query_t *query,
+                      void (*cb)(const detlog_record_t *rec, void *opaque), void *opaque,
+                      uint64_t *scanned)
+{
+    uint64_t found = 0, indexed = 0, read = 0;
+
+    for (uint64_t i = 0; i < reader->nb_index; i++) {
+        const detlog_index_t *idx = &reader->index[i];
+
+        if (idx->first != indexed || idx->first + idx->count > reader->count)
+            break; // torn index: scan the rest
+        indexed += idx->count;
+        if (!block_match(idx, query))
+            continue;
+        found += scan(reader, idx->first, idx->count, query, cb, opaque);
+        read += idx->count;
+    }
+    found += scan(reader, indexed, reader->count - indexed, query, cb, opaque);
+    read += reader->count - indexed;
+    if (scanned)
+        *scanned = read;
+    return found;
+}
+
+void detlog_reader_close(detlog_reader_t *reader)
+{
+    if (reader->map)
+        munmap((void *)reader->map, reader->size);
+    if (reader->idx_map)
+        munmap((void *)reader->idx_map, reader->idx_size);
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,102 @@
+#ifndef _FF_RKNN_DETLOG_H_
+#define _FF_RKNN_DETLOG_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "postprocess.h"
+
+#define DETLOG_MAGIC       0x4c445246 // "FRDL"
+#define DETLOG_INDEX_MAGIC 0x49445246 // "FRDI"
+#define DETLOG_VERSION     1
+#define DETLOG_BLOCK       4096 // records per write and per index entry, at most
+#define DETLOG_FLUSH_MS    2000 // partial blocks are written after this
+
+typedef struct _detlog_header_t
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t header_size; // records start here
+    uint32_t reserved;
+    int64_t created; // unix time, microseconds
+    int64_t reserved2;
+} detlog_header_t;
+
+/*
+ * One detection, 24 bytes. Records are in write order: with -j the workers
+ * of a file share its stream id and interleave, so within a stream they
+ * are not in pts order; worker w numbers its frames from w << 24.
+ */
+typedef struct _detlog_record_t
+{
+    int64_t pts; // microseconds, INT64_MIN: unknown
+    uint32_t frame; // inferred frame number of the stream, groups the records of a frame
+    uint16_t stream;
+    uint8_t cls_id;
+    uint8_t score; // prop * 255
+    int16_t box[4]; // left, top, right, bottom
+} detlog_record_t;
+
+/*
+ * Sparse index, one entry per written block of records (the <log>.idx
+ * file): a query only reads the blocks whose pts range, classes and
+ * streams can match.
+ */
+typedef struct _detlog_index_t
+{
+    uint64_t first; // record number
+    uint32_t count;
+    uint32_t streams; // bit (stream id % 32)
+    int64_t min_pts;
+    int64_t max_pts;
+    uint64_t classes[2]; // bit per class id
+} detlog_index_t;
+
+typedef struct _detlog_t
+{
+    int fd;
+    int idx_fd;
+    uint64_t records;
+    detlog_record_t batch[DETLOG_BLOCK];
+    int batch_count;
+    detlog_index_t block;
+    int64_t last_flush; // ms
+    pthread_mutex_t lock;
+} detlog_t;
+
+/* writer, shared by the stream threads */
+detlog_t *detlog_open(const char *path);
+void detlog_append(detlog_t *log, int stream, uint32_t frame, const detect_result_group_t *group);
+void detlog_close(detlog_t *log);
+
+typedef struct _detlog_query_t
+{
+    int64_t t0; // pts range, inclusive
+    int64_t t1;
+    int cls_id; // -1: any
+    int stream; // -1: any
+    int min_score; // 0 ~ 255
+} detlog_query_t;
+
+typedef struct _detlog_reader_t
+{
+    const uint8_t *map;
+    size_t size;
+    const detlog_record_t *records;
+    uint64_t count;
+    const uint8_t *idx_map;
+    size_t idx_size;
+    const detlog_index_t *index;
+    uint64_t nb_index;
+} detlog_reader_t;
+
+/* reader: mmaps the log and its index, the index is optional */
+int detlog_reader_open(detlog_reader_t *reader, const char *path);
+uint64_t detlog_query(const detlog_reader_t *reader, const detlog_query_t *query,
+                      void (*cb)(const detlog_record_t *rec, void *opaque), void *opaque,
+                      uint64_t *scanned);
+void detlog_reader_close(detlog_reader_t *reader);
+
+#endif //_FF_RKNN_DETLOG_H_
@@ -0,0 +1,588 @@
+/*
+ * ff-rknn-bench - microbenchmarks of the CPU kernels around the NPU
+ *
+ *   ff-rknn-bench [-f filter] [-t seconds] [-r repetitions] [-d dump.bin] [-o results.json]
+ *
+ * YOLOv5 post-processing (post_process() and its process(), quick sort
+ * and nms() steps) on synthetic int8 output tensors at 320, 640 and 1280
+ * input sizes, each with no candidate (empty), a few objects (sparse) and
+ * a crowd; then the burn-in kernels and, built with -DHAVE_SWSCALE=1, the
+ * swscale conversion of a decoded frame into the model input. -d adds
+ * post_process() over the real frames of an ff-rknn -dump. -f keeps the
+ * benchmarks whose name contains the filter. The table goes to stdout, -o
+ * writes JSON in the Google Benchmark layout so its compare.py can diff
+ * two runs, e.g. x86 against RK3588 or before/after a change.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+
+/* the steps of post_process() are static */
+#include "postprocess.cc"
+#include "annotate.h"
+#include "tensordump.h"
+
+#ifndef HAVE_SWSCALE
+#define HAVE_SWSCALE 0
+#endif
+
+#if HAVE_SWSCALE
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+/* synthetic tensors: zero point and scale of the three heads */
+#define QNT_ZP    0
+#define QNT_SCALE 0.05f
+#define Q_LOW     -100 // sigmoid 0.007, below any threshold
+#define Q_HIGH    40   // sigmoid 0.88
+
+#define CANDIDATE_CELLS 2 // an object lights up 2x2 cells, all 3 anchors
+
+typedef struct _density_t
+{
+    const char *name;
+    int objects; // per image, whatever its size
+} density_t;
+
+static const density_t densities[] = {
+    { "empty", 0 },
+    { "sparse", 4 },
+    { "crowd", 48 },
+};
+
+static const int input_sizes[] = { 320, 640, 1280 };
+
+typedef struct _tensors_t
+{
+    int size;
+    int8_t *heads[3];
+    std::vector<int32_t> zps;
+    std::vector<float> scales;
+    /* process() of the three heads, sorted: the input of nms() */
+    std::vector<float> boxes;
+    std::vector<float> probs;
+    std::vector<float> raw_probs; // in process() order
+    std::vector<int> classes;
+    std::vector<int> order;
+    std::set<int> class_set;
+} tensors_t;
+
+static double min_time = 0.5;
+static int repetitions = 5;
+static const char *filter;
+static FILE *json;
+static int json_count;
+static volatile int64_t sink;
+
+static int64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t rnd(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static void tensors_init(tensors_t *t, int size, int objects)
+{
+    uint32_t seed = size * 131 + objects;
+
+    t->size = size;
+    for (int h = 0; h < 3; h++) {
+        int grid = size / (8 << h);
+
+        t->heads[h] = (int8_t *)malloc(PROP_BOX_SIZE * 3 * grid * grid);
+        memset(t->heads[h], Q_LOW, PROP_BOX_SIZE * 3 * grid * grid);
+        t->zps.push_back(QNT_ZP);
+        t->scales.push_back(QNT_SCALE);
+    }
+    for (int o = 0; o < objects; o++) {
+        int h = rnd(&seed) % 3, grid = size / (8 << h);
+        int gi = rnd(&seed) % (grid - 1), gj = rnd(&seed) % (grid - 1);
+        int cls = rnd(&seed) % 4, grid_len = grid * grid;
+
+        for (int i = gi; i < gi + CANDIDATE_CELLS; i++) {
+            for (int j = gj; j < gj + CANDIDATE_CELLS; j++) {
+                for (int a = 0; a < 3; a++) {
+                    int8_t *p = t->heads[h] + PROP_BOX_SIZE * a * grid_len + i * grid + j;
+
+                    for (int c = 0; c < 4; c++)
+                        p[c * grid_len] = (int8_t)(rnd(&seed) % 21) - 10;
+                    p[4 * grid_len] = Q_HIGH + rnd(&seed) % 20;
+                    p[(5 + cls) * grid_len] = Q_HIGH + rnd(&seed) % 20;
+                }
+            }
+        }
+    }
+
+    for (int h = 0; h < 3; h++) {
+        int stride = 8 << h, grid = size / stride;
+        const int *anchor = h == 0 ? anchor0 : h == 1 ? anchor1 : anchor2;
+
+        process(t->heads[h], (int *)anchor, grid, grid, size, size, stride, t->boxes, t->probs,
+                t->classes, BOX_THRESH, QNT_ZP, QNT_SCALE);
+    }
+    t->raw_probs = t->probs;
+    for (int i = 0; i < (int)t->probs.size(); i++)
+        t->order.push_back(i);
+    if (!t->probs.empty())
+        quick_sort_indice_inverse(t->probs, 0, t->probs.size() - 1, t->order);
+    t->class_set.insert(t->classes.begin(), t->classes.end());
+}
+
+static void tensors_free(tensors_t *t)
+{
+    for (int h = 0; h < 3; h++)
+        free(t->heads[h]);
+}
+
+/*
+ * Time fn(arg): grow the batch until it runs min_time / repetitions, then
+ * keep the median of the repetitions. items: work units per call (0: none).
+ */
+static void bench(const char *name, void (*fn)(void *arg), void *arg, int64_t bytes, int64_t items)
+{
+    double real[16], cpu[16], median_real, median_cpu;
+    double target = min_time / repetitions * 1e9;
+    int64_t iters = 1, t0, c0;
+    int reps = repetitions < 16 ? repetitions : 16;
+
+    if (filter && !strstr(name, filter))
+        return;
+    fn(arg); // warm up caches and lazy allocations
+    for (;;) {
+        t0 = now_ns(CLOCK_MONOTONIC);
+        for (int64_t i = 0; i < iters; i++)
+            fn(arg);
+        if (now_ns(CLOCK_MONOTONIC) - t0 >= target / 10 || iters >= (1LL << 40))
+            break;
+        iters *= 10;
+    }
+    iters = iters * target / (now_ns(CLOCK_MONOTONIC) - t0 + 1) + 1;
+    for (int r = 0; r < reps; r++) {
+        t0 = now_ns(CLOCK_MONOTONIC);
+        c0 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+        for (int64_t i = 0; i < iters; i++)
+            fn(arg);
+        cpu[r] = (double)(now_ns(CLOCK_THREAD_CPUTIME_ID) - c0) / iters;
+        real[r] = (double)(now_ns(CLOCK_MONOTONIC) - t0) / iters;
+    }
+    /* insertion sort, a handful of values */
+    for (int i = 1; i < reps; i++) {
+        for (int j = i; j > 0 && real[j] < real[j - 1]; j--) {
+            double v = real[j];
+
+            real[j] = real[j - 1];
+            real[j - 1] = v;
+        }
+        for (int j = i; j > 0 && cpu[j] < cpu[j - 1]; j--) {
+            double v = cpu[j];
+
+            cpu[j] = cpu[j - 1];
+            cpu[j - 1] = v;
+        }
+    }
+    median_real = real[reps / 2];
+    median_cpu = cpu[reps / 2];
+
+    printf("%-36s %12.1f ns %12.1f ns (min) %10lld it", name, median_real, real[0], (long long)iters);
+    if (bytes)
+        printf(" %9.1f MB/s", bytes / median_real * 1e3);
+    if (items)
+        printf(" %7lld items", (long long)items);
+    printf("\n");
+    fflush(stdout);
+
+    if (!json)
+        return;
+    fprintf(json, "%s    {\n"
+                  "      \"name\": \"%s\",\n"
+                  "      \"run_name\": \"%s\",\n"
+                  "      \"run_type\": \"iteration\",\n"
+                  "      \"repetitions\": %d,\n"
+                  "      \"iterations\": %lld,\n"
+                  "      \"real_time\": %.3f,\n"
+                  "      \"cpu_time\": %.3f,\n"
+                  "      \"min_real_time\": %.3f,\n"
+                  "      \"time_unit\": \"ns\"",
+            json_count++ ? ",\n" : "", name, name, reps, (long long)iters, median_real, median_cpu, real[0]);
+    if (bytes)
+        fprintf(json, ",\n      \"bytes_per_second\": %.1f", bytes / median_real * 1e9);
+    if (items)
+        fprintf(json, ",\n      \"items\": %lld", (long long)items);
+    fprintf(json, "\n    }");
+}
+
+/* --- post-processing --- */
+
+static void run_post_process(void *arg)
+{
+    tensors_t *t = (tensors_t *)arg;
+    detect_result_group_t group;
+
+    post_process(t->heads[0], t->heads[1], t->heads[2], t->size, t->size, BOX_THRESH, NMS_THRESH,
+                 1.0f, 1.0f, t->zps, t->scales, &group);
+    sink += group.count;
+}
+
+/* the stride 8 head: three quarters of the cells */
+static void run_process(void *arg)
+{
+    tensors_t *t = (tensors_t *)arg;
+    std::vector<float> boxes, probs;
+    std::vector<int> classes;
+    int grid = t->size / 8;
+
+    sink += process(t->heads[0], (int *)anchor0, grid, grid, t->size, t->size, 8, boxes, probs,
+                    classes, BOX_THRESH, QNT_ZP, QNT_SCALE);
+}
+
+/* includes the copy of the scores and a fresh index array, like post_process() builds */
+static void run_quick_sort(void *arg)
+{
+    tensors_t *t = (tensors_t *)arg;
+    std::vector<float> probs(t->raw_probs);
+    std::vector<int> order(probs.size());
+
+    for (int i = 0; i < (int)order.size(); i++)
+        order[i] = i;
+
+    sink += quick_sort_indice_inverse(probs, 0, probs.size() - 1, order);
+}
+
+static void run_nms(void *arg)
+{
+    tensors_t *t = (tensors_t *)arg;
+    std::vector<int> order(t->order);
+
+    for (auto c : t->class_set)
+        nms(order.size(), t->boxes, t->classes, order, c, NMS_THRESH);
+    sink += order[0];
+}
+
+static void bench_post_process(void)
+{
+    char name[64];
+
+    /* process() and friends read the labels for the result names only */
+    for (int i = 0; i < OBJ_CLASS_NUM; i++)
+        labels[i] = strdup("object");
+    init = 0;
+
+    for (size_t s = 0; s < sizeof(input_sizes) / sizeof(input_sizes[0]); s++) {
+        for (size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); d++) {
+            tensors_t t;
+            int size = input_sizes[s];
+            int64_t candidates;
+            int64_t tensor_bytes = 0;
+
+            tensors_init(&t, size, densities[d].objects);
+            candidates = t.probs.size();
+            for (int h = 0; h < 3; h++)
+                tensor_bytes += PROP_BOX_SIZE * 3 * (size / (8 << h)) * (size / (8 << h));
+
+            snprintf(name, sizeof(name), "post_process/%d/%s", size, densities[d].name);
+            bench(name, run_post_process, &t, tensor_bytes, candidates);
+            snprintf(name, sizeof(name), "process/%d/%s", size, densities[d].name);
+            bench(name, run_process, &t, PROP_BOX_SIZE * 3 * (size / 8) * (size / 8), 0);
+            if (candidates > 1) {
+                snprintf(name, sizeof(name), "quick_sort_indice_inverse/%d/%s", size,
+                         densities[d].name);
+                bench(name, run_quick_sort, &t, 0, candidates);
+                snprintf(name, sizeof(name), "nms/%d/%s", size, densities[d].name);
+                bench(name, run_nms, &t, 0, candidates);
+            }
+            tensors_free(&t);
+        }
+    }
+    deinitPostProcess();
+}
+
+/* --- post-processing of dumped NPU outputs --- */
+
+typedef struct _dump_frame_t
+{
+    tensordump_view_t view;
+    std::vector<int32_t> zps;
+    std::vector<float> scales;
+} dump_frame_t;
+
+typedef struct _dump_arg_t
+{
+    std::vector<dump_frame_t> frames;
+    size_t next;
+} dump_arg_t;
+
+/* one frame per call, round robin over the dump */
+static void run_dump(void *arg)
+{
+    dump_arg_t *a = (dump_arg_t *)arg;
+    dump_frame_t *d = &a->frames[a->next++ % a->frames.size()];
+    const tensordump_frame_t *f = d->view.frame;
+    detect_result_group_t group;
+
+    post_process((int8_t *)d->view.data[0], (int8_t *)d->view.data[1], (int8_t *)d->view.data[2],
+                 f->model_height, f->model_width, f->conf_threshold, f->nms_threshold, f->scale_w,
+                 f->scale_h, d->zps, d->scales, &group);
+    sink += group.count;
+}
+
+static void bench_dump(const char *path)
+{
+    tensordump_reader_t reader;
+    dump_arg_t a;
+    dump_frame_t d;
+    int64_t detections = 0;
+
+    if (tensordump_reader_open(&reader, path) < 0) {
+        fprintf(stderr, "Cannot read tensor dump %s\n", path);
+        return;
+    }
+    for (int i = 0; i < OBJ_CLASS_NUM; i++)
+        labels[i] = strdup("object");
+    init = 0;
+    while (tensordump_next(&reader, &d.view)) {
+        if (d.view.frame->n_outputs < 3 || d.view.tensors[0].type != RKNN_TENSOR_INT8)
+            continue;
+        d.zps.clear();
+        d.scales.clear();
+        for (int i = 0; i < d.view.frame->n_outputs; i++) {
+            d.zps.push_back(d.view.tensors[i].zp);
+            d.scales.push_back(d.view.tensors[i].scale);
+        }
+        detections += d.view.frame->count;
+        a.frames.push_back(d);
+    }
+    a.next = 0;
+    if (!a.frames.empty()) {
+        printf("# %s: %zu frames, %.1f detections per frame\n", path, a.frames.size(),
+               (double)detections / a.frames.size());
+        bench("post_process/dump", run_dump, &a, 0, 0);
+    }
+    deinitPostProcess();
+    tensordump_reader_close(&reader);
+}
+
+/* --- burn-in --- */
+
+#define BURN_W 1920
+#define BURN_H 1080
+
+typedef struct _span_arg_t
+{
+    uint8_t *buf;
+    int n;
+    uint8_t pattern[48];
+    int simd;
+} span_arg_t;
+
+static void run_blend_span(void *arg)
+{
+    span_arg_t *a = (span_arg_t *)arg;
+
+    if (a->simd)
+        annotate_blend_span(a->buf, a->n, a->pattern, 128);
+    else
+        annotate_blend_span_c(a->buf, a->n, a->pattern, 128);
+}
+
+typedef struct _burn_arg_t
+{
+    uint8_t *buf;
+    annotate_box_t boxes[16];
+    int count;
+    int nv12;
+} burn_arg_t;
+
+static void run_burn_in(void *arg)
+{
+    burn_arg_t *a = (burn_arg_t *)arg;
+
+    if (a->nv12)
+        annotate_nv12(a->buf, BURN_W, a->buf + BURN_W * BURN_H, BURN_W, BURN_W, BURN_H, a->boxes,
+                      a->count, 128, 2, 2);
+    else
+        annotate_rgb(a->buf, BURN_W, BURN_H, BURN_W * 3, a->boxes, a->count, 128, 2, 2);
+}
+
+static void bench_annotate(void)
+{
+    span_arg_t span;
+    burn_arg_t burn;
+    uint32_t seed = 1;
+
+    span.n = BURN_W * 3;
+    span.buf = (uint8_t *)calloc(1, span.n);
+    for (int i = 0; i < 48; i++)
+        span.pattern[i] = i * 5;
+    span.simd = 0;
+    bench("annotate_blend_span_c/5760", run_blend_span, &span, span.n, 0);
+    span.simd = 1;
+    bench("annotate_blend_span/5760", run_blend_span, &span, span.n, 0);
+    free(span.buf);
+
+    burn.buf = (uint8_t *)calloc(1, BURN_W * BURN_H * 3);
+    burn.count = 16;
+    for (int i = 0; i < burn.count; i++) {
+        annotate_box_t *b = &burn.boxes[i];
+
+        b->left = rnd(&seed) % (BURN_W - 300);
+        b->top = rnd(&seed) % (BURN_H - 300);
+        b->right = b->left + 40 + rnd(&seed) % 260;
+        b->bottom = b->top + 40 + rnd(&seed) % 260;
+        b->rgb[0] = 255;
+        b->rgb[1] = i * 16;
+        b->rgb[2] = 0;
+        b->label = "person 87%";
+    }
+    burn.nv12 = 0;
+    bench("annotate_rgb/1920x1080/16", run_burn_in, &burn, 0, burn.count);
+    burn.nv12 = 1;
+    bench("annotate_nv12/1920x1080/16", run_burn_in, &burn, 0, burn.count);
+    free(burn.buf);
+}
+
+/* --- model input without RGA --- */
+
+#if HAVE_SWSCALE
+typedef struct _sws_arg_t
+{
+    struct SwsContext *sws;
+    uint8_t *src[4];
+    int src_stride[4];
+    uint8_t *dst[4];
+    int dst_stride[4];
+} sws_arg_t;
+
+static void run_sws(void *arg)
+{
+    sws_arg_t *a = (sws_arg_t *)arg;
+
+    sink += sws_scale(a->sws, a->src, a->src_stride, 0, BURN_H, a->dst, a->dst_stride);
+}
+
+static void bench_swscale(void)
+{
+    char name[64];
+
+    for (size_t s = 0; s < sizeof(input_sizes) / sizeof(input_sizes[0]); s++) {
+        int size = input_sizes[s];
+        sws_arg_t a;
+
+        av_image_alloc(a.src, a.src_stride, BURN_W, BURN_H, AV_PIX_FMT_NV12, 16);
+        av_image_alloc(a.dst, a.dst_stride, size, size, AV_PIX_FMT_RGB24, 16);
+        memset(a.src[0], 128, BURN_W * BURN_H * 3 / 2);
+        a.sws = sws_getContext(BURN_W, BURN_H, AV_PIX_FMT_NV12, size, size, AV_PIX_FMT_RGB24,
+                               SWS_BILINEAR, NULL, NULL, NULL);
+        snprintf(name, sizeof(name), "sws_nv12_rgb24/1920x1080/%d", size);
+        if (a.sws)
+            bench(name, run_sws, &a, size * size * 3, 0);
+        sws_freeContext(a.sws);
+        av_freep(&a.src[0]);
+        av_freep(&a.dst[0]);
+    }
+}
+#endif
+
+static void json_context(char **argv)
+{
+    struct utsname u;
+    char date[64];
+    time_t now = time(NULL);
+
+    uname(&u);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    fprintf(json, "{\n  \"context\": {\n"
+                  "    \"date\": \"%s\",\n"
+                  "    \"host_name\": \"%s\",\n"
+                  "    \"executable\": \"%s\",\n"
+                  "    \"machine\": \"%s\",\n"
+                  "    \"compiler\": \"%s\",\n"
+                  "    \"simd\": \"%s\",\n"
+                  "    \"min_time\": %.3f,\n"
+                  "    \"library_build_type\": \"release\"\n"
+                  "  },\n  \"benchmarks\": [\n",
+            date, u.nodename, argv[0], u.machine, __VERSION__,
+#if defined(__aarch64__) || defined(__ARM_NEON)
+            "neon",
+#elif defined(__SSE2__)
+            "sse2",
+#else
+            "none",
+#endif
+            min_time);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-f filter] [-t seconds] [-r repetitions] [-d dump.bin] [-o results.json]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *json_path = NULL;
+    const char *dump_path = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "f:t:r:d:o:h")) != -1) {
+        switch (c) {
+        case 'f':
+            filter = optarg;
+            break;
+        case 't':
+            min_time = atof(optarg);
+            break;
+        case 'r':
+            repetitions = atoi(optarg);
+            break;
+        case 'd':
+            dump_path = optarg;
+            break;
+        case 'o':
+            json_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (min_time <= 0 || repetitions < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (json_path) {
+        json = fopen(json_path, "w");
+        if (!json) {
+            fprintf(stderr, "cannot write %s\n", json_path);
+            return 1;
+        }
+        json_context(argv);
+    }
+
+    bench_post_process();
+    if (dump_path)
+        bench_dump(dump_path);
+    bench_annotate();
+#if HAVE_SWSCALE
+    bench_swscale();
+#endif
+
+    if (json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    return 0;
+}
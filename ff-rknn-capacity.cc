@@ -0,0 +1,357 @@
+/*
+ * ff-rknn-capacity - how many streams the board sustains
+ *
+ *   ff-rknn-capacity [-c clip] [-s WxH] [-r fps] [-n 1,2,4,...] [-t seconds] [-w warmup]
+ *                    [-l p99_ms] [-o curve.csv] [-b baseline.csv] [-x ./ff-rknn] [-v]
+ *                    [-- ff-rknn options]
+ *
+ * Runs "ff-rknn -H 1 -i clip -vs N,seconds,warmup" for every N of -n and
+ * reads its Bench: line: inferred fps of all the streams against the frame
+ * rate of the clip, latency from the time a camera would have sent each
+ * frame to the sinks, CPU (100 per core) and peak RSS. An N sustains when
+ * it keeps 95% of the target fps and its p99 stays under -l (default 200
+ * ms); the sweep stops after the first N that does not. A missing clip is
+ * generated (-s, -r): 10 s of a moving test pattern, H.264 with the
+ * encoders of -R. The options after -- go to ff-rknn, at least the model, e.g.
+ * "-- -m model.rknn" on RK3588, "-- -sw 1 -backend mock -m any" on a PC.
+ * -o writes the curve as CSV, -b compares it with an earlier one: an N
+ * the baseline sustained falling behind, or an fps or p99 more than 10%
+ * worse at the same N, is a regression and makes the exit status 1.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "recorder.h"
+
+#define CLIP_SECONDS 10
+#define MIN_FPS      0.95 // of the target
+#define TOLERANCE    0.10 // -b: worse than the baseline by more than this
+
+typedef struct _point_t
+{
+    int streams;
+    double fps;
+    double target;
+    double p50_ms;
+    double p99_ms;
+    double max_ms;
+    double cpu;
+    double rss_mb;
+    int ok;
+} point_t;
+
+/* colour bars scrolling left, a block crossing the frame, noise in the lower third */
+static void draw_pattern(uint8_t *rgb, int width, int height, int n)
+{
+    static const uint8_t bars[8][3] = {
+        { 235, 235, 235 }, { 235, 235, 16 }, { 16, 235, 235 }, { 16, 235, 16 },
+        { 235, 16, 235 }, { 235, 16, 16 }, { 16, 16, 235 }, { 16, 16, 16 },
+    };
+    int bw = width / 8 > 0 ? width / 8 : 1, size = height / 4;
+    int bx = (n * 4) % (width + size) - size, by = height / 3;
+    uint32_t seed = n * 2654435761u;
+
+    for (int y = 0; y < height; y++) {
+        uint8_t *p = rgb + (size_t)y * width * 3;
+
+        for (int x = 0; x < width; x++, p += 3) {
+            if (x >= bx && x < bx + size && y >= by && y < by + size) {
+                p[0] = 255;
+                p[1] = 128;
+                p[2] = 0;
+            } else if (y >= height * 2 / 3) {
+                seed = seed * 1664525u + 1013904223u;
+                p[0] = p[1] = p[2] = seed >> 24;
+            } else {
+                memcpy(p, bars[((x + n * 2) / bw) % 8], 3);
+            }
+        }
+    }
+}
+
+static int make_clip(const char *path, int width, int height, int fps)
+{
+    recorder_t *r = (recorder_t *)calloc(1, sizeof(recorder_t));
+    uint8_t *rgb = (uint8_t *)malloc((size_t)width * height * 3);
+    int ret = -1;
+
+    fprintf(stderr, "Generating %s: %dx%d, %d fps, %d s\n", path, width, height, fps, CLIP_SECONDS);
+    if (r && rgb && recorder_open(r, path, -1, width, height, AV_PIX_FMT_RGB24,
+                                  AVRational{ fps, 1 }, 0) == 0) {
+        for (int n = 0; n < fps * CLIP_SECONDS; n++) {
+            draw_pattern(rgb, width, height, n);
+            /* the queue never waits, this one has to */
+            while (recorder_push(r, rgb, (int64_t)n * 1000000 / fps) < 0)
+                usleep(1000);
+        }
+        ret = 0;
+    }
+    if (r)
+        recorder_close(r);
+    free(r);
+    free(rgb);
+    return ret;
+}
+
+/* ff-rknn with its output on a pipe, the Bench: line parsed, the rest shown with -v */
+static int run_point(const char *ffrknn, const char *clip, int streams, int seconds, int warmup,
+                     std::vector<char *> &extra, int verbose, point_t *pt)
+{
+    char vs[64], line[1024];
+    std::vector<char *> args;
+    int fds[2], status, found = 0;
+    FILE *fp;
+    pid_t pid;
+
+    snprintf(vs, sizeof(vs), "%d,%d,%d", streams, seconds, warmup);
+    args.push_back((char *)ffrknn);
+    args.push_back((char *)"-H");
+    args.push_back((char *)"1");
+    args.push_back((char *)"-i");
+    args.push_back((char *)clip);
+    args.push_back((char *)"-vs");
+    args.push_back(vs);
+    args.insert(args.end(), extra.begin(), extra.end());
+    args.push_back(NULL);
+
+    if (pipe(fds) < 0)
+        return -1;
+    pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        /* survives the exec: a run that does not stop on its own is killed */
+        alarm(warmup + seconds + 60);
+        execv(ffrknn, args.data());
+        fprintf(stderr, "%s: %s\n", ffrknn, strerror(errno));
+        _exit(127);
+    }
+    close(fds[1]);
+
+    memset(pt, 0, sizeof(*pt));
+    fp = fdopen(fds[0], "r");
+    while (fp && fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "Bench: streams=%d seconds=%*f fps=%lf target=%lf p50=%lf p99=%lf "
+                         "max=%lf cpu=%lf rss=%lf",
+                   &pt->streams, &pt->fps, &pt->target, &pt->p50_ms, &pt->p99_ms, &pt->max_ms,
+                   &pt->cpu, &pt->rss_mb) == 8)
+            found = 1;
+        if (verbose)
+            fprintf(stderr, "  %s", line);
+    }
+    if (fp)
+        fclose(fp);
+    else
+        close(fds[0]);
+    waitpid(pid, &status, 0);
+    if (!found) {
+        fprintf(stderr, "%d stream(s): no Bench: line from %s (%s %d), -v shows its output\n",
+                streams, ffrknn, WIFSIGNALED(status) ? "signal" : "exit status",
+                WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+        return -1;
+    }
+    return 0;
+}
+
+static void print_point(FILE *fp, const point_t *pt)
+{
+    fprintf(fp, "%7d %8.1f %8.1f %8.1f %8.1f %8.1f %6.0f %8.1f  %s\n", pt->streams, pt->fps,
+            pt->target, pt->p50_ms, pt->p99_ms, pt->max_ms, pt->cpu, pt->rss_mb,
+            pt->ok ? "ok" : "behind");
+}
+
+static int write_csv(const char *path, std::vector<point_t> &curve)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(fp, "streams,fps,target_fps,p50_ms,p99_ms,max_ms,cpu_pct,rss_mb,ok\n");
+    for (size_t i = 0; i < curve.size(); i++) {
+        const point_t *pt = &curve[i];
+
+        fprintf(fp, "%d,%.1f,%.1f,%.2f,%.2f,%.2f,%.0f,%.1f,%d\n", pt->streams, pt->fps, pt->target,
+                pt->p50_ms, pt->p99_ms, pt->max_ms, pt->cpu, pt->rss_mb, pt->ok);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int read_csv(const char *path, std::vector<point_t> &curve)
+{
+    char line[256];
+    FILE *fp = fopen(path, "r");
+
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        point_t pt;
+
+        if (sscanf(line, "%d,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%d", &pt.streams, &pt.fps, &pt.target,
+                   &pt.p50_ms, &pt.p99_ms, &pt.max_ms, &pt.cpu, &pt.rss_mb, &pt.ok) == 9)
+            curve.push_back(pt);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* most streams sustained, 0: none */
+static int capacity(std::vector<point_t> &curve)
+{
+    int n = 0;
+
+    for (size_t i = 0; i < curve.size() && curve[i].ok; i++)
+        n = curve[i].streams;
+    return n;
+}
+
+static int compare(std::vector<point_t> &curve, std::vector<point_t> &base)
+{
+    int regressions = 0;
+
+    for (size_t i = 0; i < curve.size(); i++) {
+        if (!curve[i].ok && curve[i].streams <= capacity(base)) {
+            fprintf(stderr, "regression: %d stream(s) fall behind, baseline sustained %d\n",
+                    curve[i].streams, capacity(base));
+            regressions++;
+        }
+    }
+    for (size_t i = 0; i < curve.size(); i++) {
+        for (size_t j = 0; j < base.size(); j++) {
+            const point_t *a = &curve[i], *b = &base[j];
+
+            if (a->streams != b->streams)
+                continue;
+            if (a->fps < b->fps * (1 - TOLERANCE)) {
+                fprintf(stderr, "regression: %d stream(s) %.1f fps, baseline %.1f\n", a->streams,
+                        a->fps, b->fps);
+                regressions++;
+            }
+            if (a->p99_ms > b->p99_ms * (1 + TOLERANCE) + 1) {
+                fprintf(stderr, "regression: %d stream(s) p99 %.1f ms, baseline %.1f\n",
+                        a->streams, a->p99_ms, b->p99_ms);
+                regressions++;
+            }
+        }
+    }
+    return regressions;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-c clip] [-s WxH] [-r fps] [-n 1,2,4,...] [-t seconds] [-w warmup]\n"
+            "       [-l p99_ms] [-o curve.csv] [-b baseline.csv] [-x ./ff-rknn] [-v] [-- ff-rknn options]\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *clip = "capacity-clip.mp4", *ffrknn = "./ff-rknn", *sweep = "1,2,3,4,6,8,12,16,24,32";
+    const char *csv = NULL, *baseline = NULL;
+    int width = 1280, height = 720, fps = 30, seconds = 20, warmup = 5, verbose = 0;
+    double max_p99 = 200;
+    std::vector<char *> extra;
+    std::vector<point_t> curve, base;
+    struct stat st;
+    int c;
+
+    while ((c = getopt(argc, argv, "c:s:r:n:t:w:l:o:b:x:vh")) != -1) {
+        switch (c) {
+        case 'c':
+            clip = optarg;
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width < 16 || height < 16) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            fps = atoi(optarg) > 0 ? atoi(optarg) : 30;
+            break;
+        case 'n':
+            sweep = optarg;
+            break;
+        case 't':
+            seconds = atoi(optarg) > 0 ? atoi(optarg) : 20;
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'l':
+            max_p99 = atof(optarg);
+            break;
+        case 'o':
+            csv = optarg;
+            break;
+        case 'b':
+            baseline = optarg;
+            break;
+        case 'x':
+            ffrknn = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (int i = optind; i < argc; i++)
+        extra.push_back(argv[i]);
+
+    if (baseline && read_csv(baseline, base) < 0)
+        return 1;
+    if (stat(clip, &st) < 0 && make_clip(clip, width & ~1, height & ~1, fps) < 0) {
+        fprintf(stderr, "Cannot generate %s, pass an H.264 clip with -c\n", clip);
+        return 1;
+    }
+
+    printf("%7s %8s %8s %8s %8s %8s %6s %8s\n", "streams", "fps", "target", "p50_ms", "p99_ms",
+           "max_ms", "cpu%", "rss_mb");
+    for (const char *p = sweep; *p;) {
+        point_t pt;
+        int n = atoi(p);
+
+        if (n > 0 && run_point(ffrknn, clip, n, seconds, warmup, extra, verbose, &pt) == 0) {
+            pt.ok = pt.fps >= pt.target * MIN_FPS && pt.p99_ms <= max_p99;
+            curve.push_back(pt);
+            print_point(stdout, &pt);
+            fflush(stdout);
+            if (!pt.ok)
+                break;
+        } else if (n > 0) {
+            break;
+        }
+        p += strcspn(p, ",");
+        p += *p == ',';
+    }
+    printf("Capacity: %d stream(s), p99 <= %.0f ms\n", capacity(curve), max_p99);
+
+    if (csv && write_csv(csv, curve) < 0)
+        return 1;
+    if (baseline && compare(curve, base))
+        return 1;
+    return curve.empty() ? 1 : 0;
+}
@@ -39,53 +39,20 @@
 #include "SDL3/SDL.h"
 #include "SDL_syswm.h"
 
-#include <drm_fourcc.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <sys/time.h>
 #include <unistd.h>
-#include <xf86drm.h>
-#include <xf86drmMode.h>
 
-#ifdef __cplusplus
-extern "C" {
-#endif
+#include <atomic>
 
-#include <libavcodec/avcodec.h>
-#include <libavdevice/avdevice.h>
-#include <libavformat/avformat.h>
-#include <libavutil/hwcontext_drm.h>
-#include <libavutil/pixfmt.h>
-
-#include <rga/RgaApi.h>
-#include <rga/rga.h>
-
-#ifdef __cplusplus
-} // closing brace for extern "C"
-#endif
-
-#include "postprocess.h"
-#include "rknn_api.h"
-
-#define ALIGN(x, a)           ((x) + (a - 1)) & (~(a - 1))
-#define DRM_ALIGN(val, align) ((val + (align - 1)) & ~(align - 1))
-
-#ifndef DRM_FORMAT_NV12_10
-#define DRM_FORMAT_NV12_10 fourcc_code('N', 'A', '1', '2')
-#endif
-
-#ifndef DRM_FORMAT_NV15
-#define DRM_FORMAT_NV15 fourcc_code('N', 'A', '1', '5')
-#endif
-
-#define MODEL_WIDTH  640
-#define MODEL_HEIGHT 640
+#include "annotate.h"
+#include "ffrknn.h"
+#include "overlay.h"
+#include "stats.h"
+#include "trace.h"
 
 #define arg_a 36430 // -a
 #define arg_b 36431 // -b
@@ -101,329 +68,330 @@ extern "C" {
 #define arg_d 36433 // -d
 #define arg_p 36445 // -p
 #define arg_s 36448 // -s
+#define arg_I 36406 // -I
+#define arg_n 36443 // -n
+#define arg_sw 1202903 // -sw
+#define arg_T 36417 // -T
+#define arg_k 36440 // -k
+#define arg_A 36398 // -A
+#define arg_H 36405 // -H
+#define arg_w 36452 // -w
+#define arg_j 36439 // -j
+#define arg_u 36450 // -u
+#define arg_L 36409 // -L
+#define arg_B 36399 // -B
+#define arg_R 36415 // -R
+#define arg_S 36416 // -S
+#define arg_shm 39695413 // -shm
+#define arg_D 36401 // -D
+#define arg_m2 1202636 // -m2
+#define arg_c2 1202306 // -c2
+#define arg_o2 1202702 // -o2
+#define arg_ds 1202404 // -ds
+#define arg_slo 39695547 // -slo
+#define arg_st 1202900 // -st
+#define arg_trace 280167388 // -trace
+#define arg_metrics 3518552804 // -metrics
+#define arg_dump 1309423843 // -dump
+#define arg_backend 2020349237 // -backend
+#define arg_vs 1202998 // -vs
+#define arg_cap 39677761 // -cap
+#define arg_replay 562450298 // -replay
+
+/* the pipeline: decode, NPU and sinks live in libffrknn (ffrknn.h) */
+ffrknn_config_t config;
+ffrknn_t *engine;
 
-static unsigned int hash_me(char *str);
-
-/* --- RKNN --- */
-int channel = 3;
-int width = MODEL_WIDTH;
-int height = MODEL_HEIGHT;
-unsigned char *model_data;
-int model_data_size = 0;
-char *model_name = NULL;
-float scale_w = 1.0f; // (float)width / img_width;
-float scale_h = 1.0f; // (float)height / img_height;
-detect_result_group_t detect_result_group;
-std::vector<float> out_scales;
-std::vector<int32_t> out_zps;
-rknn_context ctx;
-rknn_input_output_num io_num;
-rknn_input inputs[2];
-rknn_tensor_attr output_attrs[256];
-size_t actual_size = 0;
-const float nms_threshold = NMS_THRESH;
-const float box_conf_threshold = BOX_THRESH;
 /* --- SDL --- */
-int alphablend;
-int accur;
-unsigned int obj2det;
-int frameSize_texture;
-int frameSize_rknn;
-void *resize_buf;
-void *texture_dst_buf;
-Uint32 format;
-SDL_Texture *texture;
+int screen_left = 0;
+int screen_top = 0;
 SDL_Window *window = NULL;
 SDL_Renderer *renderer = NULL;
+Uint32 format;
 
-int screen_width = 960;
-int screen_height = 540;
-int screen_left = 0;
-int screen_top = 0;
-unsigned int frame_width = 960;
-unsigned int frame_height = 540;
-int v4l2;  // v4l2 h264
-int rtsp;  // rtsp h264
-int rtmp;  // flv h264
-int http;  // flv h264
-int delay; // ms
-char *pixel_format;
-char *sensor_frame_size;
-char *sensor_frame_rate;
-
-float frmrate = 0.0;      // Measured frame rate
-float avg_frmrate = 0.0;  // avg frame rate
-float prev_frmrate = 0.0; // avg frame rate
-Uint32 currtime;
-Uint32 lasttime;
-int loop_counter = 0;
-const int frmrate_update = 25;
-
-enum AVPixelFormat get_format(AVCodecContext *Context,
-                              const enum AVPixelFormat *PixFmt)
+/* one tile of the window per stream */
+typedef struct _tile_t
 {
-    while (*PixFmt != AV_PIX_FMT_NONE) {
-        if (*PixFmt == AV_PIX_FMT_DRM_PRIME)
-            return AV_PIX_FMT_DRM_PRIME;
-        PixFmt++;
+    SDL_Texture *texture;
+    SDL_FRect rect;
+    detect_result_group_t shown_group;
+    int opened;
+} tile_t;
+
+tile_t tiles[FFRKNN_MAX_STREAMS];
+int nb_tiles;
+int frameSize_texture;
+uint64_t texture_bytes;
+uint64_t texture_uploads;
+
+std::atomic<int> quit(0);
+
+static int load_stream_list(const char *filename)
+{
+    char line[1024];
+    FILE *fp;
+    int n = 0;
+
+    fp = fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "Open stream list %s failed.\n", filename);
+        return -1;
     }
-    return AV_PIX_FMT_NONE;
+    while (fgets(line, sizeof(line), fp)) {
+        char *p = line;
+        char *e;
+
+        while (*p == ' ' || *p == '\t')
+            p++;
+        e = p + strlen(p);
+        while (e > p && (e[-1] == '\n' || e[-1] == '\r' || e[-1] == ' ' || e[-1] == '\t'))
+            *--e = '\0';
+        if (*p == '\0' || *p == '#')
+            continue;
+        /* optional second field: latency SLO of this stream in ms */
+        e = p + strcspn(p, " \t");
+        if (*e)
+            *e++ = '\0';
+        if (ffrknn_add_stream(engine, p, atof(e), NULL, NULL) < 0)
+            break;
+        n++;
+    }
+    fclose(fp);
+    return n;
 }
 
-static int drm_rga_buf(int src_Width, int src_Height, int wStride, int hStride, int src_fd,
-                       int src_format, int dst_Width, int dst_Height,
-                       int dst_format, int frameSize, char *buf)
+static void displayTexture(tile_t *tile)
 {
-    rga_info_t src;
-    rga_info_t dst;
-    int ret;
-    // int hStride = (src_Height + 15) & (~15);
-    // int wStride = (src_Width + 15) & (~15);
-    // int dhStride = (dst_Height + 15) & (~15);
-    // int dwStride = (dst_Width + 15) & (~15);
-
-    memset(&src, 0, sizeof(rga_info_t));
-    src.fd = src_fd;
-    src.mmuFlag = 1;
-
-    memset(&dst, 0, sizeof(rga_info_t));
-    dst.fd = -1;
-    dst.virAddr = buf;
-    dst.mmuFlag = 1;
-
-    rga_set_rect(&src.rect, 0, 0, src_Width, src_Height, wStride, hStride,
-                 src_format);
-    rga_set_rect(&dst.rect, 0, 0, dst_Width, dst_Height, dst_Width, dst_Height,
-                 dst_format);
-
-    ret = c_RkRgaBlit(&src, &dst, NULL);
-    return ret;
+    SDL_RenderTexture(renderer, tile->texture, NULL, &tile->rect);
+    if (config.burn_in)
+        return;
+
+    // Queue Objects, drawn in batches by overlay_flush()
+    char text[64];
+    SDL_FRect rect;
+    for (int i = 0; i < tile->shown_group.count; i++) {
+        detect_result_t *det_result = &(tile->shown_group.results[i]);
+
+        if (!ffrknn_detection_shown(engine, det_result))
+            continue;
+        rect.x = tile->rect.x + det_result->box.left;
+        rect.y = tile->rect.y + det_result->box.top;
+        rect.w = det_result->box.right - det_result->box.left + 1;
+        rect.h = det_result->box.bottom - det_result->box.top + 1;
+        ffrknn_detection_label(det_result, text, sizeof(text));
+        overlay_add(&rect, annotate_class_color(det_result), config.label_scale ? text : NULL);
+    }
 }
 
-#if 0
-static char *drm_get_rgaformat_str(uint32_t drm_fmt) 
+/* upload and render run here, not on a stream: no stream id in the span */
+static void display_span(int stage, int64_t begin, int64_t end)
 {
-  switch (drm_fmt) {
-  case DRM_FORMAT_NV12:
-    return "RK_FORMAT_YCbCr_420_SP";
-  case DRM_FORMAT_NV12_10:
-    return "RK_FORMAT_YCbCr_420_SP_10B";
-  case DRM_FORMAT_NV15:
-    return "RK_FORMAT_YCbCr_420_SP_10B";
-  case DRM_FORMAT_NV16:
-    return "RK_FORMAT_YCbCr_422_SP";
-  case DRM_FORMAT_YUYV:
-    return "RK_FORMAT_YUYV_422";
-  case DRM_FORMAT_UYVY:
-    return "RK_FORMAT_UYVY_422";
-  default:
-    return "0";
-  }
+    stats_record(stage, end - begin);
+    trace_span(stage, -1, AV_NOPTS_VALUE, -1, begin, end);
 }
-#endif
 
-static uint32_t drm_get_rgaformat(uint32_t drm_fmt)
+static int display_init(void)
 {
-    switch (drm_fmt) {
-    case DRM_FORMAT_NV12:
-        return RK_FORMAT_YCbCr_420_SP;
-    case DRM_FORMAT_NV12_10:
-        return RK_FORMAT_YCbCr_420_SP_10B;
-    case DRM_FORMAT_NV15:
-        return RK_FORMAT_YCbCr_420_SP_10B;
-    case DRM_FORMAT_NV16:
-        return RK_FORMAT_YCbCr_422_SP;
-    case DRM_FORMAT_YUYV:
-        return RK_FORMAT_YUYV_422;
-    case DRM_FORMAT_UYVY:
-        return RK_FORMAT_UYVY_422;
-    default:
-        return 0;
+    SDL_SysWMinfo info;
+    SDL_version sdl_compiled;
+    SDL_version sdl_linked;
+    Uint32 wflags = 0 | SDL_WINDOW_OPENGL | SDL_WINDOW_BORDERLESS |
+                    SDL_WINDOW_ALWAYS_ON_TOP;
+
+    SDL_VERSION(&sdl_compiled);
+    SDL_GetVersion(&sdl_linked);
+    SDL_Log("SDL: compiled with=%d.%d.%d linked against=%d.%d.%d",
+            sdl_compiled.major, sdl_compiled.minor, sdl_compiled.patch,
+            sdl_linked.major, sdl_linked.minor, sdl_linked.patch);
+
+    // SDL_SetHint(SDL_HINT_RENDER_DRIVER, "opengles2");
+    // SDL_SetHint(SDL_HINT_VIDEO_WAYLAND_ALLOW_LIBDECOR, "0");
+    if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
+        SDL_Log("SDL_Init failed (%s)", SDL_GetError());
+        return -1;
     }
-}
 
-static void displayTexture(void *imageData)
-{
-    unsigned char *texture_data = NULL;
-    int texture_pitch = 0;
+    SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+    SDL_GL_SetAttribute(SDL_GL_ACCELERATED_VISUAL, 1);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
+
+    if (SDL_CreateWindowAndRenderer(config.width, config.height,
+                                    wflags,
+                                    &window, &renderer) < 0) {
+        SDL_Log("SDL_CreateWindowAndRenderer failed (%s)", SDL_GetError());
+        return -1;
+    }
+    if (config.alphablend) {
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    }
+    // SDL_RenderFillRect(renderer, &rect);
+    SDL_SetWindowTitle(window, "rknn yolov5 object detection");
+    SDL_SetWindowPosition(window, screen_left, screen_top);
 
-    if (loop_counter++ % frmrate_update == 0) {
-        currtime = SDL_GetTicks(); // [ms]
-        if (currtime - lasttime > 0) {
-            frmrate = frmrate_update * (1000.0 / (currtime - lasttime));
+    format = config.image_format == AV_PIX_FMT_NV12 ? SDL_PIXELFORMAT_NV12 : SDL_PIXELFORMAT_RGB24;
+    nb_tiles = ffrknn_stream_count(engine);
+    for (int i = 0; i < nb_tiles; i++) {
+        tile_t *tile = &tiles[i];
+        ffrknn_stream_info_t si;
+
+        if (ffrknn_stream_info(engine, i, &si) < 0 || !si.opened)
+            continue;
+        tile->rect.x = si.x;
+        tile->rect.y = si.y;
+        tile->rect.w = si.width;
+        tile->rect.h = si.height;
+        tile->texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING,
+                                          si.width, si.height);
+        if (!tile->texture) {
+            av_log(NULL, AV_LOG_FATAL, "Failed to create texturer: %s", SDL_GetError());
+            return -1;
         }
-        lasttime = currtime;
-        avg_frmrate = (prev_frmrate + frmrate) / 2.0;
-        prev_frmrate = frmrate;
+        tile->opened = 1;
+        if (config.image_format == AV_PIX_FMT_NV12)
+            frameSize_texture = si.width * si.height * 3 / 2;
+        else
+            frameSize_texture = si.width * si.height * 3;
     }
+    return overlay_init(renderer, config.label_scale);
+}
 
-    SDL_LockTexture(texture, 0, (void **)&texture_data, &texture_pitch);
-    memcpy(texture_data, (void *)imageData, frameSize_texture);
-    SDL_UnlockTexture(texture);
-    SDL_RenderTexture(renderer, texture, NULL, NULL);
+static void display_loop(void)
+{
+    SDL_Event event;
+    int finished = 0;
 
-    // Draw Objects
-    char text[256];
-    SDL_FRect rect;
-    unsigned int obj;
-    int accur_obj;
-    int clr;
-    for (int i = 0; i < detect_result_group.count; i++) {
-        detect_result_t *det_result = &(detect_result_group.results[i]);
-#if 0
-    sprintf(text, "%s %.1f%%", det_result->name, det_result->prop * 100);
-    printf("%s @ (%d %d %d %d) %f\n",
-           det_result->name, 
-           det_result->box.left, 
-           det_result->box.top,
-           det_result->box.right, 
-           det_result->box.bottom, 
-           det_result->prop);
-#endif
-        if (obj2det) {
-            obj = hash_me(det_result->name);
-            if (obj != obj2det) {
+    while (!finished) {
+        unsigned char *texture_data = NULL;
+        int texture_pitch = 0;
+        int fresh[FFRKNN_MAX_STREAMS];
+        int nb_fresh = 0;
+        int running = ffrknn_wait(engine, 0);
+        int64_t t = stats_now();
+
+        for (int i = 0; i < nb_tiles; i++) {
+            tile_t *tile = &tiles[i];
+            const uint8_t *image;
+            int w = tile->rect.w, h = tile->rect.h;
+
+            fresh[i] = 0;
+            if (!tile->opened)
                 continue;
+
+            /* the image stays ours until the next ffrknn_image_read() */
+            image = ffrknn_image_read(engine, i, &tile->shown_group);
+            if (!image)
+                continue;
+            if (config.image_format == AV_PIX_FMT_NV12) {
+                SDL_UpdateNVTexture(tile->texture, NULL, image, w, image + w * h, w);
+            } else {
+                SDL_LockTexture(tile->texture, 0, (void **)&texture_data, &texture_pitch);
+                memcpy(texture_data, image, frameSize_texture);
+                SDL_UnlockTexture(tile->texture);
             }
+            texture_bytes += frameSize_texture;
+            texture_uploads++;
+            fresh[i] = 1;
+            nb_fresh++;
         }
-        if (accur) {
-            accur_obj = (int)(det_result->prop * 100.0);
-            if (accur_obj < accur) {
-                continue;
+
+        if (nb_fresh) {
+            int64_t t_render = stats_now();
+
+            display_span(STATS_UPLOAD, t, t_render);
+            if (nb_tiles > 1)
+                SDL_RenderClear(renderer);
+            for (int i = 0; i < nb_tiles; i++) {
+                if (tiles[i].opened)
+                    displayTexture(&tiles[i]);
+            }
+            overlay_flush(renderer, config.alphablend);
+            /* may block on vsync: only this thread waits, producers keep overwriting the mailbox */
+            SDL_RenderPresent(renderer);
+            t = stats_now();
+            display_span(STATS_RENDER, t_render, t);
+            for (int i = 0; i < nb_tiles; i++) {
+                if (fresh[i])
+                    ffrknn_presented(engine, i, &tiles[i].shown_group, t);
             }
+        } else if (!running) {
+            break;
+        } else {
+            usleep(1000);
         }
-        rect.x = det_result->box.left;
-        rect.y = det_result->box.top;
-        rect.w = det_result->box.right - det_result->box.left + 1;
-        rect.h = det_result->box.bottom - det_result->box.top + 1;
-        if (det_result->name[0] == 'p' && det_result->name[1] == 'e')
-            clr = 1;
-        else if (det_result->name[0] == 'c' && det_result->name[1] == 'a')
-            clr = 2;
-        else if (det_result->name[0] == 'b' && det_result->name[1] == 'u')
-            clr = 3;
-        else if (det_result->name[0] == 'b' && det_result->name[1] == 'i')
-            clr = 4;
-        else if (det_result->name[0] == 'm' && det_result->name[1] == 'o')
-            clr = 5;
-        else if (det_result->name[0] == 'b' && det_result->name[3] == 'k')
-            clr = 6;
-        else if (det_result->name[0] == 'u' && det_result->name[1] == 'm')
-            clr = 7;
-        else
-            clr = 0;
-        if (alphablend) {
-            if (clr == 1)
-                SDL_SetRenderDrawColor(renderer, 255, 0, 0, alphablend);
-            else if (clr == 2)
-                SDL_SetRenderDrawColor(renderer, 0, 255, 0, alphablend);
-            else if (clr == 3)
-                SDL_SetRenderDrawColor(renderer, 255, 0, 255, alphablend);
-            else if (clr == 4)
-                SDL_SetRenderDrawColor(renderer, 255, 255, 0, alphablend);
-            else if (clr == 5)
-                SDL_SetRenderDrawColor(renderer, 128, 155, 255, alphablend);
-            else if (clr == 6)
-                SDL_SetRenderDrawColor(renderer, 128, 128, 128, alphablend);
-            else if (clr == 7)
-                SDL_SetRenderDrawColor(renderer, 255, 255, 255, alphablend);
-            else
-                SDL_SetRenderDrawColor(renderer, 0, 0, 255, alphablend);
-            SDL_RenderFillRect(renderer, &rect);
+
+        while (SDL_PollEvent(&event)) {
+            switch (event.type) {
+            case SDL_EVENT_QUIT:
+            {
+                finished = 1;
+                SDL_Log("Program quit after %ld ticks", event.quit.timestamp);
+                break;
+            }
+            case SDL_EVENT_KEY_DOWN:
+            {
+                SDL_bool withControl = (SDL_bool) !!(event.key.keysym.mod & SDL_KMOD_CTRL);
+                SDL_bool withShift = (SDL_bool) !!(event.key.keysym.mod & SDL_KMOD_SHIFT);
+                SDL_bool withAlt = (SDL_bool) !!(event.key.keysym.mod & SDL_KMOD_ALT);
+
+                switch (event.key.keysym.sym) {
+                /* Add hotkeys here */
+                case SDLK_ESCAPE:
+                    finished = 1;
+                    break;
+                case SDLK_x:
+                    finished = 1;
+                    break;
+                }
+            }
+            }
         }
-        if (clr == 1)
-            SDL_SetRenderDrawColor(renderer, 255, 0, 0, SDL_ALPHA_OPAQUE);
-        else if (clr == 2)
-            SDL_SetRenderDrawColor(renderer, 0, 255, 0, SDL_ALPHA_OPAQUE);
-        else if (clr == 3)
-            SDL_SetRenderDrawColor(renderer, 255, 0, 255, SDL_ALPHA_OPAQUE);
-        else if (clr == 4)
-            SDL_SetRenderDrawColor(renderer, 255, 255, 0, SDL_ALPHA_OPAQUE);
-        else if (clr == 5)
-            SDL_SetRenderDrawColor(renderer, 128, 155, 255, SDL_ALPHA_OPAQUE);
-        else if (clr == 6)
-            SDL_SetRenderDrawColor(renderer, 128, 128, 128, SDL_ALPHA_OPAQUE);
-        else if (clr == 7)
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, SDL_ALPHA_OPAQUE);
-        else
-            SDL_SetRenderDrawColor(renderer, 0, 0, 255, SDL_ALPHA_OPAQUE);
-        SDL_RenderRect(renderer, &rect);
     }
-
-    SDL_RenderPresent(renderer);
 }
 
-static int decode_and_display(AVCodecContext *dec_ctx, AVFrame *frame,
-                              AVPacket *pkt)
+static void display_deinit(void)
 {
-    AVDRMFrameDescriptor *desc;
-    AVDRMLayerDescriptor *layer;
-    unsigned int drm_format;
-    RgaSURF_FORMAT src_format;
-    RgaSURF_FORMAT dst_format;
-    int hStride, wStride;
-    SDL_Rect rect;
-    int ret;
-
-    ret = avcodec_send_packet(dec_ctx, pkt);
-    if (ret < 0) {
-        fprintf(stderr, "Error sending a packet for decoding\n");
-        return ret;
+    overlay_deinit();
+    for (int i = 0; i < nb_tiles; i++) {
+        if (tiles[i].texture)
+            SDL_DestroyTexture(tiles[i].texture);
+        tiles[i].texture = NULL;
     }
-    ret = 0;
-    while (ret >= 0) {
-        ret = avcodec_receive_frame(dec_ctx, frame);
-        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-            break;
-        } else if (ret < 0) {
-            fprintf(stderr, "Error during decoding!\n");
-            return ret;
-        }
-        desc = (AVDRMFrameDescriptor *)frame->data[0];
-        layer = &desc->layers[0];
-        if (desc && layer) {
-            wStride = layer->planes[0].pitch;
-            hStride = (layer->planes[1].offset / layer->planes[0].pitch);
-
-            drm_format = layer->format;
-            src_format = (RgaSURF_FORMAT)drm_get_rgaformat(drm_format);
-
-            /* ------------ RKNN ----------- */
-            drm_rga_buf(frame->width, frame->height, wStride, hStride, desc->objects[0].fd, src_format,
-                        screen_width, screen_height, RK_FORMAT_RGB_888,
-                        frameSize_texture, (char *)texture_dst_buf);
-            drm_rga_buf(frame->width, frame->height, frame->width, frame->height, desc->objects[0].fd, src_format,
-                        width, height, RK_FORMAT_RGB_888, frameSize_rknn, (char *)resize_buf);
-
-            inputs[0].buf = resize_buf;
-            rknn_inputs_set(ctx, io_num.n_input, inputs);
-
-            rknn_output outputs[io_num.n_output];
-            memset(outputs, 0, sizeof(outputs));
-            for (int i = 0; i < io_num.n_output; i++) {
-                outputs[i].want_float = 0;
-            }
-
-            ret = rknn_run(ctx, NULL);
-            ret = rknn_outputs_get(ctx, io_num.n_output, outputs, NULL);
+    if (renderer) {
+        SDL_DestroyRenderer(renderer);
+    }
+    if (window) {
+        SDL_DestroyWindow(window);
+    }
+    renderer = NULL;
+    window = NULL;
+    SDL_Quit();
+}
 
-            // post process
-            scale_w = (float)width / screen_width;
-            scale_h = (float)height / screen_height;
+/* SDL window, renderer and events all live on this thread */
+static void *render_thread(void * /* arg */)
+{
+    trace_thread_name("render");
+    if (display_init() == 0)
+        display_loop();
+    quit.store(1);
+    display_deinit();
+    return NULL;
+}
 
-            for (int i = 0; i < io_num.n_output; ++i) {
-                out_scales.push_back(output_attrs[i].scale);
-                out_zps.push_back(output_attrs[i].zp);
-            }
-            post_process((int8_t *)outputs[0].buf, (int8_t *)outputs[1].buf, (int8_t *)outputs[2].buf,
-                         height, width, box_conf_threshold, nms_threshold,
-                         scale_w, scale_h, out_zps, out_scales, &detect_result_group);
+static void headless_loop(void)
+{
+    while (!quit.load() && ffrknn_wait(engine, 100) > 0)
+        ;
+}
 
-            displayTexture(texture_dst_buf);
-            ret = rknn_outputs_release(ctx, io_num.n_output, outputs);
-        }
-    }
-    return 0;
+static void sigint_handler(int /* sig */)
+{
+    quit.store(1);
 }
 
 static unsigned int hash_me(char *str)
@@ -438,127 +406,79 @@ static unsigned int hash_me(char *str)
 void print_help(void)
 {
     fprintf(stderr, "ff-rknn parameters:\n"
+                    "-i input stream (repeat for several streams)\n"
+                    "-I file with one input stream per line\n"
                     "-x displayed width\n"
                     "-y displayed height\n"
-                    "-m rknn model\n"
+                    "-m rknn model, or a ladder: big.rknn,small.rknn (largest first)\n"
+                    "-slo ladder: NPU wait + inference budget per frame in ms\n"
+                    "-m2 second stage classifier model, run on crops of the detections\n"
+                    "-c2 second stage: max crops per frame (default 8)\n"
+                    "-o2 second stage: only crops of this object\n"
+                    "-ds dynamic shape model: choose the input shape every N frames (0: largest)\n"
+                    "-n NPU contexts shared by the streams (default: streams, max 3)\n"
+                    "-backend inference backend: rknn (default), mock[:ms=25,jitter=0,cores=3,objects=4,size=640]\n"
                     "-f protocol (v4l2, rtsp, rtmp, http)\n"
+                    "-sw 1 software decoding (fallback when rkmpp is missing or busy)\n"
+                    "-T software decoder threads (0: auto)\n"
+                    "-k skip frames: nonref, bidir, nonkey (keyframes only)\n"
+                    "-A analysis fps, infer only frames on this rate\n"
+                    "-H 1 headless: no window, decode and infer as fast as possible\n"
+                    "-w write per-frame detections (JSON lines) to file, '-' for stdout\n"
+                    "-D write detections to a binary log (+ .idx), see detlog-query\n"
+                    "-dump write raw NPU outputs to file[,N]: every Nth frame, see tensor-replay\n"
+                    "-j headless: split seekable files at keyframes over N workers\n"
+                    "-vs N[,secs[,warmup]] headless: N copies of every file, paced and looped, then a Bench: line\n"
+                    "-cap capture the demuxed packets of the streams and their arrival to file\n"
+                    "-replay play a -cap file: file[,speed=1,jitter=ms,loss=percent,seed=1]\n"
+                    "-u texture upload format: rgb (default), nv12\n"
                     "-p pixel format (h264) - camera\n"
                     "-s video frame size (WxH) - camera\n"
                     "-r video frame rate - camera\n"
                     "-o unique object to detect\n"
                     "-b use alpha blend on detected objects (1 ~ 255)\n"
+                    "-L label text scale (0: no labels, default 1)\n"
+                    "-B 1 burn boxes and labels into the frame on the CPU\n"
+                    "-R record annotated video to file (.mp4, .mkv), -s<id> added per stream\n"
+                    "-S record: start a new file every N seconds\n"
+                    "-shm publish frames and detections in shared memory, socket path\n"
+                    "-trace write a Chrome trace (Perfetto) of the pipeline, at exit and on SIGUSR1\n"
+                    "-metrics serve Prometheus metrics on a unix socket path or [host:]port\n"
+                    "-st print stage latency percentiles every N seconds (and at exit)\n"
                     "-a accuracy perc (1 ~ 100)\n");
 }
 
-/*-------------------------------------------
-  Functions
-  -------------------------------------------*/
-static unsigned char *load_data(FILE *fp, size_t ofst, size_t sz)
-{
-    unsigned char *data;
-    int ret;
-
-    data = NULL;
-
-    if (NULL == fp) {
-        return NULL;
-    }
-
-    ret = fseek(fp, ofst, SEEK_SET);
-    if (ret != 0) {
-        fprintf(stderr, "blob seek failure.\n");
-        return NULL;
-    }
-
-    data = (unsigned char *)malloc(sz);
-    if (data == NULL) {
-        fprintf(stderr, "buffer malloc failure.\n");
-        return NULL;
-    }
-    ret = fread(data, 1, sz, fp);
-    return data;
-}
-
-static unsigned char *load_model(char *filename, int *model_size)
-{
-
-    FILE *fp;
-    unsigned char *data;
-
-    if (!filename)
-        return NULL;
-
-    fp = fopen(filename, "rb");
-    if (NULL == fp) {
-        fprintf(stderr, "Open file %s failed.\n", filename);
-        return NULL;
-    }
-
-    fseek(fp, 0, SEEK_END);
-    int size = ftell(fp);
-
-    data = load_data(fp, 0, size);
-
-    fclose(fp);
-
-    *model_size = size;
-    return data;
-}
-
-static int saveFloat(const char *file_name, float *output, int element_size)
-{
-    FILE *fp;
-    fp = fopen(file_name, "w");
-    for (int i = 0; i < element_size; i++) {
-        fprintf(fp, "%.6f\n", output[i]);
-    }
-    fclose(fp);
-    return 0;
-}
-
 int main(int argc, char *argv[])
 {
-    SDL_Event event;
-    SDL_SysWMinfo info;
-    SDL_version sdl_compiled;
-    SDL_version sdl_linked;
-    Uint32 wflags = 0 | SDL_WINDOW_OPENGL | SDL_WINDOW_BORDERLESS |
-                    SDL_WINDOW_ALWAYS_ON_TOP;
-    AVFormatContext *input_ctx = NULL;
-    AVStream *video = NULL;
-    int video_stream, ret, v4l2 = 0, kmsgrab = 0;
-    AVCodecContext *codec_ctx = NULL;
-    AVCodec *codec;
-    AVFrame *frame;
-    AVPacket pkt;
-    int lindex, opt;
-    char *codec_name = NULL;
-    char *video_name = NULL;
+    pthread_t render_tid;
+    int ret = 0;
     // char *video_name = "/home/rock/weston/apps/videos_rknn/vid-1.mp4";
     // char *video_name = "/home/rock/Videos/jellyfish-5-mbps-hd-hevc.mkv";
-    char *pixel_format = NULL, *size_window = NULL;
-    AVDictionary *opts = NULL;
-    AVDictionaryEntry *dict = NULL;
-    AVCodecParameters *codecpar;
-    AVInputFormat *ifmt = NULL;
-    int nframe = 1;
-    int finished = 0;
+    char *inputs[FFRKNN_MAX_STREAMS];
+    int nb_inputs = 0;
+    char *stream_list = NULL;
+    char *replay_filename = NULL;
     int i = 1;
     unsigned int a;
 
     a = 0;
+    ffrknn_config_default(&config);
 
     while (i < argc) {
         a = hash_me(argv[i++]);
         switch (a) {
         case arg_i:
-            video_name = argv[i];
+            if (i < argc && nb_inputs < FFRKNN_MAX_STREAMS)
+                inputs[nb_inputs++] = argv[i];
+            break;
+        case arg_I:
+            stream_list = argv[i];
             break;
         case arg_x:
-            screen_width = atoi(argv[i]);
+            config.width = atoi(argv[i]);
             break;
         case arg_y:
-            screen_height = atoi(argv[i]);
+            config.height = atoi(argv[i]);
             break;
         case arg_l:
             screen_left = atoi(argv[i]);
@@ -567,35 +487,123 @@ int main(int argc, char *argv[])
             screen_top = atoi(argv[i]);
             break;
         case arg_f:
-            // v4l2 = atoi(argv[i]);
-            v4l2 = !strncasecmp(argv[i], "v4l2", 4);
-            rtsp = !strncasecmp(argv[i], "rtsp", 4);
-            rtmp = !strncasecmp(argv[i], "rtmp", 4);
-            http = !strncasecmp(argv[i], "http", 4);
+            config.protocol = argv[i];
             break;
         case arg_r:
-            sensor_frame_rate = argv[i];
+            config.frame_rate = argv[i];
             break;
         case arg_d:
-            delay = atoi(argv[i]);
+            config.delay = atoi(argv[i]);
             break;
         case arg_p:
-            pixel_format = argv[i];
+            config.pixel_format = argv[i];
             break;
         case arg_s:
-            sensor_frame_size = argv[i];
+            config.video_size = argv[i];
             break;
         case arg_m:
-            model_name = argv[i];
+            config.model = argv[i];
+            break;
+        case arg_backend:
+            config.backend = argv[i];
+            break;
+        case arg_cap:
+            config.capture_filename = argv[i];
+            break;
+        case arg_replay:
+            replay_filename = argv[i];
+            break;
+        case arg_vs:
+            sscanf(argv[i], "%d,%d,%d", &config.virtual_streams, &config.bench_seconds,
+                   &config.bench_warmup);
+            break;
+        case arg_m2:
+            config.model2 = argv[i];
+            break;
+        case arg_c2:
+            config.max_crops = atoi(argv[i]);
+            break;
+        case arg_o2:
+            config.object2 = argv[i];
+            break;
+        case arg_ds:
+            config.shape_interval = atoi(argv[i]);
+            break;
+        case arg_slo:
+            config.slo_ms = atof(argv[i]);
+            break;
+        case arg_st:
+            config.stats_interval = atoi(argv[i]);
+            break;
+        case arg_trace:
+            config.trace_filename = argv[i];
+            break;
+        case arg_metrics:
+            config.metrics_address = argv[i];
+            break;
+        case arg_n:
+            config.npu_contexts = atoi(argv[i]);
+            break;
+        case arg_sw:
+            config.sw_decode = atoi(argv[i]);
+            break;
+        case arg_T:
+            config.decoder_threads = atoi(argv[i]);
+            break;
+        case arg_k:
+            if (!strcasecmp(argv[i], "nonref"))
+                config.skip_frame = AVDISCARD_NONREF;
+            else if (!strcasecmp(argv[i], "bidir"))
+                config.skip_frame = AVDISCARD_BIDIR;
+            else if (!strcasecmp(argv[i], "nonkey"))
+                config.skip_frame = AVDISCARD_NONKEY;
+            else
+                fprintf(stderr, "Unknown skip mode: %s\n", argv[i]);
+            break;
+        case arg_A:
+            config.analysis_fps = atof(argv[i]);
+            break;
+        case arg_H:
+            config.headless = atoi(argv[i]);
+            break;
+        case arg_w:
+            config.det_filename = argv[i];
+            break;
+        case arg_D:
+            config.detlog_filename = argv[i];
+            break;
+        case arg_dump:
+            config.dump_filename = argv[i];
+            break;
+        case arg_j:
+            config.gop_workers = atoi(argv[i]);
+            break;
+        case arg_L:
+            config.label_scale = atoi(argv[i]);
+            break;
+        case arg_B:
+            config.burn_in = atoi(argv[i]);
+            break;
+        case arg_R:
+            config.record_filename = argv[i];
+            break;
+        case arg_S:
+            config.record_segment_us = (int64_t)(atof(argv[i]) * AV_TIME_BASE);
+            break;
+        case arg_shm:
+            config.shm_socket = argv[i];
+            break;
+        case arg_u:
+            config.image_format = strcasecmp(argv[i], "nv12") ? AV_PIX_FMT_RGB24 : AV_PIX_FMT_NV12;
             break;
         case arg_o:
-            obj2det = hash_me(argv[i]);
+            config.object = argv[i];
             break;
         case arg_b:
-            alphablend = atoi(argv[i]);
+            config.alphablend = atoi(argv[i]);
             break;
         case arg_a:
-            accur = atoi(argv[i]);
+            config.accuracy = atoi(argv[i]);
             break;
         default:
             break;
@@ -605,363 +613,70 @@ int main(int argc, char *argv[])
     // fprintf(stderr,"%s: %u\n", "-p", hash_me("-p"));
     // fprintf(stderr,"%s: %u\n", "-s", hash_me("-s"));
 
-    if (!video_name) {
-        fprintf(stderr, "No stream to play! Please pass an input.\n");
-        print_help();
-        return -1;
-    }
-    if (!model_name) {
-        fprintf(stderr, "No model to load! Please pass a model.\n");
-        print_help();
-        return -1;
-    }
-    if (screen_width <= 0)
-        screen_width = 960;
-    if (screen_height <= 0)
-        screen_height = 540;
     if (screen_left <= 0)
         screen_left = 0;
     if (screen_top <= 0)
         screen_top = 0;
-
-    /* Create the neural network */
-    model_data_size = 0;
-    model_data = load_model(model_name, &model_data_size);
-    if (!model_data) {
-        fprintf(stderr, "Error locading model: `%s`\n", model_name);
-        return -1;
-    }
-    fprintf(stderr, "Model: %s - size: %d.\n", model_name, model_data_size);
-    ret = rknn_init(&ctx, model_data, model_data_size, 0, NULL);
-    if (ret < 0) {
-        fprintf(stderr, "rknn_init error ret=%d\n", ret);
-        return -1;
-    }
-
-    rknn_sdk_version version;
-    ret = rknn_query(ctx, RKNN_QUERY_SDK_VERSION, &version,
-                     sizeof(rknn_sdk_version));
-    if (ret < 0) {
-        fprintf(stderr, "rknn_init error ret=%d\n", ret);
-        return -1;
-    }
-    fprintf(stderr, "sdk version: %s driver version: %s\n",
-            version.api_version,
-            version.drv_version);
-
-    ret = rknn_query(ctx, RKNN_QUERY_IN_OUT_NUM, &io_num, sizeof(io_num));
-    if (ret < 0) {
-        fprintf(stderr, "rknn_init error ret=%d\n", ret);
-        return -1;
-    }
-    fprintf(stderr, "model input num: %d, output num: %d\n",
-            io_num.n_input,
-            io_num.n_output);
-
-    rknn_tensor_attr input_attrs[io_num.n_input + 1];
-    memset(input_attrs, 0, sizeof(input_attrs));
-    for (int i = 0; i < io_num.n_input; i++) {
-        // fprintf(stderr, "RKNN_QUERY_OUTPUT_ATTR output_attrs[%d].index=%d\n", i, i);
-        input_attrs[i].index = i;
-        ret = rknn_query(ctx, RKNN_QUERY_INPUT_ATTR, &(input_attrs[i]),
-                         sizeof(rknn_tensor_attr));
-        if (ret < 0) {
-            fprintf(stderr, "rknn_init error ret=%d\n", ret);
-            return -1;
-        }
-    }
-
-    memset(output_attrs, 0, sizeof(output_attrs));
-    for (int i = 0; i < io_num.n_output; i++) {
-        output_attrs[i].index = i;
-        ret = rknn_query(ctx, RKNN_QUERY_OUTPUT_ATTR, &(output_attrs[i]),
-                         sizeof(rknn_tensor_attr));
-    }
-
-    if (input_attrs[0].fmt == RKNN_TENSOR_NCHW) {
-        channel = input_attrs[0].dims[1];
-        width = input_attrs[0].dims[2];
-        height = input_attrs[0].dims[3];
-    } else {
-        width = input_attrs[0].dims[1];
-        height = input_attrs[0].dims[2];
-        channel = input_attrs[0].dims[3];
-    }
-
-    fprintf(stderr, "model: %dx%dx%d\n", width, height, channel);
-    memset(inputs, 0, sizeof(inputs));
-    inputs[0].index = 0;
-    inputs[0].type = RKNN_TENSOR_UINT8;
-    inputs[0].size = width * height * channel;
-    inputs[0].fmt = RKNN_TENSOR_NHWC;
-    inputs[0].pass_through = 0;
-
-    input_ctx = avformat_alloc_context();
-    if (!input_ctx) {
-        av_log(0, AV_LOG_ERROR, "Cannot allocate input format (Out of memory?)\n");
-        return -1;
-    }
-
-    av_dict_set(&opts, "num_capture_buffers", "128", 0);
-    if (rtsp) {
-        // av_dict_set(&opts, "rtsp_transport", "tcp", 0);
-        av_dict_set(&opts, "rtsp_flags", "prefer_tcp", 0);
-    }
-    if (v4l2) {
-        avdevice_register_all();
-        ifmt = av_find_input_format("video4linux2");
-        if (!ifmt) {
-            av_log(0, AV_LOG_ERROR, "Cannot find input format: v4l2\n");
-            return -1;
-        }
-        input_ctx->flags |= AVFMT_FLAG_NONBLOCK;
-        if (pixel_format) {
-            av_dict_set(&opts, "input_format", pixel_format, 0);
-        }
-        if (sensor_frame_size)
-            av_dict_set(&opts, "video_size", sensor_frame_size, 0);
-        if (sensor_frame_rate)
-            av_dict_set(&opts, "framerate", sensor_frame_rate, 0);
-    }
-    if (rtmp) {
-        ifmt = av_find_input_format("flv");
-        if (!ifmt) {
-            av_log(0, AV_LOG_ERROR, "Cannot find input format: flv\n");
-            return -1;
-        }
-        av_dict_set(&opts, "fflags", "nobuffer", 0);
-    }
-
-    if (http) {
-        av_dict_set(&opts, "fflags", "nobuffer", 0);
-    }
-
-    if (avformat_open_input(&input_ctx, video_name, ifmt, &opts) != 0) {
-        av_log(0, AV_LOG_ERROR, "Cannot open input file '%s'\n", video_name);
-        avformat_close_input(&input_ctx);
-        return -1;
-    }
-
-    if (avformat_find_stream_info(input_ctx, NULL) < 0) {
-        av_log(0, AV_LOG_ERROR, "Cannot find input stream information.\n");
-        avformat_close_input(&input_ctx);
-        return -1;
-    }
-
-    /* find the video stream information */
-    ret = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
-    if (ret < 0) {
-        av_log(0, AV_LOG_ERROR, "Cannot find a video stream in the input file\n");
-        avformat_close_input(&input_ctx);
-        return -1;
-    }
-    video_stream = ret;
-
-    /* find the video decoder: ie: h264_rkmpp / h264_rkmpp_decoder */
-    codecpar = input_ctx->streams[video_stream]->codecpar;
-    if (!codecpar) {
-        av_log(0, AV_LOG_ERROR, "Unable to find stream!\n");
-        avformat_close_input(&input_ctx);
-        return -1;
-    }
-
-#if 0
-    if (codecpar->codec_id != AV_CODEC_ID_H264) {
-        av_log(0, AV_LOG_ERROR, "H264 support only!\n");
-        avformat_close_input(&input_ctx);
-        return -1;
-    }
-#endif
-
-    codec = avcodec_find_decoder(codecpar->codec_id);
-    if (!codec) {
-        av_log(0, AV_LOG_ERROR, "Codec not found!\n");
-        avformat_close_input(&input_ctx);
-        return -1;
-    }
-
-    codec_ctx = avcodec_alloc_context3(codec);
-    if (!codec_ctx) {
-        av_log(0, AV_LOG_ERROR, "Could not allocate video codec context!\n");
-        avformat_close_input(&input_ctx);
+    if (!config.model) {
+        fprintf(stderr, "No model to load! Please pass a model.\n");
+        print_help();
         return -1;
     }
-
-    video = input_ctx->streams[video_stream];
-    if (avcodec_parameters_to_context(codec_ctx, video->codecpar) < 0) {
-        av_log(0, AV_LOG_ERROR, "Error with the codec!\n");
-        avformat_close_input(&input_ctx);
-        avcodec_free_context(&codec_ctx);
+    engine = ffrknn_new(&config);
+    if (!engine)
         return -1;
-    }
-
-    codec_ctx->pix_fmt = AV_PIX_FMT_DRM_PRIME;
-    codec_ctx->coded_height = frame_height;
-    codec_ctx->coded_width = frame_width;
-    codec_ctx->get_format = get_format;
+    /* with the defaults the engine settled: window size, -R implies -B */
+    config = *ffrknn_config(engine);
 
-#if 0
-    while (dict = av_dict_get(opts, "", dict, AV_DICT_IGNORE_SUFFIX)) {
-        fprintf(stderr, "dict: %s -> %s\n", dict->key, dict->value);
-    }
-#endif
-
-    /* open it */
-    if (avcodec_open2(codec_ctx, codec, &opts) < 0) {
-        av_log(0, AV_LOG_ERROR, "Could not open codec!\n");
-        avformat_close_input(&input_ctx);
-        avcodec_free_context(&codec_ctx);
+    for (i = 0; i < nb_inputs; i++)
+        ffrknn_add_stream(engine, inputs[i], 0, NULL, NULL);
+    if (stream_list && load_stream_list(stream_list) < 0) {
+        ffrknn_free(engine);
         return -1;
     }
-
-    av_dict_free(&opts);
-
-    frame = av_frame_alloc();
-    if (!frame) {
-        fprintf(stderr, "Could not allocate video frame\n");
-        avformat_close_input(&input_ctx);
-        avcodec_free_context(&codec_ctx);
+    if (replay_filename && ffrknn_add_replay(engine, replay_filename, NULL, NULL) < 0) {
+        ffrknn_free(engine);
         return -1;
     }
-
-    SDL_VERSION(&sdl_compiled);
-    SDL_GetVersion(&sdl_linked);
-    SDL_Log("SDL: compiled with=%d.%d.%d linked against=%d.%d.%d",
-            sdl_compiled.major, sdl_compiled.minor, sdl_compiled.patch,
-            sdl_linked.major, sdl_linked.minor, sdl_linked.patch);
-
-    // SDL_SetHint(SDL_HINT_RENDER_DRIVER, "opengles2");
-    // SDL_SetHint(SDL_HINT_VIDEO_WAYLAND_ALLOW_LIBDECOR, "0");
-    if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
-        SDL_Log("SDL_Init failed (%s)", SDL_GetError());
-        avformat_close_input(&input_ctx);
-        avcodec_free_context(&codec_ctx);
+    if (!ffrknn_stream_count(engine)) {
+        fprintf(stderr, "No stream to play! Please pass an input.\n");
+        print_help();
+        ffrknn_free(engine);
         return -1;
     }
 
-    SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
-    SDL_GL_SetAttribute(SDL_GL_ACCELERATED_VISUAL, 1);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
-
-    if (SDL_CreateWindowAndRenderer(screen_width, screen_height,
-                                    wflags,
-                                    &window, &renderer) < 0) {
-        SDL_Log("SDL_CreateWindowAndRenderer failed (%s)", SDL_GetError());
+    if (ffrknn_open(engine) < 0) {
+        ret = -1;
         goto error_exit;
     }
-    if (alphablend) {
-        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-    }
-    // SDL_RenderFillRect(renderer, &rect);
-    SDL_SetWindowTitle(window, "rknn yolov5 object detection");
-    SDL_SetWindowPosition(window, screen_left, screen_top);
 
-    format = SDL_PIXELFORMAT_RGB24;
-    texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING,
-                                screen_width, screen_height);
-    if (!texture) {
-        av_log(NULL, AV_LOG_FATAL, "Failed to create texturer: %s", SDL_GetError());
-        goto error_exit;
+    if (config.headless) {
+        signal(SIGINT, sigint_handler);
+        signal(SIGTERM, sigint_handler);
     }
 
-    frameSize_rknn = width * height * channel;
-    resize_buf = calloc(1, frameSize_rknn);
-
-    frameSize_texture = screen_width * screen_height * channel;
-    texture_dst_buf = calloc(1, frameSize_texture);
-
-    if (!resize_buf || !texture_dst_buf) {
-        av_log(NULL, AV_LOG_FATAL, "Failed to create texture buf: %dx%d",
-               screen_width, screen_height);
+    if (ffrknn_start(engine) < 0) {
+        ret = -1;
         goto error_exit;
     }
-
-    ret = 0;
-    while (ret >= 0) {
-        if ((ret = av_read_frame(input_ctx, &pkt)) < 0) {
-            if (ret == AVERROR(EAGAIN)) {
-                ret = 0;
-                continue;
-            }
-            break;
-        }
-        if (video_stream == pkt.stream_index && pkt.size > 0) {
-            ret = decode_and_display(codec_ctx, frame, &pkt);
-            if (delay > 0)
-                usleep(delay * 1000);
-        }
-        av_packet_unref(&pkt);
-
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-            case SDL_EVENT_QUIT:
-            {
-                finished = 1;
-                SDL_Log("Program quit after %ld ticks", event.quit.timestamp);
-                break;
-            }
-            case SDL_EVENT_KEY_DOWN:
-            {
-                SDL_bool withControl = (SDL_bool) !!(event.key.keysym.mod & SDL_KMOD_CTRL);
-                SDL_bool withShift = (SDL_bool) !!(event.key.keysym.mod & SDL_KMOD_SHIFT);
-                SDL_bool withAlt = (SDL_bool) !!(event.key.keysym.mod & SDL_KMOD_ALT);
-
-                switch (event.key.keysym.sym) {
-                /* Add hotkeys here */
-                case SDLK_ESCAPE:
-                    finished = 1;
-                    break;
-                case SDLK_x:
-                    finished = 1;
-                    break;
-                }
-            }
-            }
-        }
-        if (finished) {
-            break;
-        }
+    if (config.headless) {
+        headless_loop();
+    } else if (pthread_create(&render_tid, NULL, render_thread, NULL) == 0) {
+        pthread_join(render_tid, NULL);
+    } else {
+        fprintf(stderr, "Cannot create render thread\n");
     }
-    /* flush the codec */
-    decode_and_display(codec_ctx, frame, NULL);
 
 error_exit:
 
-    if (input_ctx)
-        avformat_close_input(&input_ctx);
-    if (codec_ctx)
-        avcodec_free_context(&codec_ctx);
-    if (frame) {
-        av_frame_free(&frame);
-    }
-    if (texture_dst_buf) {
-        free(texture_dst_buf);
-    }
-    if (resize_buf) {
-        free(resize_buf);
-    }
-    if (renderer) {
-        SDL_DestroyRenderer(renderer);
-    }
-    if (window) {
-        SDL_DestroyWindow(window);
-    }
-    SDL_Quit();
-
+    quit.store(1);
+    ffrknn_stop(engine);
+    ffrknn_report(engine);
+    if (texture_uploads)
+        fprintf(stderr, "Texture upload (%s): %llu bytes/frame, %llu frames\n",
+                config.image_format == AV_PIX_FMT_NV12 ? "nv12" : "rgb24",
+                (unsigned long long)(texture_bytes / texture_uploads), (unsigned long long)texture_uploads);
     // release
-    if (ctx)
-        ret = rknn_destroy(ctx);
-
-    if (model_data) {
-        free(model_data);
-    }
-
-    deinitPostProcess();
-
-    fprintf(stderr, "Avg FPS: %.1f\n", avg_frmrate);
+    ffrknn_free(engine);
+    return ret;
 }
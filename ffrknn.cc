@@ -0,0 +1,2725 @@
+/*
+ * ff-rknn - the pipeline as a library
+ *
+ * Everything between the inputs and the sinks: demux (or replay), decode,
+ * RGA / swscale, the shared NPU pools and post-processing, the second
+ * stage and the per stream outputs. The state that used to be file scope
+ * in ff-rknn.c lives in the engine; ff-rknn.c is its SDL / command line
+ * client.
+ */
+
+#include "ffrknn.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <atomic>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+#include <libavdevice/avdevice.h>
+#include <libavformat/avformat.h>
+#include <libavutil/hwcontext_drm.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/pixfmt.h>
+#include <libswscale/swscale.h>
+
+#ifndef HAVE_RGA
+#define HAVE_RGA 1
+#endif
+
+#if HAVE_RGA
+#include <rga/RgaApi.h>
+#include <rga/rga.h>
+#endif
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#include "annotate.h"
+#include "backend.h"
+#include "cascade.h"
+#include "detlog.h"
+#include "ladder.h"
+#include "mailbox.h"
+#include "metrics.h"
+#include "npu_pool.h"
+#include "pktcap.h"
+#include "postprocess.h"
+#include "recorder.h"
+#include "rknn_api.h"
+#include "shm_ring.h"
+#include "stats.h"
+#include "tensordump.h"
+#include "trace.h"
+
+#ifndef DRM_FORMAT_NV12_10
+#define DRM_FORMAT_NV12_10 fourcc_code('N', 'A', '1', '2')
+#endif
+
+#ifndef DRM_FORMAT_NV15
+#define DRM_FORMAT_NV15 fourcc_code('N', 'A', '1', '5')
+#endif
+
+#define STAGE_QUEUE 4
+
+/* -ds: input shape choice of dynamic shape models */
+#define SHAPE_MIN_BOX 24 // model pixels the smallest detection should keep
+#define SHAPE_CROWD   16 // this many detections keep the largest shape
+#define SHAPE_PROBE   16 // every Nth choice runs the largest shape to find small objects
+
+/* frame reference + detections handed from the detector to the second stage */
+typedef struct _stage_job_t
+{
+    AVFrame *frame;
+    detect_result_group_t group;
+    int64_t n; // frames inferred by the stream with this one, taken at push time
+} stage_job_t;
+
+/* -j: the frame numbers of worker w start here, 24 bits each fit the uint32 of the logs */
+#define SEGMENT_FRAMES (1 << 24)
+
+/* a video packet read from the input, for the latency of its frame */
+#define ARRIVAL_RING 64 // packets remembered, more than any decoder reorder delay
+typedef struct _arrival_t
+{
+    int64_t pts;     // microseconds
+    int64_t arrival; // stats_now()
+    int64_t capture; // AV_PKT_DATA_PRFT wallclock, 0: none
+} arrival_t;
+
+/*
+ * Everything that belongs to one input: demuxer, decoder, the RGA targets
+ * and the detections. The stream thread renders into texture_dst_buf, the
+ * write slot of the mailbox, and publishes it with the detections; the
+ * display picks up the latest slot with ffrknn_image_read().
+ */
+typedef struct _stream_t
+{
+    ffrknn_t *eng;
+    int id;
+    char *url;
+    AVFormatContext *input_ctx;
+    AVCodecContext *codec_ctx;
+    AVFrame *frame;
+    int video_stream;
+    int sw_decode;
+    int64_t next_sample; // analysis fps: next pts to infer, microseconds
+    int segment;         // GOP-parallel worker: [seg_start, seg_end) of the file
+    int64_t frame_base;  // GOP-parallel worker: segment * SEGMENT_FRAMES
+    int64_t seg_start;
+    int64_t seg_end;
+    int seg_done;
+    FILE *seg_file;
+    struct SwsContext *sws_texture;
+    struct SwsContext *sws_rknn;
+    pthread_t thread;
+    int thread_started;
+
+    void *resize_buf;
+    void *texture_dst_buf;
+    detect_result_group_t detect_result_group;
+    int shape;            // -ds: shapes index of the current model for the next frames
+    npu_pool_t *shape_pool; // the model it was chosen for, a ladder move chooses again
+    uint64_t shape_frames; // frames inferred since the first choice
+    uint64_t shape_choices;
+    uint64_t shape_count[NPU_MAX_SHAPES];
+    ladder_state_t ladder; // -m a,b,c: model of this stream and its latency
+
+    mailbox_t mbox;
+    stage_job_t jobs[STAGE_QUEUE]; // -m2: frames waiting for the second stage
+    AVFrame *stage_frame;          // the one the second stage works on
+    int job_head;
+    int job_count;
+    int stage_stop;
+    pthread_mutex_t stage_lock;
+    pthread_cond_t stage_cond;
+    pthread_t stage_thread;
+    int stage_started;
+    uint8_t *crop_buf;
+    struct SwsContext *sws_crop;
+    std::atomic<uint64_t> stage_dropped;
+
+    recorder_t *rec; // -R: annotated frames to file
+    shm_ring_t *shm; // -shm: frames and detections for local readers
+    pthread_mutex_t lock;
+    int finished;
+
+    ffrknn_callback_t cb;
+    void *opaque;
+    std::atomic<uint64_t> presented;
+
+    std::atomic<int64_t> frames_inferred;
+    metrics_stream_t m; // -metrics
+    uint64_t scrape_decoded; // at the previous scrape, for the rates
+    uint64_t scrape_inferred;
+
+    arrival_t arrivals[ARRIVAL_RING];
+    uint64_t arrival_head;
+    stats_hist_t lat_arrival; // packet read to present (headless: to the sinks)
+    stats_hist_t lat_capture; // sender wallclock to the same point
+
+    int paced;           // -vs: packets released at the frame rate of the file, looped
+    int64_t pace_delay;  // staggered start, ns
+    int64_t pace_start;  // stats_now() due time of the first packet
+    int64_t pace_wall;   // the same in CLOCK_REALTIME microseconds
+    int64_t first_dts;   // of the file, stream time base
+    int64_t loop_offset; // added to the timestamps of this pass over the file
+    int64_t loop_end;    // end of the last packet, offset included
+
+    pktcap_reader_t *replay; // -replay: the capture, read up to the next packet of this stream
+    int replay_stream;       // its id in the capture
+    int64_t replay_due;      // stats_now() release time of the previous packet
+    uint32_t replay_seed;
+    uint64_t replay_lost;
+} stream_t;
+
+/* -vs: measured after the warm-up, over all the virtual streams */
+typedef struct _bench_t
+{
+    int seconds; // 0: until interrupted
+    int warmup;
+    std::atomic<int> on;
+    int64_t start;        // stats_now()
+    int64_t frames;       // inferred by then
+    double cpu;           // user + system seconds by then
+    stats_hist_t latency; // due time of the packet to the sinks
+} bench_t;
+
+
+struct _ffrknn_t
+{
+    ffrknn_config_t cfg;
+    int v4l2; // cfg.protocol
+    int rtsp;
+    int rtmp;
+    int http;
+    int live; // any of them: drop rather than wait
+
+    /* --- RKNN --- */
+    char *model_names; // cfg.model, cut at the commas
+    unsigned char *model_data[LADDER_MAX];
+    npu_pool_t npu[LADDER_MAX]; // one model, or a ladder from the largest to the smallest
+    int nb_models;
+    ladder_t ladder;
+    unsigned char *model2_data; // second stage classifier
+    cascade_t cascade;
+    int cascade_on;
+    int input_size; // model input buffer of the streams, largest model
+    int postprocess;
+
+    /* --- frame images: one tile of cfg.width x cfg.height per stream --- */
+    int frame_images; // display, burn-in or shared memory
+    int cols;
+    int image_width;
+    int image_height;
+    int image_size;
+
+    /* --- sinks --- */
+    FILE *det_file;
+    pthread_mutex_t det_lock;
+    detlog_t *det_log;
+    tensordump_t *tensor_dump;
+    pktcap_t *packet_capture;
+    int shm_started; // the per process services this engine runs
+    int metrics_started;
+    int stats_started;
+    int trace_started;
+
+    char *replay_filename; // file[,speed=S,jitter=ms,loss=pct,seed=N]
+    float replay_speed;    // 0: no wait
+    float replay_jitter;   // ms, added to the arrival of each packet
+    float replay_loss;     // percent of the packets dropped
+    uint32_t replay_seed;
+    int64_t replay_start; // stats_now() of arrival 0
+    int64_t replay_wall;  // the same in CLOCK_REALTIME microseconds
+    bench_t bench;
+
+    /* --- Streams --- */
+    stream_t *streams[FFRKNN_MAX_STREAMS];
+    int nb_streams;
+    int opened;
+    int started;
+    int stopped;
+    int64_t start_time; // stats_now()
+    int64_t end_time;
+    int64_t scrape_time; // previous metrics scrape, 0: none yet
+    std::atomic<int> quit;
+};
+
+static const unsigned int frame_width = 960; // coded size hint of the rkmpp decoder
+static const unsigned int frame_height = 540;
+static const float nms_threshold = NMS_THRESH;
+static const float box_conf_threshold = BOX_THRESH;
+
+/* post-processing labels and the class colours are per process, shared by the engines */
+static pthread_mutex_t postprocess_lock = PTHREAD_MUTEX_INITIALIZER;
+static int postprocess_users;
+
+static enum AVPixelFormat get_format(AVCodecContext *Context,
+                                     const enum AVPixelFormat *PixFmt)
+{
+    stream_t *s = (stream_t *)Context->opaque;
+    const enum AVPixelFormat *fmt;
+
+#if HAVE_RGA
+    if (!s->sw_decode) {
+        for (fmt = PixFmt; *fmt != AV_PIX_FMT_NONE; fmt++) {
+            if (*fmt == AV_PIX_FMT_DRM_PRIME)
+                return AV_PIX_FMT_DRM_PRIME;
+        }
+    }
+#endif
+    /* no DRM PRIME: first format living in system memory */
+    for (fmt = PixFmt; *fmt != AV_PIX_FMT_NONE; fmt++) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(*fmt);
+        if (desc && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+            if (!s->sw_decode)
+                fprintf(stderr, "Stream %d: no DRM PRIME output, decoding to %s\n",
+                        s->id, av_get_pix_fmt_name(*fmt));
+            s->sw_decode = 1;
+            return *fmt;
+        }
+    }
+    return AV_PIX_FMT_NONE;
+}
+
+/* native (software) decoder for a codec, skipping rkmpp and other wrappers */
+static const AVCodec *find_sw_decoder(enum AVCodecID id)
+{
+    const AVCodec *codec;
+    void *it = NULL;
+
+    while ((codec = av_codec_iterate(&it))) {
+        if (!av_codec_is_decoder(codec) || codec->id != id)
+            continue;
+        if (codec->wrapper_name || (codec->capabilities & AV_CODEC_CAP_HARDWARE))
+            continue;
+        return codec;
+    }
+    return NULL;
+}
+
+#if HAVE_RGA
+static int drm_rga_buf(int src_x, int src_y, int src_Width, int src_Height, int wStride, int hStride,
+                       int src_fd, int src_format, int dst_Width, int dst_Height,
+                       int dst_format, int frameSize, char *buf)
+{
+    rga_info_t src;
+    rga_info_t dst;
+    int ret;
+    // int hStride = (src_Height + 15) & (~15);
+    // int wStride = (src_Width + 15) & (~15);
+    // int dhStride = (dst_Height + 15) & (~15);
+    // int dwStride = (dst_Width + 15) & (~15);
+
+    memset(&src, 0, sizeof(rga_info_t));
+    src.fd = src_fd;
+    src.mmuFlag = 1;
+
+    memset(&dst, 0, sizeof(rga_info_t));
+    dst.fd = -1;
+    dst.virAddr = buf;
+    dst.mmuFlag = 1;
+
+    rga_set_rect(&src.rect, src_x, src_y, src_Width, src_Height, wStride, hStride,
+                 src_format);
+    rga_set_rect(&dst.rect, 0, 0, dst_Width, dst_Height, dst_Width, dst_Height,
+                 dst_format);
+
+    ret = c_RkRgaBlit(&src, &dst, NULL);
+    return ret;
+}
+
+#if 0
+static char *drm_get_rgaformat_str(uint32_t drm_fmt) 
+{
+  switch (drm_fmt) {
+  case DRM_FORMAT_NV12:
+    return "RK_FORMAT_YCbCr_420_SP";
+  case DRM_FORMAT_NV12_10:
+    return "RK_FORMAT_YCbCr_420_SP_10B";
+  case DRM_FORMAT_NV15:
+    return "RK_FORMAT_YCbCr_420_SP_10B";
+  case DRM_FORMAT_NV16:
+    return "RK_FORMAT_YCbCr_422_SP";
+  case DRM_FORMAT_YUYV:
+    return "RK_FORMAT_YUYV_422";
+  case DRM_FORMAT_UYVY:
+    return "RK_FORMAT_UYVY_422";
+  default:
+    return "0";
+  }
+}
+#endif
+
+static uint32_t drm_get_rgaformat(uint32_t drm_fmt)
+{
+    switch (drm_fmt) {
+    case DRM_FORMAT_NV12:
+        return RK_FORMAT_YCbCr_420_SP;
+    case DRM_FORMAT_NV12_10:
+        return RK_FORMAT_YCbCr_420_SP_10B;
+    case DRM_FORMAT_NV15:
+        return RK_FORMAT_YCbCr_420_SP_10B;
+    case DRM_FORMAT_NV16:
+        return RK_FORMAT_YCbCr_422_SP;
+    case DRM_FORMAT_YUYV:
+        return RK_FORMAT_YUYV_422;
+    case DRM_FORMAT_UYVY:
+        return RK_FORMAT_UYVY_422;
+    default:
+        return 0;
+    }
+}
+#endif
+
+/*
+ * Scale + colour convert the x, y, w, h part of a decoded frame into a
+ * packed RGB888 or NV12 buffer: DRM PRIME frames go through RGA, software
+ * frames through swscale.
+ */
+static int frame_rect_to_buf(AVFrame *frame, int x, int y, int w, int h,
+                             enum AVPixelFormat dst_fmt, int dst_width, int dst_height,
+                             char *buf, struct SwsContext **sws)
+{
+    if (frame->format == AV_PIX_FMT_DRM_PRIME) {
+#if HAVE_RGA
+        AVDRMFrameDescriptor *desc = (AVDRMFrameDescriptor *)frame->data[0];
+        AVDRMLayerDescriptor *layer;
+        RgaSURF_FORMAT src_format;
+        int hStride, wStride;
+
+        if (!desc)
+            return -1;
+        layer = &desc->layers[0];
+        wStride = layer->planes[0].pitch;
+        hStride = (layer->planes[1].offset / layer->planes[0].pitch);
+        src_format = (RgaSURF_FORMAT)drm_get_rgaformat(layer->format);
+
+        if (dst_fmt == AV_PIX_FMT_NV12)
+            return drm_rga_buf(x, y, w, h, wStride, hStride, desc->objects[0].fd, src_format,
+                               dst_width, dst_height, RK_FORMAT_YCbCr_420_SP,
+                               dst_width * dst_height * 3 / 2, buf);
+        return drm_rga_buf(x, y, w, h, wStride, hStride, desc->objects[0].fd, src_format,
+                           dst_width, dst_height, RK_FORMAT_RGB_888,
+                           dst_width * dst_height * 3, buf);
+#else
+        return -1;
+#endif
+    }
+
+    uint8_t *dst[4] = { (uint8_t *)buf, NULL, NULL, NULL };
+    int dst_stride[4] = { dst_width * 3, 0, 0, 0 };
+    AVFrame *src = frame;
+
+    if (dst_fmt == AV_PIX_FMT_NV12) {
+        dst[1] = (uint8_t *)buf + dst_width * dst_height;
+        dst_stride[0] = dst_width;
+        dst_stride[1] = dst_width;
+    }
+    /* crop: a new reference with the data pointers moved to the rect */
+    if (x || y || w != frame->width || h != frame->height) {
+        src = av_frame_clone(frame);
+        if (!src)
+            return -1;
+        src->crop_left = x;
+        src->crop_top = y;
+        src->crop_right = frame->width - x - w;
+        src->crop_bottom = frame->height - y - h;
+        if (av_frame_apply_cropping(src, AV_FRAME_CROP_UNALIGNED) < 0) {
+            av_frame_free(&src);
+            return -1;
+        }
+    }
+    *sws = sws_getCachedContext(*sws, src->width, src->height, (enum AVPixelFormat)src->format,
+                                dst_width, dst_height, dst_fmt,
+                                SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    if (*sws)
+        sws_scale(*sws, src->data, src->linesize, 0, src->height, dst, dst_stride);
+    if (src != frame)
+        av_frame_free(&src);
+    return *sws ? 0 : -1;
+}
+
+static int frame_to_buf(AVFrame *frame, enum AVPixelFormat dst_fmt, int dst_width, int dst_height,
+                        char *buf, struct SwsContext **sws)
+{
+    return frame_rect_to_buf(frame, 0, 0, frame->width, frame->height, dst_fmt,
+                             dst_width, dst_height, buf, sws);
+}
+
+/* object and accuracy filters */
+int ffrknn_detection_shown(ffrknn_t *eng, const detect_result_t *det_result)
+{
+    if (eng->cfg.object && strcmp(det_result->name, eng->cfg.object))
+        return 0;
+    if (eng->cfg.accuracy && (int)(det_result->prop * 100.0) < eng->cfg.accuracy)
+        return 0;
+    return 1;
+}
+
+/* "person 87%", "+ #3" with the second stage class */
+void ffrknn_detection_label(const detect_result_t *det_result, char *text, int size)
+{
+    if (det_result->sub_cls >= 0)
+        snprintf(text, size, "%s %.0f%% #%d", det_result->name, det_result->prop * 100,
+                 det_result->sub_cls);
+    else
+        snprintf(text, size, "%s %.0f%%", det_result->name, det_result->prop * 100);
+}
+
+/*
+ * -B: draw the boxes into texture_dst_buf so the pixels carry them, boxes
+ * are in tile pixels on screen and in source pixels headless.
+ */
+static void stream_annotate(stream_t *s, detect_result_group_t *group, int src_width, int src_height)
+{
+    ffrknn_t *eng = s->eng;
+    int width = eng->image_width, height = eng->image_height;
+    annotate_box_t boxes[OBJ_NUMB_MAX_SIZE];
+    char text[OBJ_NUMB_MAX_SIZE][64];
+    float sx = 1.0f, sy = 1.0f;
+    int n = 0;
+
+    if (eng->cfg.headless) {
+        sx = (float)width / src_width;
+        sy = (float)height / src_height;
+    }
+    for (int i = 0; i < group->count; i++) {
+        detect_result_t *det_result = &(group->results[i]);
+        const uint8_t *c = annotate_palette[annotate_class_color(det_result)];
+        annotate_box_t *b = &boxes[n];
+
+        if (!ffrknn_detection_shown(eng, det_result))
+            continue;
+        b->left = det_result->box.left * sx;
+        b->top = det_result->box.top * sy;
+        b->right = det_result->box.right * sx;
+        b->bottom = det_result->box.bottom * sy;
+        b->rgb[0] = c[0];
+        b->rgb[1] = c[1];
+        b->rgb[2] = c[2];
+        ffrknn_detection_label(det_result, text[n], sizeof(text[n]));
+        b->label = text[n];
+        n++;
+    }
+    if (!n)
+        return;
+
+    if (eng->cfg.image_format == AV_PIX_FMT_NV12) {
+        uint8_t *y_plane = (uint8_t *)s->texture_dst_buf;
+
+        annotate_nv12(y_plane, width, y_plane + width * height, width, width, height, boxes, n,
+                      eng->cfg.alphablend, 1, eng->cfg.label_scale);
+    } else {
+        annotate_rgb((uint8_t *)s->texture_dst_buf, width, height, width * 3, boxes, n,
+                     eng->cfg.alphablend, 1, eng->cfg.label_scale);
+    }
+}
+
+/* -shm: the decoder buffer of the frame, for readers importing the fd */
+static shm_dmabuf_t *frame_dmabuf(AVFrame *frame, shm_dmabuf_t *dmabuf)
+{
+    AVDRMFrameDescriptor *desc = (AVDRMFrameDescriptor *)frame->data[0];
+    AVDRMLayerDescriptor *layer;
+
+    if (frame->format != AV_PIX_FMT_DRM_PRIME || !desc)
+        return NULL;
+    layer = &desc->layers[0];
+    dmabuf->fd = desc->objects[0].fd;
+    dmabuf->fourcc = layer->format;
+    dmabuf->width = frame->width;
+    dmabuf->height = frame->height;
+    dmabuf->pitch = layer->planes[0].pitch;
+    dmabuf->uv_offset = layer->nb_planes > 1 ? layer->planes[1].offset : 0;
+    return dmabuf;
+}
+
+/* hand the finished frame and its detections over to the display */
+static void stream_publish(stream_t *s, detect_result_group_t *group)
+{
+    mailbox_slot_t *slot = mailbox_write_slot(&s->mbox);
+
+    slot->group = *group;
+    mailbox_publish(&s->mbox);
+    s->texture_dst_buf = mailbox_write_slot(&s->mbox)->buf;
+}
+
+/*
+ * One JSON line per inferred frame; boxes are in source frame pixels when
+ * headless. Shared by all stream threads, stdio buffers the writes.
+ */
+static void write_detections(stream_t *s, detect_result_group_t *group)
+{
+    ffrknn_t *eng = s->eng;
+    FILE *fp = s->seg_file ? s->seg_file : eng->det_file;
+
+    if (!s->seg_file)
+        pthread_mutex_lock(&eng->det_lock);
+    fprintf(fp, "{\"stream\":%d,\"pts\":%lld,\"dets\":[", s->id,
+            group->pts == AV_NOPTS_VALUE ? -1LL : (long long)group->pts);
+    for (int i = 0; i < group->count; i++) {
+        detect_result_t *det_result = &(group->results[i]);
+
+        fprintf(fp, "%s{\"name\":\"%s\",\"prop\":%.3f,\"box\":[%d,%d,%d,%d]",
+                i ? "," : "", det_result->name, det_result->prop,
+                det_result->box.left, det_result->box.top,
+                det_result->box.right, det_result->box.bottom);
+        if (det_result->sub_cls >= 0)
+            fprintf(fp, ",\"sub\":[%d,%.3f]", det_result->sub_cls, det_result->sub_prop);
+        fputc('}', fp);
+    }
+    fprintf(fp, "]}\n");
+    if (!s->seg_file)
+        pthread_mutex_unlock(&eng->det_lock);
+}
+
+/*
+ * Frame number in the sinks: the workers of a split file share its id, so
+ * each counts in a range of its own and pts orders the frames.
+ */
+static int64_t stream_frame(stream_t *s, int64_t n)
+{
+    return s->frame_base + n;
+}
+
+/* frame timestamp on the source timeline, in microseconds */
+static int64_t frame_pts_us(stream_t *s, AVFrame *frame)
+{
+    int64_t pts = frame->best_effort_timestamp;
+
+    if (pts == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;
+    return av_rescale_q(pts, s->input_ctx->streams[s->video_stream]->time_base, AV_TIME_BASE_Q);
+}
+
+/* -dump: the outputs of the frame with all post_process() needs to decode them again */
+static void dump_tensors(stream_t *s, npu_pool_t *pool, npu_ctx_t *nctx, rknn_output *outputs,
+                         int model_width, int model_height, float scale_w, float scale_h)
+{
+    ffrknn_t *eng = s->eng;
+    rknn_tensor_attr attrs[NPU_MAX_OUTPUTS];
+    tensordump_frame_t f;
+
+    memcpy(attrs, pool->output_attrs, pool->io_num.n_output * sizeof(rknn_tensor_attr));
+    /* dynamic shapes: the dims of the shape set on this context */
+    for (uint32_t i = 0; pool->nb_shapes && i < pool->io_num.n_output; i++)
+        pool->backend->query(nctx->ctx, RKNN_QUERY_CURRENT_OUTPUT_ATTR, &attrs[i], sizeof(attrs[i]));
+    memset(&f, 0, sizeof(f));
+    f.pts = s->detect_result_group.pts;
+    f.frame = stream_frame(s, s->frames_inferred);
+    f.stream = s->id;
+    f.n_outputs = pool->io_num.n_output;
+    f.model_width = model_width;
+    f.model_height = model_height;
+    f.conf_threshold = box_conf_threshold;
+    f.nms_threshold = nms_threshold;
+    f.scale_w = scale_w;
+    f.scale_h = scale_h;
+    tensordump_write(eng->tensor_dump, &f, attrs, outputs, &s->detect_result_group);
+}
+
+/* packet arrival and sender time of the frame: newest packet with its pts, else the newest */
+static void frame_arrival(stream_t *s, int64_t pts, detect_result_group_t *group)
+{
+    arrival_t *a = NULL;
+
+    group->arrival = 0;
+    group->capture = 0;
+    for (uint64_t i = 0; i < ARRIVAL_RING && i < s->arrival_head; i++) {
+        a = &s->arrivals[(s->arrival_head - 1 - i) % ARRIVAL_RING];
+        if (a->pts == pts)
+            break;
+    }
+    if (!a)
+        return;
+    if (a->pts != pts)
+        a = &s->arrivals[(s->arrival_head - 1) % ARRIVAL_RING];
+    group->arrival = a->arrival;
+    group->capture = a->capture;
+}
+
+/* end to end latency of a frame once it is on the glass (headless: in the sinks) */
+static void latency_record(stream_t *s, const detect_result_group_t *group, int64_t now)
+{
+    ffrknn_t *eng = s->eng;
+    struct timespec ts;
+    int64_t ns;
+
+    if (!group->arrival)
+        return;
+    stats_hist_add(&s->lat_arrival, now - group->arrival);
+    if (group->capture) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ns = (ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 - group->capture) * 1000;
+        stats_hist_add(&s->lat_capture, ns);
+        if (s->paced && eng->bench.on.load(std::memory_order_relaxed))
+            stats_hist_add(&eng->bench.latency, ns);
+    }
+}
+
+/* latency histogram of the stage, and its span with -trace */
+static void stage_span(int stage, stream_t *s, int64_t pts, int core, int64_t begin, int64_t end)
+{
+    stats_record(stage, end - begin);
+    trace_span(stage, s ? s->id : -1, pts, core, begin, end);
+    if (!s)
+        return;
+    switch (stage) {
+    case STATS_RGA_MODEL:
+    case STATS_RGA_TEXTURE:
+    case STATS_RGA_CROP:
+        metrics_add(&s->m.rga_ns, end - begin);
+        break;
+    case STATS_INPUTS_SET:
+    case STATS_RUN:
+    case STATS_OUTPUTS_GET:
+        metrics_add(&s->m.npu_ns, end - begin);
+        break;
+    }
+}
+
+/* RKNN_NPU_CORE_0/1/2 to 0/1/2, -1 for auto */
+static int npu_core_index(rknn_core_mask core)
+{
+    if (core == RKNN_NPU_CORE_0)
+        return 0;
+    if (core == RKNN_NPU_CORE_1)
+        return 1;
+    if (core == RKNN_NPU_CORE_2)
+        return 2;
+    return -1;
+}
+
+/*
+ * GOP-parallel worker: keep frames in [seg_start, seg_end). Leading frames
+ * of an open GOP belong to the previous segment, which decodes past its end
+ * keyframe until the first frame at or after seg_end.
+ */
+static int frame_in_segment(stream_t *s, AVFrame *frame)
+{
+    int64_t pts;
+
+    if (s->seg_start == AV_NOPTS_VALUE && s->seg_end == AV_NOPTS_VALUE)
+        return 1;
+    pts = frame_pts_us(s, frame);
+    if (pts == AV_NOPTS_VALUE)
+        return 1;
+    if (s->seg_end != AV_NOPTS_VALUE && pts >= s->seg_end) {
+        s->seg_done = 1;
+        return 0;
+    }
+    return s->seg_start == AV_NOPTS_VALUE || pts >= s->seg_start;
+}
+
+/* -A: only frames on the analysis fps grid go through RGA and the NPU */
+static int frame_sampled(stream_t *s, AVFrame *frame)
+{
+    ffrknn_t *eng = s->eng;
+    int64_t interval, pts;
+
+    if (eng->cfg.analysis_fps <= 0)
+        return 1;
+    pts = frame_pts_us(s, frame);
+    if (pts == AV_NOPTS_VALUE)
+        return 1;
+    interval = (int64_t)(AV_TIME_BASE / eng->cfg.analysis_fps);
+    if (s->next_sample != AV_NOPTS_VALUE && pts < s->next_sample)
+        return 0;
+    /* stay on the grid, resync after a gap or a backwards jump */
+    if (s->next_sample == AV_NOPTS_VALUE || pts - s->next_sample >= interval)
+        s->next_sample = pts + interval;
+    else
+        s->next_sample += interval;
+    return 1;
+}
+
+/* the frame to the callback of the stream, with its image before it goes to the display */
+static void stream_callback(stream_t *s, AVFrame *frame, detect_result_group_t *group, int64_t n,
+                            int image)
+{
+    ffrknn_t *eng = s->eng;
+    ffrknn_result_t r;
+
+    r.stream = s->id;
+    r.frame = n;
+    r.width = frame->width;
+    r.height = frame->height;
+    r.group = group;
+    r.image = image ? (const uint8_t *)s->texture_dst_buf : NULL;
+    r.image_width = eng->image_width;
+    r.image_height = eng->image_height;
+    r.image_format = eng->cfg.image_format;
+    s->cb(s->opaque, &r);
+}
+
+/*
+ * Everything after the detections: texture image, burn-in, the sinks and
+ * the callback. Runs in the stream thread, or in the second stage thread
+ * with a second stage model: n is the frame count of the detector then.
+ */
+static void stream_output(stream_t *s, AVFrame *frame, detect_result_group_t *group, int64_t n)
+{
+    ffrknn_t *eng = s->eng;
+    int64_t t = stats_now();
+    int image = eng->frame_images &&
+                frame_to_buf(frame, eng->cfg.image_format, eng->image_width, eng->image_height,
+                             (char *)s->texture_dst_buf, &s->sws_texture) == 0;
+
+    if (eng->frame_images)
+        stage_span(STATS_RGA_TEXTURE, s, group->pts, -1, t, stats_now());
+    if (eng->det_file)
+        write_detections(s, group);
+    if (eng->det_log)
+        detlog_append(eng->det_log, s->id, stream_frame(s, n), group);
+    if (image) {
+        if (eng->cfg.burn_in)
+            stream_annotate(s, group, frame->width, frame->height);
+        if (s->rec)
+            recorder_push(s->rec, (uint8_t *)s->texture_dst_buf, group->pts);
+        if (s->shm) {
+            shm_dmabuf_t dmabuf;
+
+            shm_ring_publish(s->shm, s->texture_dst_buf, group, frame_dmabuf(frame, &dmabuf));
+        }
+    }
+    if (s->cb)
+        stream_callback(s, frame, group, n, image);
+    if (image)
+        stream_publish(s, group);
+    /* on screen the frame is done at ffrknn_presented() */
+    if (eng->cfg.headless)
+        latency_record(s, group, stats_now());
+}
+
+/*
+ * -m2: crop the best detections (by score, -o2 class only, at most -c2)
+ * from the source frame into the batch buffer and classify them.
+ */
+static void stage_classify(stream_t *s, AVFrame *frame, detect_result_group_t *group)
+{
+    ffrknn_t *eng = s->eng;
+    int order[OBJ_NUMB_MAX_SIZE];
+    int cls[CASCADE_MAX_CROPS];
+    float prop[CASCADE_MAX_CROPS];
+    int crop_w = eng->cascade.pool.width, crop_h = eng->cascade.pool.height;
+    int min_w = crop_w / 8 > 16 ? crop_w / 8 : 16;
+    int min_h = crop_h / 8 > 16 ? crop_h / 8 : 16;
+    float sx = 1.0f, sy = 1.0f;
+    int n = 0, crops = 0;
+    int ret;
+
+    for (int i = 0; i < group->count; i++) {
+        group->results[i].sub_cls = -1;
+        if (!ffrknn_detection_shown(eng, &group->results[i]) ||
+            (eng->cfg.object2 && strcmp(group->results[i].name, eng->cfg.object2)))
+            continue;
+        /* insertion sort by score, the list is short */
+        int j = n++;
+        for (; j > 0 && group->results[order[j - 1]].prop < group->results[i].prop; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+    if (n > eng->cfg.max_crops)
+        n = eng->cfg.max_crops;
+
+    /* boxes are in tile pixels on screen, the crop comes from the frame */
+    if (!eng->cfg.headless) {
+        sx = (float)frame->width / eng->image_width;
+        sy = (float)frame->height / eng->image_height;
+    }
+    for (int i = 0; i < n; i++) {
+        BOX_RECT *box = &group->results[order[i]].box;
+        int x = box->left * sx, y = box->top * sy;
+        int w = (box->right - box->left + 1) * sx, h = (box->bottom - box->top + 1) * sy;
+
+        /* RGA: even rect for YUV sources, scale factor below 16 */
+        if (w < min_w) {
+            x -= (min_w - w) / 2;
+            w = min_w;
+        }
+        if (h < min_h) {
+            y -= (min_h - h) / 2;
+            h = min_h;
+        }
+        x = x < 0 ? 0 : x & ~1;
+        y = y < 0 ? 0 : y & ~1;
+        if (x + w > frame->width)
+            w = frame->width - x;
+        if (y + h > frame->height)
+            h = frame->height - y;
+        w &= ~1;
+        h &= ~1;
+        if (w < 2 || h < 2)
+            continue;
+        int64_t t = stats_now();
+        ret = frame_rect_to_buf(frame, x, y, w, h, AV_PIX_FMT_RGB24, crop_w, crop_h,
+                                (char *)s->crop_buf + (size_t)crops * eng->cascade.crop_size,
+                                &s->sws_crop);
+        stage_span(STATS_RGA_CROP, s, group->pts, -1, t, stats_now());
+        if (ret < 0)
+            continue;
+        order[crops++] = order[i];
+    }
+    if (!crops || cascade_classify(&eng->cascade, s->crop_buf, crops, cls, prop) < 0)
+        return;
+    for (int i = 0; i < crops; i++) {
+        group->results[order[i]].sub_cls = cls[i];
+        group->results[order[i]].sub_prop = prop[i];
+    }
+}
+
+/*
+ * Live inputs drop the oldest waiting frame when the second stage falls
+ * behind, files wait for it so no detections are lost.
+ */
+static void stage_push(stream_t *s, AVFrame *frame, detect_result_group_t *group, int64_t n)
+{
+    ffrknn_t *eng = s->eng;
+    stage_job_t *job;
+
+    pthread_mutex_lock(&s->stage_lock);
+    while (s->job_count == STAGE_QUEUE) {
+        if (eng->live) {
+            av_frame_unref(s->jobs[s->job_head].frame);
+            s->job_head = (s->job_head + 1) % STAGE_QUEUE;
+            s->job_count--;
+            s->stage_dropped++;
+        } else {
+            pthread_cond_wait(&s->stage_cond, &s->stage_lock);
+        }
+    }
+    job = &s->jobs[(s->job_head + s->job_count) % STAGE_QUEUE];
+    if (av_frame_ref(job->frame, frame) == 0) {
+        job->group = *group;
+        job->n = n;
+        s->job_count++;
+        pthread_cond_broadcast(&s->stage_cond);
+    }
+    pthread_mutex_unlock(&s->stage_lock);
+}
+
+static void *stage_thread(void *arg)
+{
+    stream_t *s = (stream_t *)arg;
+    AVFrame *frame = s->stage_frame;
+    detect_result_group_t group;
+    int64_t t, t_output, n;
+
+    trace_thread_name("stage %d", s->id);
+    for (;;) {
+        stage_job_t *job;
+
+        pthread_mutex_lock(&s->stage_lock);
+        while (!s->job_count && !s->stage_stop)
+            pthread_cond_wait(&s->stage_cond, &s->stage_lock);
+        if (!s->job_count) {
+            pthread_mutex_unlock(&s->stage_lock);
+            break;
+        }
+        /* take the job out, the slot can be refilled while we work */
+        job = &s->jobs[s->job_head];
+        av_frame_move_ref(frame, job->frame);
+        group = job->group;
+        n = job->n;
+        s->job_head = (s->job_head + 1) % STAGE_QUEUE;
+        s->job_count--;
+        pthread_cond_broadcast(&s->stage_cond);
+        pthread_mutex_unlock(&s->stage_lock);
+
+        t = stats_now();
+        stage_classify(s, frame, &group);
+        t_output = stats_now();
+        stream_output(s, frame, &group, n);
+        trace_span(TRACE_CLASSIFY, s->id, group.pts, -1, t, t_output);
+        trace_span(TRACE_OUTPUT, s->id, group.pts, -1, t_output, stats_now());
+        av_frame_unref(frame);
+    }
+    return NULL;
+}
+
+static int stage_start(stream_t *s)
+{
+    ffrknn_t *eng = s->eng;
+    cascade_t *c = &eng->cascade;
+
+    s->crop_buf = (uint8_t *)malloc((size_t)c->crop_size *
+                                    ((eng->cfg.max_crops + c->batch - 1) / c->batch) * c->batch);
+    if (!s->crop_buf)
+        return -1;
+    for (int i = 0; i < STAGE_QUEUE; i++) {
+        s->jobs[i].frame = av_frame_alloc();
+        if (!s->jobs[i].frame)
+            return -1;
+    }
+    s->stage_frame = av_frame_alloc();
+    if (!s->stage_frame)
+        return -1;
+    if (pthread_create(&s->stage_thread, NULL, stage_thread, s) != 0)
+        return -1;
+    s->stage_started = 1;
+    return 0;
+}
+
+/* waits until the queued frames went through the second stage */
+static void stage_stop(stream_t *s)
+{
+    if (!s->stage_started)
+        return;
+    pthread_mutex_lock(&s->stage_lock);
+    s->stage_stop = 1;
+    pthread_cond_broadcast(&s->stage_cond);
+    pthread_mutex_unlock(&s->stage_lock);
+    pthread_join(s->stage_thread, NULL);
+    s->stage_started = 0;
+}
+
+/*
+ * Smallest model shape at which the smallest shown detection of the last
+ * frame still spans SHAPE_MIN_BOX pixels; nothing detected gives the
+ * smallest shape, a crowd the largest.
+ */
+static int shape_for(ffrknn_t *eng, npu_pool_t *pool, detect_result_group_t *group, int ref_width,
+                     int ref_height)
+{
+    float min_w = 1.0f, min_h = 1.0f;
+    int n = 0;
+
+    for (int i = 0; i < group->count; i++) {
+        detect_result_t *det_result = &group->results[i];
+        float w = (float)(det_result->box.right - det_result->box.left + 1) / ref_width;
+        float h = (float)(det_result->box.bottom - det_result->box.top + 1) / ref_height;
+
+        if (!ffrknn_detection_shown(eng, det_result))
+            continue;
+        if (w < min_w)
+            min_w = w;
+        if (h < min_h)
+            min_h = h;
+        n++;
+    }
+    if (n >= SHAPE_CROWD)
+        return pool->nb_shapes - 1;
+    for (int i = 0; i < pool->nb_shapes - 1; i++) {
+        if (pool->shapes[i].width * min_w >= SHAPE_MIN_BOX &&
+            pool->shapes[i].height * min_h >= SHAPE_MIN_BOX)
+            return i;
+    }
+    return pool->nb_shapes - 1;
+}
+
+static void choose_shape(stream_t *s, npu_pool_t *pool, AVFrame *frame)
+{
+    ffrknn_t *eng = s->eng;
+
+    if (eng->cfg.shape_interval <= 0) {
+        s->shape = pool->nb_shapes - 1;
+        s->shape_pool = pool;
+        return;
+    }
+    /* new model on the ladder: choose now */
+    if (s->shape_pool != pool) {
+        s->shape_pool = pool;
+        s->shape_frames = 0;
+    }
+    if (s->shape_frames++ % eng->cfg.shape_interval)
+        return;
+    /* s->detect_result_group still holds the previous frame */
+    if (++s->shape_choices % SHAPE_PROBE == 0)
+        s->shape = pool->nb_shapes - 1;
+    else if (eng->cfg.headless)
+        s->shape = shape_for(eng, pool, &s->detect_result_group, frame->width, frame->height);
+    else
+        s->shape = shape_for(eng, pool, &s->detect_result_group, eng->image_width,
+                             eng->image_height);
+}
+
+static int decode_and_display(stream_t *s, AVPacket *pkt)
+{
+    ffrknn_t *eng = s->eng;
+    AVCodecContext *dec_ctx = s->codec_ctx;
+    AVFrame *frame = s->frame;
+    npu_ctx_t *nctx;
+    rknn_input inputs[1];
+    float scale_w, scale_h;
+    int64_t t0, t1, t2, t_wait, send_ns, pts, n;
+    int core;
+    int ret;
+
+    t0 = stats_now();
+    ret = avcodec_send_packet(dec_ctx, pkt);
+    if (ret < 0) {
+        fprintf(stderr, "Error sending a packet for decoding\n");
+        return ret;
+    }
+    /* the packet's send is billed to its first frame */
+    send_ns = stats_now() - t0;
+    ret = 0;
+    while (ret >= 0) {
+        t0 = stats_now();
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            break;
+        } else if (ret < 0) {
+            fprintf(stderr, "Error during decoding!\n");
+            return ret;
+        }
+        pts = frame_pts_us(s, frame);
+        stage_span(STATS_DECODE, s, pts, -1, t0 - send_ns, stats_now());
+        metrics_add(&s->m.decoded, 1);
+        send_ns = 0;
+        if (!frame_in_segment(s, frame) || !frame_sampled(s, frame))
+            continue;
+
+        /* ------------ RKNN ----------- */
+        npu_pool_t *pool = &eng->npu[s->ladder.rung];
+        int model_width = pool->width, model_height = pool->height;
+
+        if (pool->nb_shapes) {
+            choose_shape(s, pool, frame);
+            model_width = pool->shapes[s->shape].width;
+            model_height = pool->shapes[s->shape].height;
+        }
+        t0 = stats_now();
+        ret = frame_to_buf(frame, AV_PIX_FMT_RGB24, model_width, model_height, (char *)s->resize_buf,
+                           &s->sws_rknn);
+        stage_span(STATS_RGA_MODEL, s, pts, -1, t0, stats_now());
+        if (ret < 0) {
+            ret = 0;
+            continue;
+        }
+
+        memset(inputs, 0, sizeof(inputs));
+        inputs[0].index = 0;
+        inputs[0].type = RKNN_TENSOR_UINT8;
+        inputs[0].size = model_width * model_height * pool->channel;
+        inputs[0].fmt = RKNN_TENSOR_NHWC;
+        inputs[0].pass_through = 0;
+        inputs[0].buf = s->resize_buf;
+
+        rknn_output outputs[pool->io_num.n_output];
+        memset(outputs, 0, sizeof(outputs));
+        for (int i = 0; i < pool->io_num.n_output; i++) {
+            outputs[i].want_float = 0;
+        }
+
+        t_wait = stats_now();
+        nctx = npu_pool_acquire(pool);
+        t1 = stats_now();
+        core = npu_core_index(nctx->core);
+        stage_span(STATS_NPU_WAIT, s, pts, core, t_wait, t1);
+        if (npu_pool_set_shape(pool, nctx, s->shape) < 0) {
+            npu_pool_release(pool, nctx);
+            continue;
+        }
+        if (pool->nb_shapes)
+            s->shape_count[s->shape]++;
+        ret = pool->backend->inputs_set(nctx->ctx, pool->io_num.n_input, inputs);
+        t2 = stats_now();
+        stage_span(STATS_INPUTS_SET, s, pts, core, t1, t2);
+        if (ret >= 0) {
+            ret = pool->backend->run(nctx->ctx, NULL);
+            t0 = stats_now();
+            stage_span(STATS_RUN, s, pts, core, t2, t0);
+        }
+        if (ret >= 0) {
+            ret = pool->backend->outputs_get(nctx->ctx, pool->io_num.n_output, outputs, NULL);
+            t2 = stats_now();
+            stage_span(STATS_OUTPUTS_GET, s, pts, core, t0, t2);
+        }
+        if (ret < 0) {
+            npu_pool_release(pool, nctx);
+            fprintf(stderr, "Stream %d: rknn error ret=%d, frame skipped\n", s->id, ret);
+            ret = 0;
+            continue;
+        }
+
+        // post process: boxes in tile pixels on screen, source pixels headless
+        if (eng->cfg.headless) {
+            scale_w = (float)model_width / frame->width;
+            scale_h = (float)model_height / frame->height;
+        } else {
+            scale_w = (float)model_width / eng->image_width;
+            scale_h = (float)model_height / eng->image_height;
+        }
+
+        t0 = stats_now();
+        post_process((int8_t *)outputs[0].buf, (int8_t *)outputs[1].buf, (int8_t *)outputs[2].buf,
+                     model_height, model_width, box_conf_threshold, nms_threshold,
+                     scale_w, scale_h, pool->out_zps, pool->out_scales, &s->detect_result_group);
+        stage_span(STATS_POSTPROCESS, s, pts, -1, t0, stats_now());
+        s->detect_result_group.id = s->id;
+        s->detect_result_group.pts = pts;
+        frame_arrival(s, pts, &s->detect_result_group);
+        metrics_add(&s->m.detections, s->detect_result_group.count);
+        if (eng->tensor_dump && s->frames_inferred % eng->tensor_dump->every == 0)
+            dump_tensors(s, pool, nctx, outputs, model_width, model_height, scale_w, scale_h);
+
+        ret = pool->backend->outputs_release(nctx->ctx, pool->io_num.n_output, outputs);
+        npu_pool_release(pool, nctx);
+        /* queue wait and inference against the SLO: next model of the stream */
+        ladder_update(&eng->ladder, &s->ladder, (t1 - t_wait) / 1e6f, (t2 - t1) / 1e6f, t2 / 1000);
+
+        n = ++s->frames_inferred;
+        if (eng->cascade_on) {
+            stage_push(s, frame, &s->detect_result_group, n);
+        } else {
+            t0 = stats_now();
+            stream_output(s, frame, &s->detect_result_group, n);
+            trace_span(TRACE_OUTPUT, s->id, pts, -1, t0, stats_now());
+        }
+    }
+    return 0;
+}
+
+static int stream_interrupt(void *opaque)
+{
+    stream_t *s = (stream_t *)opaque;
+
+    return s->eng->quit.load();
+}
+
+static stream_t *stream_alloc(ffrknn_t *eng, int id, const char *url)
+{
+    stream_t *s;
+
+    s = (stream_t *)calloc(1, sizeof(stream_t));
+    if (!s)
+        return NULL;
+    s->url = strdup(url);
+    if (!s->url) {
+        free(s);
+        return NULL;
+    }
+    s->eng = eng;
+    s->id = id;
+    s->video_stream = -1;
+    s->next_sample = AV_NOPTS_VALUE;
+    s->seg_start = AV_NOPTS_VALUE;
+    s->seg_end = AV_NOPTS_VALUE;
+    s->first_dts = AV_NOPTS_VALUE;
+    s->loop_end = AV_NOPTS_VALUE;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_mutex_init(&s->stage_lock, NULL);
+    pthread_cond_init(&s->stage_cond, NULL);
+    return s;
+}
+
+static int stream_open_decoder(stream_t *s, AVStream *video, const AVCodec *codec,
+                               AVDictionary **opts)
+{
+    ffrknn_t *eng = s->eng;
+
+    s->codec_ctx = avcodec_alloc_context3(codec);
+    if (!s->codec_ctx) {
+        av_log(0, AV_LOG_ERROR, "Could not allocate video codec context!\n");
+        return -1;
+    }
+
+    if (avcodec_parameters_to_context(s->codec_ctx, video->codecpar) < 0) {
+        av_log(0, AV_LOG_ERROR, "Error with the codec!\n");
+        avcodec_free_context(&s->codec_ctx);
+        return -1;
+    }
+
+    s->codec_ctx->opaque = s;
+    s->codec_ctx->get_format = get_format;
+    s->codec_ctx->skip_frame = eng->cfg.skip_frame;
+    if (s->sw_decode) {
+        /* frame threading adds a frame of delay per thread: slices only on live sources */
+        s->codec_ctx->thread_count = eng->cfg.decoder_threads;
+        s->codec_ctx->thread_type = FF_THREAD_SLICE;
+        if (!eng->live)
+            s->codec_ctx->thread_type |= FF_THREAD_FRAME;
+    } else {
+        s->codec_ctx->pix_fmt = AV_PIX_FMT_DRM_PRIME;
+        s->codec_ctx->coded_height = frame_height;
+        s->codec_ctx->coded_width = frame_width;
+    }
+
+    if (avcodec_open2(s->codec_ctx, codec, opts) < 0) {
+        av_log(0, AV_LOG_ERROR, "Could not open codec %s!\n", codec->name);
+        avcodec_free_context(&s->codec_ctx);
+        return -1;
+    }
+    if (s->sw_decode)
+        fprintf(stderr, "Stream %d: %s software decoding, %d thread(s)\n",
+                s->id, codec->name, s->codec_ctx->thread_count);
+    return 0;
+}
+
+/* the demuxer of the input and its video stream */
+static int stream_open_demuxer(stream_t *s, AVDictionary **opts)
+{
+    ffrknn_t *eng = s->eng;
+    AVInputFormat *ifmt = NULL;
+    int ret;
+
+    if (eng->rtsp) {
+        // av_dict_set(opts, "rtsp_transport", "tcp", 0);
+        av_dict_set(opts, "rtsp_flags", "prefer_tcp", 0);
+    }
+    if (eng->v4l2) {
+        avdevice_register_all();
+        ifmt = av_find_input_format("video4linux2");
+        if (!ifmt) {
+            av_log(0, AV_LOG_ERROR, "Cannot find input format: v4l2\n");
+            return -1;
+        }
+        s->input_ctx->flags |= AVFMT_FLAG_NONBLOCK;
+        if (eng->cfg.pixel_format) {
+            av_dict_set(opts, "input_format", eng->cfg.pixel_format, 0);
+        }
+        if (eng->cfg.video_size)
+            av_dict_set(opts, "video_size", eng->cfg.video_size, 0);
+        if (eng->cfg.frame_rate)
+            av_dict_set(opts, "framerate", eng->cfg.frame_rate, 0);
+    }
+    if (eng->rtmp) {
+        ifmt = av_find_input_format("flv");
+        if (!ifmt) {
+            av_log(0, AV_LOG_ERROR, "Cannot find input format: flv\n");
+            return -1;
+        }
+        av_dict_set(opts, "fflags", "nobuffer", 0);
+    }
+
+    if (eng->http) {
+        av_dict_set(opts, "fflags", "nobuffer", 0);
+    }
+
+    if (avformat_open_input(&s->input_ctx, s->url, ifmt, opts) != 0) {
+        av_log(0, AV_LOG_ERROR, "Cannot open input file '%s'\n", s->url);
+        return -1;
+    }
+
+    if (avformat_find_stream_info(s->input_ctx, NULL) < 0) {
+        av_log(0, AV_LOG_ERROR, "Cannot find input stream information.\n");
+        return -1;
+    }
+
+    /* find the video stream information */
+    ret = av_find_best_stream(s->input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (ret < 0) {
+        av_log(0, AV_LOG_ERROR, "Cannot find a video stream in the input file\n");
+        return -1;
+    }
+    s->video_stream = ret;
+
+    if (s->seg_start != AV_NOPTS_VALUE) {
+        AVStream *st = s->input_ctx->streams[s->video_stream];
+
+        ret = av_seek_frame(s->input_ctx, s->video_stream,
+                            av_rescale_q(s->seg_start, AV_TIME_BASE_Q, st->time_base),
+                            AVSEEK_FLAG_BACKWARD);
+        if (ret < 0) {
+            av_log(0, AV_LOG_ERROR, "Stream %d: cannot seek to segment %d\n", s->id, s->segment);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* -replay: a context without demuxer, its one stream described by the capture */
+static int replay_open(stream_t *s)
+{
+    ffrknn_t *eng = s->eng;
+    pktcap_record_t rec;
+    AVStream *st;
+
+    if (pktcap_reader_open(s->replay, eng->replay_filename) < 0) {
+        av_log(0, AV_LOG_ERROR, "Cannot read packet capture '%s'\n", eng->replay_filename);
+        return -1;
+    }
+    memset(&rec, 0, sizeof(rec));
+    while (pktcap_next(s->replay, &rec) && !(rec.stream && rec.stream->stream == s->replay_stream))
+        ;
+    if (!rec.stream || rec.stream->stream != s->replay_stream)
+        return -1;
+    st = avformat_new_stream(s->input_ctx, NULL);
+    if (!st || pktcap_stream_params(&rec, st->codecpar, &st->time_base, &st->avg_frame_rate) < 0)
+        return -1;
+    st->r_frame_rate = st->avg_frame_rate;
+    s->video_stream = st->index;
+    return 0;
+}
+
+static int stream_open(stream_t *s)
+{
+    ffrknn_t *eng = s->eng;
+    AVStream *video = NULL;
+    AVCodec *codec;
+    AVCodecParameters *codecpar;
+    AVDictionary *opts = NULL;
+    int ret;
+
+    s->input_ctx = avformat_alloc_context();
+    if (!s->input_ctx) {
+        av_log(0, AV_LOG_ERROR, "Cannot allocate input format (Out of memory?)\n");
+        return -1;
+    }
+    s->input_ctx->interrupt_callback.callback = stream_interrupt;
+    s->input_ctx->interrupt_callback.opaque = s;
+
+    av_dict_set(&opts, "num_capture_buffers", "128", 0);
+    if (s->replay)
+        ret = replay_open(s);
+    else
+        ret = stream_open_demuxer(s, &opts);
+    if (ret < 0) {
+        av_dict_free(&opts);
+        return -1;
+    }
+
+    /* find the video decoder: ie: h264_rkmpp / h264_rkmpp_decoder */
+    codecpar = s->input_ctx->streams[s->video_stream]->codecpar;
+    if (!codecpar) {
+        av_log(0, AV_LOG_ERROR, "Unable to find stream!\n");
+        av_dict_free(&opts);
+        return -1;
+    }
+
+#if 0
+    if (codecpar->codec_id != AV_CODEC_ID_H264) {
+        av_log(0, AV_LOG_ERROR, "H264 support only!\n");
+        return -1;
+    }
+#endif
+
+    s->sw_decode = eng->cfg.sw_decode || !HAVE_RGA;
+    if (s->sw_decode)
+        codec = find_sw_decoder(codecpar->codec_id);
+    else
+        codec = avcodec_find_decoder(codecpar->codec_id);
+    if (!codec) {
+        av_log(0, AV_LOG_ERROR, "Codec not found!\n");
+        av_dict_free(&opts);
+        return -1;
+    }
+
+    /* open it, hardware decoder sessions may be exhausted: retry in software */
+    video = s->input_ctx->streams[s->video_stream];
+    if (stream_open_decoder(s, video, codec, &opts) < 0) {
+        if (s->sw_decode || !(codec = find_sw_decoder(codecpar->codec_id))) {
+            av_dict_free(&opts);
+            return -1;
+        }
+        fprintf(stderr, "Stream %d: hardware decoder unavailable, falling back to %s\n",
+                s->id, codec->name);
+        s->sw_decode = 1;
+        if (stream_open_decoder(s, video, codec, &opts) < 0) {
+            av_dict_free(&opts);
+            return -1;
+        }
+    }
+
+    av_dict_free(&opts);
+
+    s->frame = av_frame_alloc();
+    if (!s->frame) {
+        fprintf(stderr, "Could not allocate video frame\n");
+        return -1;
+    }
+
+    s->resize_buf = calloc(1, eng->input_size);
+    if (eng->frame_images) {
+        if (mailbox_init(&s->mbox, eng->image_size) == 0)
+            s->texture_dst_buf = mailbox_write_slot(&s->mbox)->buf;
+    }
+    if (!s->resize_buf || (eng->frame_images && !s->texture_dst_buf)) {
+        av_log(NULL, AV_LOG_FATAL, "Failed to create texture buf: %dx%d",
+               eng->image_width, eng->image_height);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * -vs: hold the video packet until it is due, as if a camera had just sent
+ * it, and return that time as its capture time (microseconds, realtime):
+ * a pipeline that falls behind keeps the backlog in its latency.
+ */
+static int64_t pace_packet(stream_t *s, AVPacket *pkt)
+{
+    ffrknn_t *eng = s->eng;
+    AVStream *st = s->input_ctx->streams[pkt->stream_index];
+    int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    int64_t duration, due, t;
+    struct timespec ts;
+
+    if (dts == AV_NOPTS_VALUE)
+        return 0;
+    if (s->first_dts == AV_NOPTS_VALUE) {
+        s->first_dts = dts;
+        s->pace_start = stats_now() + s->pace_delay;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        s->pace_wall = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 + s->pace_delay / 1000;
+    }
+    if (pkt->pts != AV_NOPTS_VALUE)
+        pkt->pts += s->loop_offset;
+    if (pkt->dts != AV_NOPTS_VALUE)
+        pkt->dts += s->loop_offset;
+    dts += s->loop_offset;
+    duration = pkt->duration;
+    if (duration <= 0 && st->avg_frame_rate.num)
+        duration = av_rescale_q(1, av_inv_q(st->avg_frame_rate), st->time_base);
+    if (s->loop_end == AV_NOPTS_VALUE || dts + duration > s->loop_end)
+        s->loop_end = dts + duration;
+
+    due = av_rescale_q(dts - s->first_dts, st->time_base, AV_TIME_BASE_Q);
+    t = s->pace_start + due * 1000;
+    ts.tv_sec = t / 1000000000;
+    ts.tv_nsec = t % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !eng->quit.load())
+        ;
+    return s->pace_wall + due;
+}
+
+/* -vs: back to the start of the file, the timestamps go on from the end of the pass */
+static int stream_loop(stream_t *s)
+{
+    if (s->loop_end == AV_NOPTS_VALUE ||
+        av_seek_frame(s->input_ctx, s->video_stream, s->first_dts, AVSEEK_FLAG_BACKWARD) < 0)
+        return -1;
+    s->loop_offset = s->loop_end - s->first_dts;
+    return 0;
+}
+
+static uint32_t replay_rand(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+/*
+ * -replay: the next captured packet of the stream once it is due. Jitter
+ * delays a packet without reordering, like the jitter buffer of a live
+ * source; the seed of the stream picks the same delays and losses every run.
+ */
+static int replay_packet(stream_t *s, AVPacket *pkt)
+{
+    ffrknn_t *eng = s->eng;
+    pktcap_record_t rec;
+
+    while (pktcap_next(s->replay, &rec)) {
+        const pktcap_packet_t *p = rec.packet;
+        AVProducerReferenceTime *prft;
+        struct timespec ts;
+        int64_t due;
+
+        if (!p || p->stream != s->replay_stream)
+            continue;
+        if (eng->replay_loss > 0 && replay_rand(&s->replay_seed) % 10000 < eng->replay_loss * 100) {
+            s->replay_lost++;
+            continue;
+        }
+        due = eng->replay_speed > 0 ? eng->replay_start + (int64_t)(p->arrival / eng->replay_speed) :
+                                      stats_now();
+        if (eng->replay_jitter > 0)
+            due += (int64_t)(replay_rand(&s->replay_seed) % 1000 * eng->replay_jitter * 1000);
+        if (due < s->replay_due)
+            due = s->replay_due;
+        s->replay_due = due;
+        ts.tv_sec = due / 1000000000;
+        ts.tv_nsec = due % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR &&
+               !eng->quit.load())
+            ;
+
+        if (av_new_packet(pkt, p->data_size) < 0)
+            return AVERROR(ENOMEM);
+        memcpy(pkt->data, rec.data, p->data_size);
+        pkt->stream_index = s->video_stream;
+        pkt->flags = p->flags;
+        pkt->pts = p->pts;
+        pkt->dts = p->dts;
+        pkt->duration = p->duration;
+        /* the sender clock moved to the replay, keeping the network delay of the capture */
+        if (p->capture) {
+            prft = (AVProducerReferenceTime *)av_packet_new_side_data(pkt, AV_PKT_DATA_PRFT,
+                                                                      sizeof(*prft));
+            if (prft) {
+                memset(prft, 0, sizeof(*prft));
+                prft->wallclock = eng->replay_wall + (due - eng->replay_start) / 1000 -
+                                  (s->replay->created + p->arrival / 1000 - p->capture);
+            }
+        }
+        return 0;
+    }
+    return AVERROR_EOF;
+}
+
+static void *stream_thread(void *arg)
+{
+    stream_t *s = (stream_t *)arg;
+    ffrknn_t *eng = s->eng;
+    AVPacket pkt;
+    int ret;
+
+    if (s->segment)
+        trace_thread_name("stream %d/%d", s->id, s->segment);
+    else
+        trace_thread_name("stream %d", s->id);
+    ret = 0;
+    while (ret >= 0 && !eng->quit.load() && !s->seg_done) {
+        int64_t t = stats_now();
+
+        if ((ret = s->replay ? replay_packet(s, &pkt) : av_read_frame(s->input_ctx, &pkt)) < 0) {
+            if (ret == AVERROR(EAGAIN)) {
+                ret = 0;
+                continue;
+            }
+            if (ret == AVERROR_EOF && s->paced && stream_loop(s) == 0) {
+                ret = 0;
+                continue;
+            }
+            break;
+        }
+        if (s->video_stream == pkt.stream_index) {
+            arrival_t *a = &s->arrivals[s->arrival_head++ % ARRIVAL_RING];
+            AVProducerReferenceTime *prft;
+            int64_t read = stats_now(), due = 0;
+            size_t size;
+
+            if (s->paced)
+                due = pace_packet(s, &pkt);
+            a->pts = pkt.pts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+                     av_rescale_q(pkt.pts, s->input_ctx->streams[pkt.stream_index]->time_base,
+                                  AV_TIME_BASE_Q);
+            a->arrival = stats_now();
+            /* RTSP: rtpdec maps the RTP time to the sender wallclock of the last RTCP SR */
+            prft = (AVProducerReferenceTime *)av_packet_get_side_data(&pkt, AV_PKT_DATA_PRFT, &size);
+            a->capture = prft && size >= sizeof(*prft) ? prft->wallclock : 0;
+            if (due)
+                a->capture = due;
+            stage_span(STATS_DEMUX, s, a->pts, -1, t, read);
+            if (eng->packet_capture)
+                pktcap_write(eng->packet_capture, s->id, &pkt, read, a->capture);
+        }
+        /* keyframe-only: drop the rest before it costs a decoder call */
+        if (eng->cfg.skip_frame >= AVDISCARD_NONKEY && !(pkt.flags & AV_PKT_FLAG_KEY)) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+        if (s->video_stream == pkt.stream_index && pkt.size > 0) {
+            ret = decode_and_display(s, &pkt);
+            if (eng->cfg.delay > 0 && !eng->cfg.headless)
+                usleep(eng->cfg.delay * 1000);
+        }
+        av_packet_unref(&pkt);
+    }
+    /* flush the codec */
+    if (!s->seg_done)
+        decode_and_display(s, NULL);
+    stage_stop(s);
+
+    pthread_mutex_lock(&s->lock);
+    s->finished = 1;
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void stream_free(stream_t *s)
+{
+    stage_stop(s);
+    if (s->input_ctx)
+        avformat_close_input(&s->input_ctx);
+    if (s->codec_ctx)
+        avcodec_free_context(&s->codec_ctx);
+    if (s->frame)
+        av_frame_free(&s->frame);
+    if (s->seg_file)
+        fclose(s->seg_file);
+    sws_freeContext(s->sws_texture);
+    sws_freeContext(s->sws_rknn);
+    mailbox_deinit(&s->mbox);
+    free(s->rec);
+    if (s->shm)
+        shm_ring_destroy(s->shm);
+    free(s->shm);
+    free(s->resize_buf);
+    if (s->replay) {
+        pktcap_reader_close(s->replay);
+        free(s->replay);
+    }
+    for (int i = 0; i < STAGE_QUEUE; i++)
+        av_frame_free(&s->jobs[i].frame);
+    av_frame_free(&s->stage_frame);
+    free(s->crop_buf);
+    sws_freeContext(s->sws_crop);
+    pthread_mutex_destroy(&s->lock);
+    pthread_mutex_destroy(&s->stage_lock);
+    pthread_cond_destroy(&s->stage_cond);
+    free(s->url);
+    free(s);
+}
+
+/*
+ * file[,speed=S,jitter=ms,loss=pct,seed=N]: one stream per input captured
+ * with capture_filename, fed its packets at their arrival times divided by
+ * speed (0: as fast as the pipeline takes them), each delayed by up to
+ * jitter ms and loss percent of them dropped.
+ */
+int ffrknn_add_replay(ffrknn_t *eng, const char *spec, ffrknn_callback_t cb, void *opaque)
+{
+    pktcap_reader_t reader;
+    pktcap_record_t rec;
+    char *save = NULL;
+    int n = 0;
+
+    if (eng->replay_filename) {
+        fprintf(stderr, "replay: one capture per engine\n");
+        return -1;
+    }
+    eng->replay_filename = strdup(spec);
+    if (!eng->replay_filename)
+        return -1;
+    strtok_r(eng->replay_filename, ",", &save);
+    for (char *opt = strtok_r(NULL, ",", &save); opt; opt = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(opt, '=');
+
+        if (value)
+            *value++ = '\0';
+        if (value && !strcmp(opt, "speed")) {
+            eng->replay_speed = atof(value);
+        } else if (value && !strcmp(opt, "jitter")) {
+            eng->replay_jitter = atof(value);
+        } else if (value && !strcmp(opt, "loss")) {
+            eng->replay_loss = atof(value);
+        } else if (value && !strcmp(opt, "seed")) {
+            eng->replay_seed = strtoul(value, NULL, 0);
+        } else {
+            fprintf(stderr, "replay: unknown option %s\n", opt);
+            return -1;
+        }
+    }
+    if (pktcap_reader_open(&reader, eng->replay_filename) < 0) {
+        fprintf(stderr, "Cannot read packet capture %s\n", eng->replay_filename);
+        return -1;
+    }
+    /* the stream records come first, the packets after them */
+    while (pktcap_next(&reader, &rec) && rec.stream) {
+        char url[1024];
+        stream_t *s;
+
+        if (eng->nb_streams >= FFRKNN_MAX_STREAMS) {
+            fprintf(stderr, "Too many streams, max %d\n", FFRKNN_MAX_STREAMS);
+            break;
+        }
+        snprintf(url, sizeof(url), "replay:%s", rec.url);
+        s = stream_alloc(eng, eng->nb_streams, url);
+        if (s)
+            s->replay = (pktcap_reader_t *)calloc(1, sizeof(pktcap_reader_t));
+        /* without its reader the stream would open "replay:..." as a URL */
+        if (!s || !s->replay) {
+            if (s)
+                stream_free(s);
+            pktcap_reader_close(&reader);
+            return -1;
+        }
+        s->replay_stream = rec.stream->stream;
+        s->replay_seed = eng->replay_seed + rec.stream->stream;
+        s->ladder.slo_ms = eng->cfg.slo_ms;
+        s->cb = cb;
+        s->opaque = opaque;
+        eng->streams[eng->nb_streams++] = s;
+        n++;
+    }
+    pktcap_reader_close(&reader);
+    fprintf(stderr, "Replay %s: %d stream(s), speed %g, jitter %g ms, loss %g%%\n",
+            eng->replay_filename, n, eng->replay_speed, eng->replay_jitter, eng->replay_loss);
+    return n;
+}
+
+/* keyframe timestamps (microseconds) from the demuxer index of a seekable file */
+static int probe_keyframes(char *url, std::vector<int64_t> &keyframes)
+{
+    AVFormatContext *input_ctx = NULL;
+    AVStream *st;
+    int idx, count;
+
+    if (avformat_open_input(&input_ctx, url, NULL, NULL) != 0)
+        return -1;
+    if (avformat_find_stream_info(input_ctx, NULL) < 0 || !input_ctx->pb || !input_ctx->pb->seekable) {
+        avformat_close_input(&input_ctx);
+        return -1;
+    }
+    idx = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (idx < 0) {
+        avformat_close_input(&input_ctx);
+        return -1;
+    }
+    st = input_ctx->streams[idx];
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+    count = avformat_index_get_entries_count(st);
+    for (int i = 0; i < count; i++) {
+        const AVIndexEntry *e = avformat_index_get_entry(st, i);
+#else
+    count = st->nb_index_entries;
+    for (int i = 0; i < count; i++) {
+        const AVIndexEntry *e = &st->index_entries[i];
+#endif
+        if (e->flags & AVINDEX_KEYFRAME)
+            keyframes.push_back(av_rescale_q(e->timestamp, st->time_base, AV_TIME_BASE_Q));
+    }
+    avformat_close_input(&input_ctx);
+    return keyframes.size();
+}
+
+/*
+ * -j N: replace every seekable file input by up to N workers, each owning a
+ * run of whole GOPs of about the same duration. Workers keep the id of their
+ * input; their detections are buffered and merged in segment order.
+ */
+static void split_streams(ffrknn_t *eng, int workers)
+{
+    stream_t *inputs[FFRKNN_MAX_STREAMS];
+    int nb_inputs = eng->nb_streams;
+
+    memcpy(inputs, eng->streams, sizeof(inputs));
+    eng->nb_streams = 0;
+    for (int i = 0; i < nb_inputs; i++) {
+        stream_t *in = inputs[i];
+        std::vector<int64_t> kf;
+        std::vector<int64_t> bounds;
+        int room = FFRKNN_MAX_STREAMS - eng->nb_streams - (nb_inputs - i - 1);
+
+        if (room < 2 || probe_keyframes(in->url, kf) < 2) {
+            eng->streams[eng->nb_streams++] = in;
+            continue;
+        }
+        int n = workers < room ? workers : room;
+        int64_t first = kf.front(), span = kf.back() - kf.front();
+        size_t k = 0;
+
+        bounds.push_back(AV_NOPTS_VALUE);
+        for (int w = 1; w < n; w++) {
+            int64_t target = first + span * w / n;
+            while (k < kf.size() && kf[k] < target)
+                k++;
+            if (k >= kf.size())
+                break;
+            if (kf[k] > (bounds.size() > 1 ? bounds.back() : first))
+                bounds.push_back(kf[k]);
+        }
+        bounds.push_back(AV_NOPTS_VALUE);
+
+        fprintf(stderr, "Stream %d: %s split into %d segment(s) over %d keyframes\n",
+                in->id, in->url, (int)bounds.size() - 1, (int)kf.size());
+        for (size_t w = 0; w + 1 < bounds.size(); w++) {
+            stream_t *s = w ? stream_alloc(eng, in->id, in->url) : in;
+
+            /* out of memory: the last worker takes the rest of the file */
+            if (!s) {
+                eng->streams[eng->nb_streams - 1]->seg_end = AV_NOPTS_VALUE;
+                break;
+            }
+            s->segment = w;
+            s->frame_base = (int64_t)w * SEGMENT_FRAMES;
+            s->ladder.slo_ms = in->ladder.slo_ms;
+            s->seg_start = bounds[w];
+            s->seg_end = bounds[w + 1];
+            s->cb = in->cb;
+            s->opaque = in->opaque;
+            if (eng->cfg.det_filename)
+                s->seg_file = tmpfile();
+            eng->streams[eng->nb_streams++] = s;
+        }
+    }
+}
+
+/*
+ * virtual_streams N: open every file input N times, each copy paced at the frame rate
+ * of the file and looped like a camera. The starts are spread over a
+ * second (golden ratio sequence) so that neither the frames nor the
+ * keyframes of the copies arrive in lockstep.
+ */
+static void fan_streams(ffrknn_t *eng, int copies)
+{
+    stream_t *inputs[FFRKNN_MAX_STREAMS];
+    int nb_inputs = eng->nb_streams;
+
+    memcpy(inputs, eng->streams, sizeof(inputs));
+    eng->nb_streams = 0;
+    for (int i = 0; i < nb_inputs; i++) {
+        stream_t *in = inputs[i];
+
+        for (int c = 0; c < copies; c++) {
+            stream_t *s;
+
+            if (eng->nb_streams >= FFRKNN_MAX_STREAMS) {
+                fprintf(stderr, "Too many streams, max %d\n", FFRKNN_MAX_STREAMS);
+                if (!c)
+                    stream_free(in);
+                break;
+            }
+            s = c ? stream_alloc(eng, eng->nb_streams, in->url) : in;
+            if (!s)
+                break;
+            s->id = eng->nb_streams;
+            s->ladder.slo_ms = in->ladder.slo_ms;
+            s->cb = in->cb;
+            s->opaque = in->opaque;
+            s->paced = 1;
+            s->pace_delay = (int64_t)(fmod(eng->nb_streams * 0.618033988749895, 1.0) * 1e9);
+            eng->streams[eng->nb_streams++] = s;
+        }
+    }
+    fprintf(stderr, "%d virtual stream(s) from %d input(s)\n", eng->nb_streams, nb_inputs);
+}
+
+static double cpu_seconds(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec +
+           ru.ru_stime.tv_usec / 1e6;
+}
+
+static int64_t frames_inferred_total(ffrknn_t *eng)
+{
+    int64_t frames = 0;
+
+    for (int i = 0; i < eng->nb_streams; i++)
+        frames += eng->streams[i]->frames_inferred.load();
+    return frames;
+}
+
+/* virtual streams: start measuring after the warm-up, stop after the measured seconds */
+static void bench_tick(ffrknn_t *eng, int64_t now)
+{
+    if (!eng->bench.on.load() && now - eng->start_time >= eng->bench.warmup * 1000000000LL) {
+        eng->bench.start = now;
+        eng->bench.frames = frames_inferred_total(eng);
+        eng->bench.cpu = cpu_seconds();
+        eng->bench.on.store(1);
+    } else if (eng->bench.on.load() && eng->bench.seconds > 0 &&
+               now - eng->bench.start >= eng->bench.seconds * 1000000000LL) {
+        eng->quit.store(1);
+    }
+}
+
+/*
+ * One line for ff-rknn-capacity: inferred fps of all the streams against
+ * the frame rate of their files, latency from the due time of the packets,
+ * CPU (100 per core) and peak RSS.
+ */
+static void bench_report(ffrknn_t *eng)
+{
+    double elapsed = (stats_now() - eng->bench.start) / 1e9, target = 0;
+    struct rusage ru;
+
+    if (!eng->bench.on.load() || elapsed <= 0)
+        return;
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+
+        if (s->paced && s->thread_started)
+            target += av_q2d(s->input_ctx->streams[s->video_stream]->avg_frame_rate);
+    }
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(stderr,
+            "Bench: streams=%d seconds=%.1f fps=%.1f target=%.1f p50=%.1f p99=%.1f max=%.1f "
+            "cpu=%.0f rss=%.1f\n",
+            eng->nb_streams, elapsed, (frames_inferred_total(eng) - eng->bench.frames) / elapsed,
+            target,
+            stats_hist_percentile(&eng->bench.latency, 0.5) / 1e6,
+            stats_hist_percentile(&eng->bench.latency, 0.99) / 1e6,
+            stats_hist_percentile(&eng->bench.latency, 1.0) / 1e6,
+            (cpu_seconds() - eng->bench.cpu) / elapsed * 100, ru.ru_maxrss / 1024.0);
+}
+
+/* concatenate the workers' detections: segments are disjoint and in pts order */
+static void merge_segments(ffrknn_t *eng)
+{
+    char buf[65536];
+    size_t n;
+
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+
+        if (!s->seg_file || !eng->det_file)
+            continue;
+        fflush(s->seg_file);
+        rewind(s->seg_file);
+        while ((n = fread(buf, 1, sizeof(buf), s->seg_file)) > 0)
+            fwrite(buf, 1, n, eng->det_file);
+    }
+}
+
+static unsigned char *load_data(FILE *fp, size_t ofst, size_t sz)
+{
+    unsigned char *data;
+    int ret;
+
+    data = NULL;
+
+    if (NULL == fp) {
+        return NULL;
+    }
+
+    ret = fseek(fp, ofst, SEEK_SET);
+    if (ret != 0) {
+        fprintf(stderr, "blob seek failure.\n");
+        return NULL;
+    }
+
+    data = (unsigned char *)malloc(sz);
+    if (data == NULL) {
+        fprintf(stderr, "buffer malloc failure.\n");
+        return NULL;
+    }
+    ret = fread(data, 1, sz, fp);
+    return data;
+}
+
+static unsigned char *load_model(const char *filename, int *model_size)
+{
+
+    FILE *fp;
+    unsigned char *data;
+
+    if (!filename)
+        return NULL;
+
+    fp = fopen(filename, "rb");
+    if (NULL == fp) {
+        fprintf(stderr, "Open file %s failed.\n", filename);
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    int size = ftell(fp);
+
+    data = load_data(fp, 0, size);
+
+    fclose(fp);
+
+    *model_size = size;
+    return data;
+}
+
+static void metrics_labels(char *buf, int size, stream_t *s)
+{
+    if (s->seg_start != AV_NOPTS_VALUE || s->seg_end != AV_NOPTS_VALUE)
+        snprintf(buf, size, "stream=\"%d\",segment=\"%d\"", s->id, s->segment);
+    else
+        snprintf(buf, size, "stream=\"%d\"", s->id);
+}
+
+/* -metrics: one scrape, on the metrics thread */
+static void write_metrics(FILE *fp, void *opaque)
+{
+    ffrknn_t *eng = (ffrknn_t *)opaque;
+    int64_t now = stats_now();
+    double window = eng->scrape_time ? (now - eng->scrape_time) / 1e9 : 0;
+    char labels[64];
+
+    eng->scrape_time = now;
+    fprintf(fp, "# HELP ff_rknn_frames_total Frames per stream and step.\n"
+                "# TYPE ff_rknn_frames_total counter\n");
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+
+        metrics_labels(labels, sizeof(labels), s);
+        fprintf(fp, "ff_rknn_frames_total{%s,step=\"decoded\"} %llu\n", labels,
+                (unsigned long long)s->m.decoded.load());
+        fprintf(fp, "ff_rknn_frames_total{%s,step=\"inferred\"} %lld\n", labels,
+                (long long)s->frames_inferred.load());
+        if (!eng->cfg.headless)
+            fprintf(fp, "ff_rknn_frames_total{%s,step=\"presented\"} %llu\n", labels,
+                    (unsigned long long)s->presented.load());
+    }
+    fprintf(fp, "# HELP ff_rknn_fps Frame rate since the previous scrape.\n"
+                "# TYPE ff_rknn_fps gauge\n");
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+        uint64_t decoded = s->m.decoded.load(), inferred = s->frames_inferred.load();
+
+        metrics_labels(labels, sizeof(labels), s);
+        if (window > 0) {
+            fprintf(fp, "ff_rknn_fps{%s,step=\"decoded\"} %.2f\n", labels,
+                    (decoded - s->scrape_decoded) / window);
+            fprintf(fp, "ff_rknn_fps{%s,step=\"inferred\"} %.2f\n", labels,
+                    (inferred - s->scrape_inferred) / window);
+        }
+        s->scrape_decoded = decoded;
+        s->scrape_inferred = inferred;
+    }
+    fprintf(fp, "# HELP ff_rknn_dropped_frames_total Frames dropped per stream and place.\n"
+                "# TYPE ff_rknn_dropped_frames_total counter\n");
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+
+        metrics_labels(labels, sizeof(labels), s);
+        if (!eng->cfg.headless)
+            fprintf(fp, "ff_rknn_dropped_frames_total{%s,where=\"display\"} %llu\n", labels,
+                    (unsigned long long)s->mbox.dropped.load());
+        if (eng->cascade_on)
+            fprintf(fp, "ff_rknn_dropped_frames_total{%s,where=\"second_stage\"} %llu\n", labels,
+                    (unsigned long long)s->stage_dropped.load());
+        if (s->rec)
+            fprintf(fp, "ff_rknn_dropped_frames_total{%s,where=\"recorder\"} %llu\n", labels,
+                    (unsigned long long)s->rec->dropped.load());
+    }
+    fprintf(fp, "# HELP ff_rknn_queue_depth Frames waiting per stream and queue.\n"
+                "# TYPE ff_rknn_queue_depth gauge\n");
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+        int depth;
+
+        metrics_labels(labels, sizeof(labels), s);
+        if (eng->cascade_on) {
+            pthread_mutex_lock(&s->stage_lock);
+            depth = s->job_count;
+            pthread_mutex_unlock(&s->stage_lock);
+            fprintf(fp, "ff_rknn_queue_depth{%s,queue=\"second_stage\"} %d\n", labels, depth);
+        }
+        if (s->rec && s->rec->thread_started) {
+            pthread_mutex_lock(&s->rec->lock);
+            depth = s->rec->count;
+            pthread_mutex_unlock(&s->rec->lock);
+            fprintf(fp, "ff_rknn_queue_depth{%s,queue=\"recorder\"} %d\n", labels, depth);
+        }
+    }
+    fprintf(fp, "# HELP ff_rknn_detections_total Detections of the inferred frames.\n"
+                "# TYPE ff_rknn_detections_total counter\n");
+    for (int i = 0; i < eng->nb_streams; i++) {
+        metrics_labels(labels, sizeof(labels), eng->streams[i]);
+        fprintf(fp, "ff_rknn_detections_total{%s} %llu\n", labels,
+                (unsigned long long)eng->streams[i]->m.detections.load());
+    }
+    fprintf(fp, "# HELP ff_rknn_npu_busy_seconds_total NPU time (inputs_set, run, outputs_get).\n"
+                "# TYPE ff_rknn_npu_busy_seconds_total counter\n");
+    for (int i = 0; i < eng->nb_streams; i++) {
+        metrics_labels(labels, sizeof(labels), eng->streams[i]);
+        fprintf(fp, "ff_rknn_npu_busy_seconds_total{%s} %.6f\n", labels,
+                eng->streams[i]->m.npu_ns.load() / 1e9);
+    }
+    fprintf(fp, "# HELP ff_rknn_rga_seconds_total Time in RGA (or swscale) blits.\n"
+                "# TYPE ff_rknn_rga_seconds_total counter\n");
+    for (int i = 0; i < eng->nb_streams; i++) {
+        metrics_labels(labels, sizeof(labels), eng->streams[i]);
+        fprintf(fp, "ff_rknn_rga_seconds_total{%s} %.6f\n", labels,
+                eng->streams[i]->m.rga_ns.load() / 1e9);
+    }
+    if (eng->nb_models > 1) {
+        fprintf(fp, "# HELP ff_rknn_model Ladder rung of the stream, 0 is the largest model.\n"
+                    "# TYPE ff_rknn_model gauge\n");
+        for (int i = 0; i < eng->nb_streams; i++) {
+            metrics_labels(labels, sizeof(labels), eng->streams[i]);
+            fprintf(fp, "ff_rknn_model{%s} %d\n", labels, eng->streams[i]->ladder.rung);
+        }
+    }
+    fprintf(fp, "# HELP ff_rknn_npu_contexts_busy NPU contexts in use per model.\n"
+                "# TYPE ff_rknn_npu_contexts_busy gauge\n");
+    for (int i = 0; i < eng->nb_models; i++) {
+        int busy = 0;
+
+        pthread_mutex_lock(&eng->npu[i].lock);
+        for (int j = 0; j < eng->npu[i].count; j++)
+            busy += eng->npu[i].ctxs[j].busy;
+        pthread_mutex_unlock(&eng->npu[i].lock);
+        fprintf(fp, "ff_rknn_npu_contexts_busy{model=\"%d\"} %d\n", i, busy);
+    }
+    fprintf(fp, "# HELP ff_rknn_latency_seconds Frame latency from packet arrival, or from the "
+                "sender clock (RTCP), to present.\n"
+                "# TYPE ff_rknn_latency_seconds summary\n");
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+        static const double quantiles[] = { 0.5, 0.9, 0.99 };
+
+        metrics_labels(labels, sizeof(labels), s);
+        for (int j = 0; j < 2; j++) {
+            stats_hist_t *h = j ? &s->lat_capture : &s->lat_arrival;
+            const char *from = j ? "capture" : "arrival";
+            uint64_t count = stats_hist_count(h);
+
+            if (!count)
+                continue;
+            for (int q = 0; q < 3; q++)
+                fprintf(fp, "ff_rknn_latency_seconds{%s,from=\"%s\",quantile=\"%g\"} %.6f\n",
+                        labels, from, quantiles[q], stats_hist_percentile(h, quantiles[q]) / 1e9);
+            fprintf(fp, "ff_rknn_latency_seconds_sum{%s,from=\"%s\"} %.6f\n", labels, from,
+                    h->sum.load() / 1e9);
+            fprintf(fp, "ff_rknn_latency_seconds_count{%s,from=\"%s\"} %llu\n", labels, from,
+                    (unsigned long long)count);
+        }
+    }
+}
+
+static void models_deinit(ffrknn_t *eng)
+{
+    for (int i = 0; i < eng->nb_models; i++) {
+        npu_pool_deinit(&eng->npu[i]);
+        free(eng->model_data[i]);
+        eng->model_data[i] = NULL;
+    }
+    eng->nb_models = 0;
+}
+
+static int postprocess_get(void)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&postprocess_lock);
+    if (!postprocess_users && initPostProcess() < 0)
+        ret = -1;
+    else if (postprocess_users++ == 0)
+        annotate_colors_init();
+    pthread_mutex_unlock(&postprocess_lock);
+    return ret;
+}
+
+static void postprocess_put(void)
+{
+    pthread_mutex_lock(&postprocess_lock);
+    if (--postprocess_users == 0)
+        deinitPostProcess();
+    pthread_mutex_unlock(&postprocess_lock);
+}
+
+/* the detector(s): "a.rknn,b.rknn" is a ladder, largest first; the second stage */
+static int models_init(ffrknn_t *eng)
+{
+    char *save = NULL;
+    int model_data_size;
+    int ret;
+
+    for (char *name = strtok_r(eng->model_names, ",", &save); name;
+         name = strtok_r(NULL, ",", &save)) {
+        if (eng->nb_models == LADDER_MAX) {
+            fprintf(stderr, "Too many models, max %d\n", LADDER_MAX);
+            break;
+        }
+        model_data_size = 0;
+        eng->model_data[eng->nb_models] = load_model(name, &model_data_size);
+        if (!eng->model_data[eng->nb_models]) {
+            fprintf(stderr, "Error locading model: `%s`\n", name);
+            return -1;
+        }
+        fprintf(stderr, "Model: %s - size: %d.\n", name, model_data_size);
+        ret = npu_pool_init(&eng->npu[eng->nb_models], eng->model_data[eng->nb_models],
+                            model_data_size, eng->cfg.npu_contexts);
+        eng->nb_models++;
+        if (ret < 0)
+            return -1;
+        /* post_process() reads the three YOLOv5 heads */
+        if (eng->npu[eng->nb_models - 1].io_num.n_output < 3) {
+            fprintf(stderr, "Model %s: %d output(s), the detector needs 3\n", name,
+                    eng->npu[eng->nb_models - 1].io_num.n_output);
+            return -1;
+        }
+    }
+    if (!eng->nb_models || postprocess_get() < 0)
+        return -1;
+    eng->postprocess = 1;
+    ladder_init(&eng->ladder, eng->nb_models);
+    for (int i = 0; i < eng->nb_streams; i++) {
+        if (eng->streams[i]->ladder.slo_ms <= 0)
+            eng->streams[i]->ladder.slo_ms = eng->cfg.slo_ms;
+    }
+
+    if (eng->cfg.model2) {
+        int model2_data_size = 0;
+
+        eng->model2_data = load_model(eng->cfg.model2, &model2_data_size);
+        if (!eng->model2_data) {
+            fprintf(stderr, "Error locading model: `%s`\n", eng->cfg.model2);
+            return -1;
+        }
+        fprintf(stderr, "Model: %s - size: %d.\n", eng->cfg.model2, model2_data_size);
+        if (cascade_init(&eng->cascade, eng->model2_data, model2_data_size,
+                         eng->cfg.npu_contexts) < 0)
+            return -1;
+        if (eng->cfg.max_crops < 1)
+            eng->cfg.max_crops = 1;
+        if (eng->cfg.max_crops > CASCADE_MAX_CROPS)
+            eng->cfg.max_crops = CASCADE_MAX_CROPS;
+        eng->cascade_on = 1;
+    }
+
+    for (int i = 0; i < eng->nb_models; i++) {
+        npu_pool_t *pool = &eng->npu[i];
+
+        if (pool->width * pool->height * pool->channel > eng->input_size)
+            eng->input_size = pool->width * pool->height * pool->channel;
+    }
+    return 0;
+}
+
+/* the per stream sinks: recorder and second stage, once the stream is open */
+static int stream_sinks(stream_t *s)
+{
+    ffrknn_t *eng = s->eng;
+
+    if (eng->cfg.record_filename) {
+        AVRational rate = s->input_ctx->streams[s->video_stream]->avg_frame_rate;
+
+        if (eng->cfg.analysis_fps > 0)
+            rate = av_d2q(eng->cfg.analysis_fps, 1001000);
+        s->rec = (recorder_t *)calloc(1, sizeof(recorder_t));
+        if (s->rec && recorder_open(s->rec, eng->cfg.record_filename,
+                                    eng->nb_streams > 1 ? s->id : -1, eng->image_width,
+                                    eng->image_height, eng->cfg.image_format, rate,
+                                    eng->cfg.record_segment_us) < 0) {
+            fprintf(stderr, "Stream %d: recording disabled\n", s->id);
+            recorder_close(s->rec);
+            free(s->rec);
+            s->rec = NULL;
+        }
+    }
+    if (eng->cascade_on && stage_start(s) < 0) {
+        fprintf(stderr, "Stream %d: cannot start the second stage\n", s->id);
+        return -1;
+    }
+    return 0;
+}
+
+/* shared memory rings of the open streams, one server for all of them */
+static void shm_open_rings(ffrknn_t *eng)
+{
+    shm_ring_t *rings[FFRKNN_MAX_STREAMS];
+    int nb_rings = 0;
+
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+
+        if (!s->frame)
+            continue;
+        s->shm = (shm_ring_t *)calloc(1, sizeof(shm_ring_t));
+        if (s->shm && shm_ring_create(s->shm, s->id,
+                                      eng->cfg.image_format == AV_PIX_FMT_NV12 ? SHM_FMT_NV12 :
+                                                                                 SHM_FMT_RGB24,
+                                      eng->image_width, eng->image_height, eng->image_size) < 0) {
+            shm_ring_destroy(s->shm);
+            free(s->shm);
+            s->shm = NULL;
+        }
+        if (s->shm)
+            rings[nb_rings++] = s->shm;
+    }
+    if (!nb_rings || shm_server_start(eng->cfg.shm_socket, rings, nb_rings) < 0)
+        fprintf(stderr, "Shared memory output disabled\n");
+    else
+        eng->shm_started = 1;
+}
+
+/* the sinks shared by the streams */
+static int sinks_open(ffrknn_t *eng)
+{
+    if (eng->cfg.det_filename) {
+        eng->det_file = strcmp(eng->cfg.det_filename, "-") ? fopen(eng->cfg.det_filename, "w") :
+                                                             stdout;
+        if (!eng->det_file) {
+            fprintf(stderr, "Open detections file %s failed.\n", eng->cfg.det_filename);
+            return -1;
+        }
+        setvbuf(eng->det_file, NULL, _IOFBF, 1 << 20);
+    }
+    if (eng->cfg.detlog_filename) {
+        eng->det_log = detlog_open(eng->cfg.detlog_filename);
+        if (!eng->det_log)
+            return -1;
+    }
+    if (eng->cfg.dump_filename) {
+        char *path = strdup(eng->cfg.dump_filename);
+        char *every = path ? strchr(path, ',') : NULL;
+
+        if (every)
+            *every++ = '\0';
+        if (path)
+            eng->tensor_dump = tensordump_open(path, every ? atoi(every) : 1);
+        free(path);
+        if (!eng->tensor_dump)
+            return -1;
+    }
+    return 0;
+}
+
+void ffrknn_config_default(ffrknn_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->max_crops = 8;
+    cfg->skip_frame = AVDISCARD_DEFAULT;
+    cfg->bench_warmup = 5;
+    cfg->width = 960;
+    cfg->height = 540;
+    cfg->image_format = AV_PIX_FMT_RGB24; // NV12: the GPU does the colour conversion
+    cfg->label_scale = 1;
+}
+
+ffrknn_t *ffrknn_new(const ffrknn_config_t *cfg)
+{
+    const char *protocol = cfg->protocol ? cfg->protocol : "";
+    ffrknn_t *eng;
+
+    if (!cfg->model) {
+        fprintf(stderr, "No model to load! Please pass a model.\n");
+        return NULL;
+    }
+    if (cfg->backend && backend_select(cfg->backend) < 0)
+        return NULL;
+    eng = (ffrknn_t *)calloc(1, sizeof(ffrknn_t));
+    if (!eng)
+        return NULL;
+    eng->cfg = *cfg;
+    eng->model_names = strdup(cfg->model);
+    if (!eng->model_names) {
+        free(eng);
+        return NULL;
+    }
+    eng->v4l2 = !strncasecmp(protocol, "v4l2", 4);
+    eng->rtsp = !strncasecmp(protocol, "rtsp", 4);
+    eng->rtmp = !strncasecmp(protocol, "rtmp", 4);
+    eng->http = !strncasecmp(protocol, "http", 4);
+    eng->live = eng->v4l2 || eng->rtsp || eng->rtmp || eng->http;
+    if (eng->cfg.width <= 0)
+        eng->cfg.width = 960;
+    if (eng->cfg.height <= 0)
+        eng->cfg.height = 540;
+    if (eng->cfg.record_filename)
+        eng->cfg.burn_in = 1;
+    eng->frame_images = !eng->cfg.headless || eng->cfg.burn_in || eng->cfg.shm_socket;
+    eng->replay_speed = 1;
+    eng->replay_seed = 1;
+    eng->bench.seconds = cfg->bench_seconds;
+    eng->bench.warmup = cfg->bench_warmup;
+    pthread_mutex_init(&eng->det_lock, NULL);
+    return eng;
+}
+
+const ffrknn_config_t *ffrknn_config(ffrknn_t *eng)
+{
+    return &eng->cfg;
+}
+
+int ffrknn_add_stream(ffrknn_t *eng, const char *url, float slo_ms, ffrknn_callback_t cb,
+                      void *opaque)
+{
+    stream_t *s;
+
+    if (eng->cols)
+        return -1;
+    if (eng->nb_streams >= FFRKNN_MAX_STREAMS) {
+        fprintf(stderr, "Too many streams, max %d\n", FFRKNN_MAX_STREAMS);
+        return -1;
+    }
+    s = stream_alloc(eng, eng->nb_streams, url);
+    if (!s)
+        return -1;
+    s->ladder.slo_ms = slo_ms;
+    s->cb = cb;
+    s->opaque = opaque;
+    eng->streams[eng->nb_streams++] = s;
+    return s->id;
+}
+
+int ffrknn_open(ffrknn_t *eng)
+{
+    int rows;
+
+    if (!eng->nb_streams) {
+        fprintf(stderr, "No stream to play! Please pass an input.\n");
+        return -1;
+    }
+    if (eng->cfg.virtual_streams > 0 && (eng->live || eng->replay_filename)) {
+        fprintf(stderr, "Virtual streams: only file inputs can be paced, ignored\n");
+        eng->cfg.virtual_streams = 0;
+    }
+    if (eng->cfg.virtual_streams > 0)
+        fan_streams(eng, eng->cfg.virtual_streams);
+    else if (eng->cfg.headless && eng->cfg.gop_workers > 1 && !eng->live)
+        split_streams(eng, eng->cfg.gop_workers);
+    if (eng->cfg.npu_contexts <= 0)
+        eng->cfg.npu_contexts = eng->nb_streams < 3 ? eng->nb_streams : 3;
+
+    /* all streams share the area: one tile per stream */
+    eng->cols = (int)ceil(sqrt((double)eng->nb_streams));
+    rows = (eng->nb_streams + eng->cols - 1) / eng->cols;
+    eng->image_width = (eng->cfg.width / eng->cols) &
+                       (eng->cfg.image_format == AV_PIX_FMT_NV12 ? ~15 : ~1);
+    eng->image_height = (eng->cfg.height / rows) & ~1;
+    if (eng->cfg.image_format == AV_PIX_FMT_NV12)
+        eng->image_size = eng->image_width * eng->image_height * 3 / 2;
+    else
+        eng->image_size = eng->image_width * eng->image_height * 3;
+
+    if (models_init(eng) < 0)
+        return -1;
+
+    if (eng->cfg.capture_filename) {
+        eng->packet_capture = pktcap_open(eng->cfg.capture_filename);
+        if (!eng->packet_capture)
+            return -1;
+    }
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+
+        if (stream_open(s) < 0) {
+            fprintf(stderr, "Stream %d: '%s' skipped\n", s->id, s->url);
+            continue;
+        }
+        if (eng->packet_capture)
+            pktcap_add_stream(eng->packet_capture, s->id,
+                              s->input_ctx->streams[s->video_stream], s->url);
+        eng->opened++;
+        if (stream_sinks(s) < 0)
+            return -1;
+    }
+    if (!eng->opened) {
+        fprintf(stderr, "No stream could be opened!\n");
+        return -1;
+    }
+
+    if (eng->cfg.shm_socket)
+        shm_open_rings(eng);
+    if (sinks_open(eng) < 0)
+        return -1;
+    return eng->opened;
+}
+
+int ffrknn_start(ffrknn_t *eng)
+{
+    struct timespec ts;
+
+    if (!eng->opened || eng->started)
+        return -1;
+    if (eng->cfg.trace_filename) {
+        if (trace_start(eng->cfg.trace_filename) < 0)
+            fprintf(stderr, "Tracing disabled\n");
+        else
+            eng->trace_started = 1;
+    }
+    eng->start_time = stats_now();
+    eng->replay_start = eng->start_time;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    eng->replay_wall = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+
+        if (!s->frame)
+            continue;
+        if (pthread_create(&s->thread, NULL, stream_thread, s) != 0) {
+            fprintf(stderr, "Stream %d: cannot create thread\n", s->id);
+            continue;
+        }
+        s->thread_started = 1;
+    }
+    eng->started = 1;
+    if (eng->cfg.stats_interval > 0 && stats_start(eng->cfg.stats_interval) == 0)
+        eng->stats_started = 1;
+    if (eng->cfg.metrics_address) {
+        if (metrics_start(eng->cfg.metrics_address, write_metrics, eng) < 0)
+            fprintf(stderr, "Metrics endpoint disabled\n");
+        else
+            eng->metrics_started = 1;
+    }
+    return 0;
+}
+
+int ffrknn_wait(ffrknn_t *eng, int timeout_ms)
+{
+    int running = 0;
+
+    if (timeout_ms > 0)
+        usleep(timeout_ms * 1000);
+    if (eng->cfg.virtual_streams && eng->started)
+        bench_tick(eng, stats_now());
+    if (eng->quit.load())
+        return 0;
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+
+        if (!s->thread_started)
+            continue;
+        pthread_mutex_lock(&s->lock);
+        if (!s->finished)
+            running++;
+        pthread_mutex_unlock(&s->lock);
+    }
+    return running;
+}
+
+void ffrknn_stop(ffrknn_t *eng)
+{
+    if (eng->stopped)
+        return;
+    eng->stopped = 1;
+    eng->quit.store(1);
+    for (int i = 0; i < eng->nb_streams; i++) {
+        if (eng->streams[i]->thread_started)
+            pthread_join(eng->streams[i]->thread, NULL);
+    }
+    eng->end_time = stats_now();
+    if (eng->shm_started)
+        shm_server_stop();
+    if (eng->metrics_started)
+        metrics_stop();
+    if (eng->stats_started)
+        stats_stop();
+    if (eng->trace_started)
+        trace_stop();
+    merge_segments(eng);
+    for (int i = 0; i < eng->nb_streams; i++) {
+        if (eng->streams[i]->rec)
+            recorder_close(eng->streams[i]->rec);
+    }
+}
+
+void ffrknn_report(ffrknn_t *eng)
+{
+    double elapsed = eng->started && eng->stopped ? (eng->end_time - eng->start_time) / 1e9 : 0;
+    int headless = eng->cfg.headless;
+    npu_pool_t *npu = eng->npu;
+
+    bench_report(eng);
+    for (int i = 0; i < eng->nb_streams; i++) {
+        stream_t *s = eng->streams[i];
+
+        if (s->thread_started && headless)
+            fprintf(stderr, "Stream %d: %s %lld frames, %.1f fps\n", s->id, s->url,
+                    (long long)s->frames_inferred, elapsed > 0 ? s->frames_inferred / elapsed : 0.0);
+        else if (s->thread_started)
+            fprintf(stderr, "Stream %d: %s %.1f fps, presented %llu, dropped %llu\n",
+                    s->id, s->url, elapsed > 0 ? s->presented / elapsed : 0.0,
+                    (unsigned long long)s->presented, (unsigned long long)s->mbox.dropped.load());
+        if (s->rec)
+            fprintf(stderr, "Stream %d: recorded %llu frames, dropped %llu, %.1f MB\n", s->id,
+                    (unsigned long long)s->rec->frames, (unsigned long long)s->rec->dropped,
+                    s->rec->bytes / 1e6);
+        if (s->thread_started && eng->nb_models == 1 && npu[0].nb_shapes) {
+            fprintf(stderr, "Stream %d: input shapes", s->id);
+            for (int j = 0; j < npu[0].nb_shapes; j++)
+                fprintf(stderr, " %dx%d: %llu", npu[0].shapes[j].width, npu[0].shapes[j].height,
+                        (unsigned long long)s->shape_count[j]);
+            fprintf(stderr, "\n");
+        }
+        if (s->thread_started && eng->nb_models > 1) {
+            fprintf(stderr, "Stream %d: frames per model", s->id);
+            for (int j = 0; j < eng->nb_models; j++)
+                fprintf(stderr, " %dx%d: %llu", npu[j].width, npu[j].height,
+                        (unsigned long long)s->ladder.frames[j]);
+            fprintf(stderr, ", %llu move(s), npu %.1f ms (wait %.1f), slo %.1f ms\n",
+                    (unsigned long long)s->ladder.moves, s->ladder.npu_ms, s->ladder.wait_ms,
+                    s->ladder.slo_ms);
+        }
+        if (stats_hist_count(&s->lat_arrival)) {
+            fprintf(stderr, "Stream %d: latency to %s\n%-12s %9s %9s %9s %9s %9s %9s  (ms)\n",
+                    s->id, headless ? "output" : "present", "from", "count", "mean", "p50", "p90",
+                    "p99", "max");
+            stats_hist_print(stderr, "arrival", &s->lat_arrival);
+            stats_hist_print(stderr, "capture", &s->lat_capture);
+        }
+        if (s->stage_dropped)
+            fprintf(stderr, "Stream %d: second stage dropped %llu frames\n", s->id,
+                    (unsigned long long)s->stage_dropped);
+        if (s->replay_lost)
+            fprintf(stderr, "Stream %d: replay dropped %llu packets\n", s->id,
+                    (unsigned long long)s->replay_lost);
+    }
+    if (eng->cascade_on)
+        fprintf(stderr, "Second stage: %llu crops in %llu runs\n",
+                (unsigned long long)eng->cascade.crops.load(),
+                (unsigned long long)eng->cascade.runs.load());
+    if (eng->started)
+        stats_dump(stderr, 0);
+    if (eng->tensor_dump)
+        fprintf(stderr, "Tensor dump: %llu frames, %.1f MB\n",
+                (unsigned long long)eng->tensor_dump->frames, eng->tensor_dump->bytes / 1e6);
+    if (eng->packet_capture)
+        fprintf(stderr, "Packet capture: %llu packets, %.1f MB\n",
+                (unsigned long long)eng->packet_capture->packets, eng->packet_capture->bytes / 1e6);
+}
+
+void ffrknn_free(ffrknn_t *eng)
+{
+    if (!eng)
+        return;
+    ffrknn_stop(eng);
+    for (int i = 0; i < eng->nb_streams; i++)
+        stream_free(eng->streams[i]);
+    if (eng->det_file && eng->det_file != stdout)
+        fclose(eng->det_file);
+    else if (eng->det_file)
+        fflush(eng->det_file);
+    detlog_close(eng->det_log);
+    tensordump_close(eng->tensor_dump);
+    pktcap_close(eng->packet_capture);
+    models_deinit(eng);
+    if (eng->cascade_on || eng->model2_data)
+        cascade_deinit(&eng->cascade);
+    free(eng->model2_data);
+    if (eng->postprocess)
+        postprocess_put();
+    free(eng->model_names);
+    free(eng->replay_filename);
+    pthread_mutex_destroy(&eng->det_lock);
+    free(eng);
+}
+
+int ffrknn_stream_count(ffrknn_t *eng)
+{
+    return eng->nb_streams;
+}
+
+int ffrknn_stream_info(ffrknn_t *eng, int index, ffrknn_stream_info_t *info)
+{
+    stream_t *s;
+
+    if (!eng->cols || index < 0 || index >= eng->nb_streams)
+        return -1;
+    s = eng->streams[index];
+    info->id = s->id;
+    info->url = s->url;
+    info->opened = s->frame && (s->thread_started || !eng->started);
+    info->x = (index % eng->cols) * eng->image_width;
+    info->y = (index / eng->cols) * eng->image_height;
+    info->width = eng->image_width;
+    info->height = eng->image_height;
+    return 0;
+}
+
+const uint8_t *ffrknn_image_read(ffrknn_t *eng, int index, detect_result_group_t *group)
+{
+    mailbox_slot_t *slot;
+
+    if (index < 0 || index >= eng->nb_streams || !eng->streams[index]->texture_dst_buf)
+        return NULL;
+    /* the slot stays ours until the next mailbox_read() */
+    slot = mailbox_read(&eng->streams[index]->mbox);
+    if (!slot)
+        return NULL;
+    if (group)
+        *group = slot->group;
+    return (const uint8_t *)slot->buf;
+}
+
+void ffrknn_presented(ffrknn_t *eng, int index, const detect_result_group_t *group, int64_t now)
+{
+    stream_t *s = eng->streams[index];
+
+    s->presented++;
+    latency_record(s, group, now);
+}
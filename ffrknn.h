@@ -0,0 +1,171 @@
+#ifndef _FF_RKNN_FFRKNN_H_
+#define _FF_RKNN_FFRKNN_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixfmt.h>
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#include "postprocess.h"
+
+/*
+ * libffrknn: the ff-rknn pipeline (demux, decode, RGA, NPU, post-process
+ * and the sinks) behind an engine, for services that analyse streams in
+ * process. An engine loads its model(s) once and shares the NPU contexts
+ * between all of its streams; every stream runs on its own thread and
+ * hands each inferred frame to the callback it was added with.
+ *
+ *     ffrknn_config_t cfg;
+ *
+ *     ffrknn_config_default(&cfg);
+ *     cfg.model = "yolov5s-640-640.rknn";
+ *     cfg.headless = 1;
+ *     ffrknn_t *eng = ffrknn_new(&cfg);
+ *     ffrknn_add_stream(eng, "rtsp://cam1/stream", 0, on_frame, ctx);
+ *     if (ffrknn_open(eng) > 0 && ffrknn_start(eng) == 0)
+ *         while (ffrknn_wait(eng, 100) > 0)
+ *             ;
+ *     ffrknn_stop(eng);
+ *     ffrknn_free(eng);
+ *
+ * Latency stats (stats_interval), the trace, the metrics endpoint and the
+ * shared memory server are per process: give them to one engine only.
+ */
+
+#define FFRKNN_MAX_STREAMS 32
+
+typedef struct _ffrknn_config_t
+{
+    /* inference */
+    const char *model;    // rknn model, or a ladder: big.rknn,small.rknn (largest first)
+    const char *backend;  // rknn (NULL), mock[:ms=25,...], see backend.h
+    int npu_contexts;     // shared by the streams, 0: one per stream, up to 3
+    float slo_ms;         // ladder: default NPU wait + inference budget per frame
+    int shape_interval;   // dynamic shape models: choose the shape every N frames, 0: largest
+    const char *model2;   // second stage classifier on crops of the detections, NULL: none
+    int max_crops;        // second stage: crops per frame
+    const char *object2;  // second stage: only crops of this object, NULL: all
+    const char *object;   // only this object is drawn, classified and sized for, NULL: all
+    int accuracy;         // the same for scores from this percent up, 0: all
+
+    /* input */
+    const char *protocol;     // v4l2, rtsp, rtmp, http, NULL: files
+    const char *pixel_format; // camera
+    const char *video_size;   // camera, WxH
+    const char *frame_rate;   // camera
+    int sw_decode;            // software decoding only
+    int decoder_threads;      // software decoding, 0: auto
+    enum AVDiscard skip_frame;
+    float analysis_fps; // infer only frames on this rate, 0: every decoded frame
+    int delay;          // ms after every packet, not headless
+    int gop_workers;    // headless: split seekable files at keyframes over N workers
+    int virtual_streams; // N paced and looped copies of every file, then a Bench: line
+    int bench_seconds;   // virtual streams: measured seconds, 0: until stopped
+    int bench_warmup;    // virtual streams: seconds before measuring
+
+    /* frame images: the decoded frames scaled into the tiles of width x height */
+    int headless; // no display: boxes in source pixels, latency up to the sinks
+    int width;
+    int height;
+    enum AVPixelFormat image_format; // AV_PIX_FMT_RGB24 or AV_PIX_FMT_NV12
+    int burn_in;     // boxes and labels drawn into the images
+    int alphablend;  // burn-in: box fill alpha, 0: outline only
+    int label_scale; // 0: no labels
+
+    /* sinks */
+    const char *det_filename;    // JSON lines, "-": stdout
+    const char *detlog_filename; // binary detection log (+ .idx)
+    const char *dump_filename;   // raw NPU outputs, file[,N]: every Nth frame
+    const char *record_filename; // annotated video (.mp4, .mkv), -s<id> added per stream
+    int64_t record_segment_us;   // new file every N us, 0: one per stream
+    const char *shm_socket;      // frames and detections in shared memory
+    const char *capture_filename; // demuxed packets and their arrival, for replay
+
+    /* observability */
+    int stats_interval; // seconds between stage latency dumps, 0: at exit only
+    const char *trace_filename;
+    const char *metrics_address; // Prometheus, unix socket path or [host:]port
+} ffrknn_config_t;
+
+/* one inferred frame, valid for the duration of the callback */
+typedef struct _ffrknn_result_t
+{
+    int stream;    // stream id
+    int64_t frame; // frames inferred by the stream so far, this one included
+    int width;     // of the decoded frame
+    int height;
+    const detect_result_group_t *group; // pts, arrival and the detections
+    const uint8_t *image; // frame image, NULL: none
+    int image_width;
+    int image_height;
+    enum AVPixelFormat image_format;
+} ffrknn_result_t;
+
+/*
+ * Called on the stream thread, or the second stage thread with model2.
+ * Boxes are in source frame pixels when headless, in image pixels
+ * otherwise. The workers of a split file share its id and callback.
+ */
+typedef void (*ffrknn_callback_t)(void *opaque, const ffrknn_result_t *result);
+
+/* where the image of a stream goes in the width x height area */
+typedef struct _ffrknn_stream_info_t
+{
+    int id;
+    const char *url;
+    int opened; // decoding, else skipped
+    int x;
+    int y;
+    int width;
+    int height;
+} ffrknn_stream_info_t;
+
+typedef struct _ffrknn_t ffrknn_t;
+
+void ffrknn_config_default(ffrknn_config_t *cfg);
+ffrknn_t *ffrknn_new(const ffrknn_config_t *cfg);
+/* cfg with the defaults the engine filled in */
+const ffrknn_config_t *ffrknn_config(ffrknn_t *eng);
+
+/* before ffrknn_open(); returns the stream id, -1 on error */
+int ffrknn_add_stream(ffrknn_t *eng, const char *url, float slo_ms, ffrknn_callback_t cb,
+                      void *opaque);
+/* one stream per input of a capture: file[,speed=1,jitter=ms,loss=percent,seed=1] */
+int ffrknn_add_replay(ffrknn_t *eng, const char *spec, ffrknn_callback_t cb, void *opaque);
+
+/* loads the models, opens the streams and the sinks: returns the streams opened */
+int ffrknn_open(ffrknn_t *eng);
+int ffrknn_start(ffrknn_t *eng);
+/* waits up to timeout_ms: returns the streams still running, 0 once stopped */
+int ffrknn_wait(ffrknn_t *eng, int timeout_ms);
+/* stops and joins the stream threads, flushes the sinks */
+void ffrknn_stop(ffrknn_t *eng);
+/* per stream and per stage results on stderr */
+void ffrknn_report(ffrknn_t *eng);
+void ffrknn_free(ffrknn_t *eng);
+
+/* after ffrknn_open(), index 0 .. count - 1 */
+int ffrknn_stream_count(ffrknn_t *eng);
+int ffrknn_stream_info(ffrknn_t *eng, int index, ffrknn_stream_info_t *info);
+
+/*
+ * Display side: the newest image of a stream with its detections, NULL
+ * when there is nothing new. The image stays valid until the next call
+ * for the stream; ffrknn_presented() once it is on the glass.
+ */
+const uint8_t *ffrknn_image_read(ffrknn_t *eng, int index, detect_result_group_t *group);
+void ffrknn_presented(ffrknn_t *eng, int index, const detect_result_group_t *group, int64_t now);
+
+/* the object / accuracy filter and label text of the engine */
+int ffrknn_detection_shown(ffrknn_t *eng, const detect_result_t *det_result);
+void ffrknn_detection_label(const detect_result_t *det_result, char *text, int size);
+
+#endif //_FF_RKNN_FFRKNN_H_
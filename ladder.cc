@@ -0,0 +1,73 @@
+/*
+ * ff-rknn - model ladder
+ *
+ * Streams that miss their latency SLO step down to a smaller model, one
+ * rung at a time, and climb back when the model above would fit with
+ * margin. Moves are held for LADDER_HOLD_US per stream and spaced by
+ * LADDER_SPACING_US over all streams, so the NPU load settles between
+ * two moves instead of every stream dropping at once.
+ */
+
+#include "ladder.h"
+
+static float average(float avg, float value)
+{
+    return avg > 0 ? avg * 0.8f + value * 0.2f : value;
+}
+
+void ladder_init(ladder_t *l, int rungs)
+{
+    l->rungs = rungs < LADDER_MAX ? rungs : LADDER_MAX;
+    for (int i = 0; i < LADDER_MAX; i++)
+        l->run_ms[i].store(0);
+    l->last_move.store(INT64_MIN / 2);
+}
+
+/* called after each inference of the stream, returns the rung for the next one */
+int ladder_update(ladder_t *l, ladder_state_t *st, float wait_ms, float run_ms, int64_t now)
+{
+    int rung = st->rung;
+    int64_t last;
+
+    st->frames[rung]++;
+    /* racy average over the streams, close enough for a prediction */
+    l->run_ms[rung].store(average(l->run_ms[rung].load(), run_ms));
+    st->wait_ms = average(st->wait_ms, wait_ms);
+    st->npu_ms = average(st->npu_ms, wait_ms + run_ms);
+    if (st->slo_ms <= 0 || l->rungs < 2)
+        return rung;
+
+    if (st->npu_ms > st->slo_ms) {
+        st->over++;
+        st->room = 0;
+    } else {
+        float up = rung > 0 ? l->run_ms[rung - 1].load() : 0;
+
+        st->over = 0;
+        if (up > 0 && st->wait_ms + up < st->slo_ms * LADDER_UP_MARGIN)
+            st->room++;
+        else
+            st->room = 0;
+    }
+
+    if (now - st->moved < LADDER_HOLD_US)
+        return rung;
+    if (st->over >= LADDER_DOWN_FRAMES && rung < l->rungs - 1)
+        rung++;
+    else if (st->room >= LADDER_UP_FRAMES && rung > 0)
+        rung--;
+    else
+        return rung;
+
+    /* one move at a time: the other streams see its effect first */
+    last = l->last_move.load();
+    if (now - last < LADDER_SPACING_US || !l->last_move.compare_exchange_strong(last, now))
+        return st->rung;
+    st->rung = rung;
+    st->moved = now;
+    st->moves++;
+    st->over = 0;
+    st->room = 0;
+    st->npu_ms = 0;
+    return rung;
+}
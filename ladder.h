@@ -0,0 +1,43 @@
+#ifndef _FF_RKNN_LADDER_H_
+#define _FF_RKNN_LADDER_H_
+
+#include <atomic>
+#include <stdint.h>
+
+#define LADDER_MAX         4
+#define LADDER_DOWN_FRAMES 8        // frames over the SLO before a stream steps down
+#define LADDER_UP_FRAMES   90       // frames with room to spare before it steps up
+#define LADDER_UP_MARGIN   0.75f    // step up only if the bigger model fits in this part of the SLO
+#define LADDER_HOLD_US     2000000  // a stream stays on a rung at least this long
+#define LADDER_SPACING_US  250000   // between two moves of any streams
+
+/*
+ * Models from the largest (rung 0) to the smallest, shared by the streams.
+ * run_ms is the inference time measured per rung over all streams, used to
+ * tell whether a stream would still meet its SLO one rung up.
+ */
+typedef struct _ladder_t
+{
+    int rungs;
+    std::atomic<float> run_ms[LADDER_MAX];
+    std::atomic<int64_t> last_move;
+} ladder_t;
+
+/* one per stream */
+typedef struct _ladder_state_t
+{
+    int rung;
+    float slo_ms;  // wait + inference budget per frame, 0: stay on rung 0
+    float wait_ms; // averages of the NPU queue wait and of wait + inference
+    float npu_ms;
+    int over;      // consecutive frames over the SLO
+    int room;      // consecutive frames the rung above would fit
+    int64_t moved; // microseconds, last rung change
+    uint64_t moves;
+    uint64_t frames[LADDER_MAX];
+} ladder_state_t;
+
+void ladder_init(ladder_t *l, int rungs);
+int ladder_update(ladder_t *l, ladder_state_t *st, float wait_ms, float run_ms, int64_t now);
+
+#endif //_FF_RKNN_LADDER_H_
@@ -0,0 +1,61 @@
+/*
+ * ff-rknn - triple buffered frame mailbox
+ */
+
+#include "mailbox.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAILBOX_FRESH 0x4
+
+int mailbox_init(mailbox_t *mb, int size)
+{
+    for (int i = 0; i < MAILBOX_SLOTS; i++) {
+        mb->slots[i].buf = calloc(1, size);
+        if (!mb->slots[i].buf)
+            return -1;
+        memset(&mb->slots[i].group, 0, sizeof(mb->slots[i].group));
+    }
+    mb->write_idx = 0;
+    mb->read_idx = 1;
+    mb->ready.store(2);
+    mb->published.store(0);
+    mb->dropped.store(0);
+    return 0;
+}
+
+void mailbox_deinit(mailbox_t *mb)
+{
+    for (int i = 0; i < MAILBOX_SLOTS; i++) {
+        free(mb->slots[i].buf);
+        mb->slots[i].buf = NULL;
+    }
+}
+
+mailbox_slot_t *mailbox_write_slot(mailbox_t *mb)
+{
+    return &mb->slots[mb->write_idx];
+}
+
+void mailbox_publish(mailbox_t *mb)
+{
+    int prev = mb->ready.exchange(mb->write_idx | MAILBOX_FRESH, std::memory_order_acq_rel);
+
+    if (prev & MAILBOX_FRESH)
+        mb->dropped.fetch_add(1, std::memory_order_relaxed);
+    mb->published.fetch_add(1, std::memory_order_relaxed);
+    mb->write_idx = prev & ~MAILBOX_FRESH;
+}
+
+/* latest published slot, or NULL when nothing new arrived since the last call */
+mailbox_slot_t *mailbox_read(mailbox_t *mb)
+{
+    int prev;
+
+    if (!(mb->ready.load(std::memory_order_acquire) & MAILBOX_FRESH))
+        return NULL;
+    prev = mb->ready.exchange(mb->read_idx, std::memory_order_acq_rel);
+    mb->read_idx = prev & ~MAILBOX_FRESH;
+    return &mb->slots[mb->read_idx];
+}
@@ -0,0 +1,39 @@
+#ifndef _FF_RKNN_MAILBOX_H_
+#define _FF_RKNN_MAILBOX_H_
+
+#include <atomic>
+#include <stdint.h>
+
+#include "postprocess.h"
+
+#define MAILBOX_SLOTS 3
+
+typedef struct _mailbox_slot_t
+{
+    void *buf;
+    detect_result_group_t group;
+} mailbox_slot_t;
+
+/*
+ * Triple buffered frame handoff, one producer and one consumer, no locks:
+ * the producer owns one slot, the consumer owns one slot and the third one
+ * is swapped atomically between them. A frame published before the
+ * consumer took the previous one replaces it and counts as dropped.
+ */
+typedef struct _mailbox_t
+{
+    mailbox_slot_t slots[MAILBOX_SLOTS];
+    int write_idx;
+    int read_idx;
+    std::atomic<int> ready; // slot index | MAILBOX_FRESH
+    std::atomic<uint64_t> published;
+    std::atomic<uint64_t> dropped;
+} mailbox_t;
+
+int mailbox_init(mailbox_t *mb, int size);
+void mailbox_deinit(mailbox_t *mb);
+mailbox_slot_t *mailbox_write_slot(mailbox_t *mb);
+void mailbox_publish(mailbox_t *mb);
+mailbox_slot_t *mailbox_read(mailbox_t *mb);
+
+#endif //_FF_RKNN_MAILBOX_H_
@@ -0,0 +1,171 @@
+/*
+ * ff-rknn - metrics endpoint
+ *
+ * One thread polls the listening socket and answers every connection with
+ * a single HTTP/1.0 response, whatever the request path: enough for
+ * Prometheus, curl and a browser. The body is built in memory first so a
+ * slow client never holds a lock of the pipeline.
+ */
+
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int server_fd = -1;
+static pthread_t server_thread;
+static std::atomic<int> server_stop(0);
+static char server_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static void (*server_write)(FILE *fp, void *opaque);
+static void *server_opaque;
+
+static void send_all(int fd, const char *buf, size_t size)
+{
+    while (size) {
+        ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        buf += n;
+        size -= n;
+    }
+}
+
+static void serve(int client)
+{
+    struct pollfd pfd = { client, POLLIN, 0 };
+    char request[1024], header[256];
+    char *body = NULL;
+    size_t size = 0;
+    FILE *fp;
+    int len;
+
+    /* the request itself does not matter, wait briefly for it */
+    if (poll(&pfd, 1, 1000) > 0)
+        recv(client, request, sizeof(request), 0);
+
+    fp = open_memstream(&body, &size);
+    if (!fp)
+        return;
+    server_write(fp, server_opaque);
+    fclose(fp);
+    len = snprintf(header, sizeof(header),
+                   "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Connection: close\r\n\r\n", size);
+    send_all(client, header, len);
+    send_all(client, body, size);
+    free(body);
+}
+
+static void *metrics_server(void * /* arg */)
+{
+    struct pollfd pfd = { server_fd, POLLIN, 0 };
+
+    while (!server_stop.load()) {
+        int client;
+
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        client = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0)
+            continue;
+        serve(client);
+        close(client);
+    }
+    return NULL;
+}
+
+static int listen_unix(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "metrics: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return -1;
+    }
+    strcpy(server_path, path);
+    return fd;
+}
+
+static int listen_tcp(const char *address)
+{
+    struct sockaddr_in addr;
+    const char *colon = strrchr(address, ':');
+    char host[64] = "127.0.0.1";
+    int fd, one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(colon ? colon + 1 : address));
+    if (colon && colon > address)
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - address), address);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 || !addr.sin_port) {
+        fprintf(stderr, "metrics: bad address %s\n", address);
+        return -1;
+    }
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int metrics_start(const char *address, void (*writer)(FILE *fp, void *opaque), void *opaque)
+{
+    server_path[0] = '\0';
+    server_write = writer;
+    server_opaque = opaque;
+    server_fd = address[0] == '/' ? listen_unix(address) : listen_tcp(address);
+    if (server_fd < 0) {
+        fprintf(stderr, "metrics: %s: %s\n", address, strerror(errno));
+        return -1;
+    }
+    server_stop.store(0);
+    if (pthread_create(&server_thread, NULL, metrics_server, NULL) != 0) {
+        close(server_fd);
+        server_fd = -1;
+        return -1;
+    }
+    fprintf(stderr, "metrics: serving on %s\n", address);
+    return 0;
+}
+
+void metrics_stop(void)
+{
+    if (server_fd < 0)
+        return;
+    server_stop.store(1);
+    pthread_join(server_thread, NULL);
+    close(server_fd);
+    if (server_path[0])
+        unlink(server_path);
+    server_fd = -1;
+}
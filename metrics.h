@@ -0,0 +1,30 @@
+#ifndef _FF_RKNN_METRICS_H_
+#define _FF_RKNN_METRICS_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+
+/* per stream counters, bumped by the stream threads with relaxed adds */
+typedef struct _metrics_stream_t
+{
+    std::atomic<uint64_t> decoded;    // frames out of the decoder
+    std::atomic<uint64_t> detections; // detections of the inferred frames
+    std::atomic<uint64_t> npu_ns;     // inputs_set + run + outputs_get
+    std::atomic<uint64_t> rga_ns;     // model input, texture and crop blits
+} metrics_stream_t;
+
+static inline void metrics_add(std::atomic<uint64_t> *counter, uint64_t value)
+{
+    counter->fetch_add(value, std::memory_order_relaxed);
+}
+
+/*
+ * Prometheus text over HTTP on "/path/to.sock" (curl --unix-socket) or
+ * "[host:]port" (default host 127.0.0.1). writer(fp, opaque) fills the
+ * body on the server thread, once per scrape.
+ */
+int metrics_start(const char *address, void (*writer)(FILE *fp, void *opaque), void *opaque);
+void metrics_stop(void);
+
+#endif //_FF_RKNN_METRICS_H_
@@ -0,0 +1,244 @@
+/*
+ * ff-rknn - NPU context pool
+ *
+ * One model load shared by every stream: the first context is created with
+ * rknn_init(), the others are rknn_dup_context() copies pinned to the NPU
+ * cores round-robin. All calls go through the backend of the pool.
+ */
+
+#include "npu_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const rknn_core_mask core_masks[] = {
+    RKNN_NPU_CORE_0,
+    RKNN_NPU_CORE_1,
+    RKNN_NPU_CORE_2,
+};
+
+/* NHWC: dims[1] is the height, NCHW: dims[2] */
+static void tensor_size(rknn_tensor_format fmt, const uint32_t *dims, int *width, int *height,
+                        int *channel)
+{
+    if (fmt == RKNN_TENSOR_NCHW) {
+        *channel = dims[1];
+        *height = dims[2];
+        *width = dims[3];
+    } else {
+        *height = dims[1];
+        *width = dims[2];
+        *channel = dims[3];
+    }
+}
+
+/*
+ * Models converted with dynamic_input list their input shapes; keep up to
+ * NPU_MAX_SHAPES of them sorted by area. Fixed models leave nb_shapes 0.
+ */
+static void query_shapes(npu_pool_t *pool)
+{
+    rknn_input_range *range;
+    int channel;
+
+    pool->nb_shapes = 0;
+    range = (rknn_input_range *)calloc(1, sizeof(rknn_input_range));
+    if (!range)
+        return;
+    range->index = 0;
+    if (pool->backend->query(pool->ctxs[0].ctx, RKNN_QUERY_INPUT_DYNAMIC_RANGE, range,
+                             sizeof(rknn_input_range)) < 0 ||
+        range->shape_number < 2 || range->n_dims != 4) {
+        free(range);
+        return;
+    }
+    pool->shape_fmt = range->fmt;
+    pool->shape_n_dims = range->n_dims;
+    for (uint32_t i = 0; i < range->shape_number && pool->nb_shapes < NPU_MAX_SHAPES; i++) {
+        npu_shape_t shape;
+        int j;
+
+        memcpy(shape.dims, range->dyn_range[i], sizeof(shape.dims));
+        tensor_size(range->fmt, shape.dims, &shape.width, &shape.height, &channel);
+        if (shape.dims[0] != 1 || shape.width <= 0 || shape.height <= 0)
+            continue;
+        for (j = pool->nb_shapes; j > 0 &&
+             pool->shapes[j - 1].width * pool->shapes[j - 1].height > shape.width * shape.height; j--)
+            pool->shapes[j] = pool->shapes[j - 1];
+        pool->shapes[j] = shape;
+        pool->nb_shapes++;
+    }
+    free(range);
+}
+
+int npu_pool_init(npu_pool_t *pool, unsigned char *model_data, int model_data_size, int count)
+{
+    rknn_sdk_version version;
+    int ret;
+
+    if (count < 1)
+        count = 1;
+    if (count > NPU_POOL_MAX_CTX)
+        count = NPU_POOL_MAX_CTX;
+
+    pool->backend = npu_backend;
+    pool->count = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    ret = pool->backend->init(&pool->ctxs[0].ctx, model_data, model_data_size, 0, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "rknn_init error ret=%d\n", ret);
+        return -1;
+    }
+    pool->count = 1;
+
+    ret = pool->backend->query(pool->ctxs[0].ctx, RKNN_QUERY_SDK_VERSION, &version,
+                               sizeof(rknn_sdk_version));
+    if (ret < 0) {
+        fprintf(stderr, "rknn_init error ret=%d\n", ret);
+        return -1;
+    }
+    fprintf(stderr, "sdk version: %s driver version: %s\n",
+            version.api_version,
+            version.drv_version);
+
+    ret = pool->backend->query(pool->ctxs[0].ctx, RKNN_QUERY_IN_OUT_NUM, &pool->io_num,
+                               sizeof(pool->io_num));
+    if (ret < 0) {
+        fprintf(stderr, "rknn_init error ret=%d\n", ret);
+        return -1;
+    }
+    fprintf(stderr, "model input num: %d, output num: %d\n",
+            pool->io_num.n_input,
+            pool->io_num.n_output);
+    if (pool->io_num.n_output > NPU_MAX_OUTPUTS) {
+        fprintf(stderr, "model has too many outputs: %d\n", pool->io_num.n_output);
+        return -1;
+    }
+
+    memset(&pool->input_attr, 0, sizeof(pool->input_attr));
+    pool->input_attr.index = 0;
+    ret = pool->backend->query(pool->ctxs[0].ctx, RKNN_QUERY_INPUT_ATTR, &pool->input_attr,
+                               sizeof(rknn_tensor_attr));
+    if (ret < 0) {
+        fprintf(stderr, "rknn_init error ret=%d\n", ret);
+        return -1;
+    }
+
+    memset(pool->output_attrs, 0, sizeof(pool->output_attrs));
+    pool->out_scales.clear();
+    pool->out_zps.clear();
+    for (uint32_t i = 0; i < pool->io_num.n_output; i++) {
+        pool->output_attrs[i].index = i;
+        ret = pool->backend->query(pool->ctxs[0].ctx, RKNN_QUERY_OUTPUT_ATTR,
+                                   &(pool->output_attrs[i]), sizeof(rknn_tensor_attr));
+        if (ret < 0) {
+            fprintf(stderr, "rknn_query output %u error ret=%d\n", i, ret);
+            return -1;
+        }
+        pool->out_scales.push_back(pool->output_attrs[i].scale);
+        pool->out_zps.push_back(pool->output_attrs[i].zp);
+    }
+
+    tensor_size(pool->input_attr.fmt, pool->input_attr.dims, &pool->width, &pool->height,
+                &pool->channel);
+    query_shapes(pool);
+    if (pool->nb_shapes) {
+        pool->width = pool->shapes[pool->nb_shapes - 1].width;
+        pool->height = pool->shapes[pool->nb_shapes - 1].height;
+        for (int i = 0; i < pool->nb_shapes; i++)
+            fprintf(stderr, "model shape %d: %dx%d\n", i, pool->shapes[i].width, pool->shapes[i].height);
+    }
+    fprintf(stderr, "model: %dx%dx%d\n", pool->width, pool->height, pool->channel);
+
+    for (int i = 1; i < count; i++) {
+        ret = pool->backend->dup_context(&pool->ctxs[0].ctx, &pool->ctxs[i].ctx);
+        if (ret < 0) {
+            fprintf(stderr, "rknn_dup_context error ret=%d, using %d context(s)\n", ret, i);
+            break;
+        }
+        pool->count++;
+    }
+
+    /* single core NPUs (RK3566/RK3568) reject the mask: keep RKNN_NPU_CORE_AUTO */
+    for (int i = 0; i < pool->count; i++) {
+        pool->ctxs[i].busy = 0;
+        pool->ctxs[i].core = RKNN_NPU_CORE_AUTO;
+        if (pool->count > 1) {
+            rknn_core_mask mask = core_masks[i % (sizeof(core_masks) / sizeof(core_masks[0]))];
+            if (pool->backend->set_core_mask(pool->ctxs[i].ctx, mask) == 0)
+                pool->ctxs[i].core = mask;
+        }
+        /* a dynamic model needs a shape before its first run */
+        pool->ctxs[i].shape = -1;
+        if (pool->nb_shapes && npu_pool_set_shape(pool, &pool->ctxs[i], pool->nb_shapes - 1) < 0)
+            return -1;
+    }
+    fprintf(stderr, "npu pool: %d context(s)\n", pool->count);
+    return 0;
+}
+
+npu_ctx_t *npu_pool_acquire(npu_pool_t *pool)
+{
+    npu_ctx_t *nctx = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!nctx) {
+        for (int i = 0; i < pool->count; i++) {
+            if (!pool->ctxs[i].busy) {
+                nctx = &pool->ctxs[i];
+                nctx->busy = 1;
+                break;
+            }
+        }
+        if (!nctx)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return nctx;
+}
+
+void npu_pool_release(npu_pool_t *pool, npu_ctx_t *nctx)
+{
+    pthread_mutex_lock(&pool->lock);
+    nctx->busy = 0;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* no-op when the context already runs this shape */
+int npu_pool_set_shape(npu_pool_t *pool, npu_ctx_t *nctx, int shape)
+{
+    rknn_tensor_attr attr;
+    int ret;
+
+    if (!pool->nb_shapes || nctx->shape == shape)
+        return 0;
+    attr = pool->input_attr;
+    attr.fmt = pool->shape_fmt;
+    attr.n_dims = pool->shape_n_dims;
+    memcpy(attr.dims, pool->shapes[shape].dims, sizeof(attr.dims));
+    ret = pool->backend->set_input_shape(nctx->ctx, &attr);
+    if (ret < 0) {
+        fprintf(stderr, "rknn_set_input_shape %dx%d error ret=%d\n", pool->shapes[shape].width,
+                pool->shapes[shape].height, ret);
+        return -1;
+    }
+    nctx->shape = shape;
+    return 0;
+}
+
+void npu_pool_deinit(npu_pool_t *pool)
+{
+    /* duplicated contexts first, the original owns the weights */
+    for (int i = pool->count - 1; i >= 0; i--) {
+        if (pool->ctxs[i].ctx)
+            pool->backend->destroy(pool->ctxs[i].ctx);
+        pool->ctxs[i].ctx = 0;
+    }
+    pool->count = 0;
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+}
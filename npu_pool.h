@@ -0,0 +1,68 @@
+#ifndef _FF_RKNN_NPU_POOL_H_
+#define _FF_RKNN_NPU_POOL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+#include "backend.h"
+
+#define NPU_POOL_MAX_CTX  8
+#define NPU_MAX_OUTPUTS   16
+#define NPU_MAX_SHAPES    8
+
+/*
+ * One rknn context bound to an NPU core. All contexts of a pool are
+ * duplicated from the same rknn_init() so the model weights are shared.
+ */
+typedef struct _npu_ctx_t
+{
+    rknn_context ctx;
+    rknn_core_mask core;
+    int busy;
+    int shape; // dynamic shape models: index in npu_pool_t.shapes set on this context
+} npu_ctx_t;
+
+typedef struct _npu_shape_t
+{
+    int width;
+    int height;
+    uint32_t dims[RKNN_MAX_DIMS];
+} npu_shape_t;
+
+/*
+ * Shared model + NPU scheduler: streams borrow a free context for one
+ * inference and hand it back, so N streams run on M cores with a single
+ * model load.
+ */
+typedef struct _npu_pool_t
+{
+    const npu_backend_t *backend; // npu_backend when the pool was created
+    int count;
+    npu_ctx_t ctxs[NPU_POOL_MAX_CTX];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    rknn_input_output_num io_num;
+    rknn_tensor_attr input_attr;
+    rknn_tensor_attr output_attrs[NPU_MAX_OUTPUTS];
+    std::vector<float> out_scales;
+    std::vector<int32_t> out_zps;
+    int channel;
+    int width;  // largest input shape
+    int height;
+
+    /* dynamic shape models (RKNN_QUERY_INPUT_DYNAMIC_RANGE), smallest first */
+    int nb_shapes;
+    npu_shape_t shapes[NPU_MAX_SHAPES];
+    rknn_tensor_format shape_fmt;
+    uint32_t shape_n_dims;
+} npu_pool_t;
+
+int npu_pool_init(npu_pool_t *pool, unsigned char *model_data, int model_data_size, int count);
+npu_ctx_t *npu_pool_acquire(npu_pool_t *pool);
+void npu_pool_release(npu_pool_t *pool, npu_ctx_t *nctx);
+int npu_pool_set_shape(npu_pool_t *pool, npu_ctx_t *nctx, int shape);
+void npu_pool_deinit(npu_pool_t *pool);
+
+#endif //_FF_RKNN_NPU_POOL_H_
@@ -0,0 +1,184 @@
+/*
+ * ff-rknn - batched detection overlay
+ *
+ * Boxes are grouped by colour and drawn with one call per colour, label
+ * text is drawn from a pre-rasterised 5x7 glyph atlas in a single
+ * SDL_RenderGeometry call per frame.
+ */
+
+#include "overlay.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "font5x7.h"
+
+#define ATLAS_COLS 16
+#define ATLAS_ROWS ((FONT_LAST - FONT_FIRST + ATLAS_COLS) / ATLAS_COLS)
+#define ATLAS_W    (ATLAS_COLS * FONT_CELL_W)
+#define ATLAS_H    (ATLAS_ROWS * FONT_CELL_H)
+
+static SDL_Texture *atlas;
+static int scale = 1;
+static std::vector<SDL_FRect> fills[OVERLAY_COLORS];
+static std::vector<SDL_FRect> boxes[OVERLAY_COLORS];
+static std::vector<SDL_FRect> label_bg[OVERLAY_COLORS];
+static std::vector<SDL_Vertex> glyph_vertices;
+static std::vector<int> glyph_indices;
+
+int overlay_init(SDL_Renderer *renderer, int text_scale)
+{
+    static uint8_t pixels[ATLAS_H][ATLAS_W][4];
+
+    scale = text_scale;
+    if (scale <= 0)
+        return 0;
+
+    memset(pixels, 0, sizeof(pixels));
+    for (int c = 0; c <= FONT_LAST - FONT_FIRST; c++) {
+        int x0 = (c % ATLAS_COLS) * FONT_CELL_W;
+        int y0 = (c / ATLAS_COLS) * FONT_CELL_H;
+
+        for (int y = 0; y < FONT_H; y++) {
+            for (int x = 0; x < FONT_W; x++) {
+                uint8_t *px = pixels[y0 + y][x0 + x];
+
+                px[0] = px[1] = px[2] = 255;
+                px[3] = (font5x7[c][y] >> (FONT_W - 1 - x)) & 1 ? 255 : 0;
+            }
+        }
+    }
+
+    atlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC,
+                              ATLAS_W, ATLAS_H);
+    if (!atlas) {
+        fprintf(stderr, "Failed to create glyph atlas: %s\n", SDL_GetError());
+        return -1;
+    }
+    SDL_UpdateTexture(atlas, NULL, pixels, ATLAS_W * 4);
+    SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+    /* -L 2 and up magnify the glyphs: keep their pixels sharp */
+    SDL_SetTextureScaleMode(atlas, SDL_SCALEMODE_NEAREST);
+
+    for (int i = 0; i < OVERLAY_COLORS; i++) {
+        fills[i].reserve(OBJ_NUMB_MAX_SIZE);
+        boxes[i].reserve(OBJ_NUMB_MAX_SIZE);
+        label_bg[i].reserve(OBJ_NUMB_MAX_SIZE);
+    }
+    glyph_vertices.reserve(OBJ_NUMB_MAX_SIZE * 24 * 4);
+    glyph_indices.reserve(OBJ_NUMB_MAX_SIZE * 24 * 6);
+    return 0;
+}
+
+void overlay_deinit(void)
+{
+    if (atlas)
+        SDL_DestroyTexture(atlas);
+    atlas = NULL;
+}
+
+static void add_label(const SDL_FRect *rect, int clr, const char *label)
+{
+    const uint8_t *bg = annotate_palette[clr];
+    SDL_Color fg = { 0, 0, 0, 255 };
+    float cw = FONT_CELL_W * scale;
+    float ch = FONT_CELL_H * scale;
+    SDL_FRect r;
+    float x, y;
+    int n = strlen(label);
+
+    /* dark label backgrounds get white text */
+    if (bg[0] * 299 + bg[1] * 587 + bg[2] * 114 < 128000)
+        fg.r = fg.g = fg.b = 255;
+
+    r.x = rect->x;
+    r.y = rect->y >= ch ? rect->y - ch : rect->y;
+    r.w = n * cw + scale;
+    r.h = ch;
+    label_bg[clr].push_back(r);
+
+    x = r.x + scale;
+    y = r.y + scale;
+    for (const char *p = label; *p; p++, x += cw) {
+        int c = (unsigned char)*p;
+        int base = glyph_vertices.size();
+        float u0, v0, u1, v1;
+        SDL_Vertex v;
+
+        if (c <= FONT_FIRST || c > FONT_LAST)
+            continue;
+        c -= FONT_FIRST;
+        u0 = (float)((c % ATLAS_COLS) * FONT_CELL_W) / ATLAS_W;
+        v0 = (float)((c / ATLAS_COLS) * FONT_CELL_H) / ATLAS_H;
+        u1 = u0 + (float)FONT_CELL_W / ATLAS_W;
+        v1 = v0 + (float)FONT_CELL_H / ATLAS_H;
+
+        v.color = fg;
+        v.position.x = x;
+        v.position.y = y;
+        v.tex_coord.x = u0;
+        v.tex_coord.y = v0;
+        glyph_vertices.push_back(v);
+        v.position.x = x + cw;
+        v.tex_coord.x = u1;
+        glyph_vertices.push_back(v);
+        v.position.y = y + ch;
+        v.tex_coord.y = v1;
+        glyph_vertices.push_back(v);
+        v.position.x = x;
+        v.tex_coord.x = u0;
+        glyph_vertices.push_back(v);
+
+        glyph_indices.push_back(base);
+        glyph_indices.push_back(base + 1);
+        glyph_indices.push_back(base + 2);
+        glyph_indices.push_back(base);
+        glyph_indices.push_back(base + 2);
+        glyph_indices.push_back(base + 3);
+    }
+}
+
+void overlay_add(const SDL_FRect *rect, int clr, const char *label)
+{
+    fills[clr].push_back(*rect);
+    boxes[clr].push_back(*rect);
+    if (label && atlas)
+        add_label(rect, clr, label);
+}
+
+void overlay_flush(SDL_Renderer *renderer, int alphablend)
+{
+    if (alphablend) {
+        for (int i = 0; i < OVERLAY_COLORS; i++) {
+            const uint8_t *c = annotate_palette[i];
+
+            if (fills[i].empty())
+                continue;
+            SDL_SetRenderDrawColor(renderer, c[0], c[1], c[2], alphablend);
+            SDL_RenderFillRects(renderer, fills[i].data(), fills[i].size());
+        }
+    }
+    for (int i = 0; i < OVERLAY_COLORS; i++) {
+        const uint8_t *c = annotate_palette[i];
+
+        if (boxes[i].empty())
+            continue;
+        SDL_SetRenderDrawColor(renderer, c[0], c[1], c[2], SDL_ALPHA_OPAQUE);
+        SDL_RenderRects(renderer, boxes[i].data(), boxes[i].size());
+        if (!label_bg[i].empty())
+            SDL_RenderFillRects(renderer, label_bg[i].data(), label_bg[i].size());
+    }
+    if (!glyph_indices.empty())
+        SDL_RenderGeometry(renderer, atlas, glyph_vertices.data(), glyph_vertices.size(),
+                           glyph_indices.data(), glyph_indices.size());
+
+    for (int i = 0; i < OVERLAY_COLORS; i++) {
+        fills[i].clear();
+        boxes[i].clear();
+        label_bg[i].clear();
+    }
+    glyph_vertices.clear();
+    glyph_indices.clear();
+}
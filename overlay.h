@@ -0,0 +1,21 @@
+#ifndef _FF_RKNN_OVERLAY_H_
+#define _FF_RKNN_OVERLAY_H_
+
+#include "SDL3/SDL.h"
+
+#include "annotate.h"
+#include "postprocess.h"
+
+#define OVERLAY_COLORS ANNOTATE_COLORS // clr: index into annotate_palette
+
+/*
+ * Detection overlay drawn in batches: boxes are queued per colour during a
+ * frame and issued with one SDL_RenderFillRects / SDL_RenderRects per
+ * colour, labels come from a glyph atlas texture in one SDL_RenderGeometry.
+ */
+int overlay_init(SDL_Renderer *renderer, int text_scale);
+void overlay_deinit(void);
+void overlay_add(const SDL_FRect *rect, int clr, const char *label);
+void overlay_flush(SDL_Renderer *renderer, int alphablend);
+
+#endif //_FF_RKNN_OVERLAY_H_
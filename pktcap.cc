@@ -0,0 +1,260 @@
+/*
+ * ff-rknn - capture and replay of demuxed packets
+ *
+ * -cap writes every video packet a stream thread reads, with the time it
+ * arrived, after a record per stream with its codec parameters and
+ * extradata. -replay opens no demuxer: the decoder is set up from the
+ * stream record and the packets come back at their arrival times, so a
+ * live RTSP/RTMP/HTTP session can be run again offline and identically.
+ */
+
+#include "pktcap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAD(n) (((n) + 7) & ~(size_t)7)
+
+static const uint8_t zeros[8] = { 0 };
+
+static int writev_all(int fd, struct iovec *iov, int count)
+{
+    while (count) {
+        ssize_t n = writev(fd, iov, count);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        while (count && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int write_record(pktcap_t *cap, const void *hdr, size_t hdr_size, const void *a,
+                        size_t a_size, const void *b, size_t b_size, size_t size)
+{
+    struct iovec iov[4];
+    int n_iov = 0, ret;
+
+    iov[n_iov].iov_base = (void *)hdr;
+    iov[n_iov++].iov_len = hdr_size;
+    if (a_size) {
+        iov[n_iov].iov_base = (void *)a;
+        iov[n_iov++].iov_len = a_size;
+    }
+    if (b_size) {
+        iov[n_iov].iov_base = (void *)b;
+        iov[n_iov++].iov_len = b_size;
+    }
+    if (size > hdr_size + a_size + b_size) {
+        iov[n_iov].iov_base = (void *)zeros;
+        iov[n_iov++].iov_len = size - hdr_size - a_size - b_size;
+    }
+
+    pthread_mutex_lock(&cap->lock);
+    ret = writev_all(cap->fd, iov, n_iov);
+    if (ret == 0) {
+        cap->bytes += size;
+        cap->packets += *(const uint32_t *)hdr == PKTCAP_PACKET_MAGIC;
+    }
+    pthread_mutex_unlock(&cap->lock);
+    if (ret < 0)
+        fprintf(stderr, "pktcap: write failed: %s\n", strerror(errno));
+    return ret;
+}
+
+pktcap_t *pktcap_open(const char *path)
+{
+    pktcap_t *cap = (pktcap_t *)calloc(1, sizeof(pktcap_t));
+    pktcap_header_t hdr;
+    struct iovec iov = { &hdr, sizeof(hdr) };
+    struct timespec ts;
+
+    if (!cap)
+        return NULL;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    cap->start = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = PKTCAP_MAGIC;
+    hdr.version = PKTCAP_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.created = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    cap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (cap->fd < 0 || writev_all(cap->fd, &iov, 1) < 0) {
+        fprintf(stderr, "pktcap: %s: %s\n", path, strerror(errno));
+        if (cap->fd >= 0)
+            close(cap->fd);
+        free(cap);
+        return NULL;
+    }
+    pthread_mutex_init(&cap->lock, NULL);
+    return cap;
+}
+
+int pktcap_add_stream(pktcap_t *cap, int stream, const AVStream *st, const char *url)
+{
+    const AVCodecParameters *par = st->codecpar;
+    pktcap_stream_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = PKTCAP_STREAM_MAGIC;
+    rec.stream = stream;
+    rec.codec_id = par->codec_id;
+    rec.width = par->width;
+    rec.height = par->height;
+    rec.format = par->format;
+    rec.profile = par->profile;
+    rec.level = par->level;
+    rec.time_base_num = st->time_base.num;
+    rec.time_base_den = st->time_base.den;
+    rec.frame_rate_num = st->avg_frame_rate.num;
+    rec.frame_rate_den = st->avg_frame_rate.den;
+    rec.extradata_size = par->extradata_size > 0 ? par->extradata_size : 0;
+    rec.url_size = strlen(url) + 1;
+    rec.size = PAD(sizeof(rec) + rec.extradata_size + rec.url_size);
+    return write_record(cap, &rec, sizeof(rec), par->extradata, rec.extradata_size, url,
+                        rec.url_size, rec.size);
+}
+
+int pktcap_write(pktcap_t *cap, int stream, const AVPacket *pkt, int64_t arrival, int64_t capture)
+{
+    pktcap_packet_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = PKTCAP_PACKET_MAGIC;
+    rec.stream = stream;
+    rec.flags = pkt->flags;
+    rec.arrival = arrival - cap->start;
+    rec.pts = pkt->pts;
+    rec.dts = pkt->dts;
+    rec.duration = pkt->duration;
+    rec.capture = capture;
+    rec.data_size = pkt->size;
+    rec.size = PAD(sizeof(rec) + rec.data_size);
+    return write_record(cap, &rec, sizeof(rec), pkt->data, rec.data_size, NULL, 0, rec.size);
+}
+
+void pktcap_close(pktcap_t *cap)
+{
+    if (!cap)
+        return;
+    close(cap->fd);
+    pthread_mutex_destroy(&cap->lock);
+    free(cap);
+}
+
+int pktcap_reader_open(pktcap_reader_t *reader, const char *path)
+{
+    const pktcap_header_t *hdr;
+    struct stat st;
+    void *map;
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(pktcap_header_t)) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    hdr = (const pktcap_header_t *)map;
+    if (hdr->magic != PKTCAP_MAGIC || hdr->version != PKTCAP_VERSION ||
+        hdr->header_size > (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    reader->map = (const uint8_t *)map;
+    reader->size = st.st_size;
+    reader->offset = hdr->header_size;
+    reader->created = hdr->created;
+    return 0;
+}
+
+int pktcap_next(pktcap_reader_t *reader, pktcap_record_t *record)
+{
+    const uint8_t *p = reader->map + reader->offset;
+    size_t left = reader->size - reader->offset;
+    uint32_t magic, size;
+
+    if (left < 8)
+        return 0;
+    memcpy(&magic, p, 4);
+    memcpy(&size, p + 4, 4);
+    if (size > left || size & 7)
+        return 0;
+    memset(record, 0, sizeof(*record));
+    if (magic == PKTCAP_STREAM_MAGIC && size >= sizeof(pktcap_stream_t)) {
+        record->stream = (const pktcap_stream_t *)p;
+        if (sizeof(pktcap_stream_t) + (size_t)record->stream->extradata_size +
+                record->stream->url_size > size || !record->stream->url_size)
+            return 0;
+        record->data = p + sizeof(pktcap_stream_t);
+        record->url = (const char *)record->data + record->stream->extradata_size;
+        if (record->url[record->stream->url_size - 1] != '\0')
+            return 0;
+    } else if (magic == PKTCAP_PACKET_MAGIC && size >= sizeof(pktcap_packet_t)) {
+        record->packet = (const pktcap_packet_t *)p;
+        if (sizeof(pktcap_packet_t) + (size_t)record->packet->data_size > size)
+            return 0;
+        record->data = p + sizeof(pktcap_packet_t);
+    } else {
+        return 0;
+    }
+    reader->offset += size;
+    return 1;
+}
+
+void pktcap_reader_close(pktcap_reader_t *reader)
+{
+    if (reader->map)
+        munmap((void *)reader->map, reader->size);
+    memset(reader, 0, sizeof(*reader));
+}
+
+int pktcap_stream_params(const pktcap_record_t *record, AVCodecParameters *par, AVRational *time_base,
+                         AVRational *frame_rate)
+{
+    const pktcap_stream_t *st = record->stream;
+
+    par->codec_type = AVMEDIA_TYPE_VIDEO;
+    par->codec_id = (enum AVCodecID)st->codec_id;
+    par->width = st->width;
+    par->height = st->height;
+    par->format = st->format;
+    par->profile = st->profile;
+    par->level = st->level;
+    if (st->extradata_size) {
+        av_freep(&par->extradata);
+        par->extradata = (uint8_t *)av_mallocz(st->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!par->extradata)
+            return -1;
+        memcpy(par->extradata, record->data, st->extradata_size);
+        par->extradata_size = st->extradata_size;
+    }
+    *time_base = AVRational{ st->time_base_num, st->time_base_den };
+    *frame_rate = AVRational{ st->frame_rate_num, st->frame_rate_den };
+    return 0;
+}
@@ -0,0 +1,117 @@
+#ifndef _FF_RKNN_PKTCAP_H_
+#define _FF_RKNN_PKTCAP_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#define PKTCAP_MAGIC        0x43505246 // "FRPC"
+#define PKTCAP_STREAM_MAGIC 0x53505246 // "FRPS"
+#define PKTCAP_PACKET_MAGIC 0x50505246 // "FRPP"
+#define PKTCAP_VERSION      1
+
+typedef struct _pktcap_header_t
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t header_size; // records start here
+    uint32_t reserved2;
+    int64_t created; // unix time of arrival 0, microseconds
+} pktcap_header_t;
+
+/*
+ * One per captured input, ahead of its packets: what the decoder needs
+ * instead of the demuxer, then the extradata and the URL (0 terminated),
+ * the record padded to 8 bytes.
+ */
+typedef struct _pktcap_stream_t
+{
+    uint32_t magic;
+    uint32_t size; // whole record
+    int32_t stream; // ff-rknn stream id
+    int32_t codec_id;
+    int32_t width;
+    int32_t height;
+    int32_t format;
+    int32_t profile;
+    int32_t level;
+    int32_t time_base_num; // of the packet timestamps
+    int32_t time_base_den;
+    int32_t frame_rate_num;
+    int32_t frame_rate_den;
+    uint32_t extradata_size;
+    uint32_t url_size;
+    uint32_t reserved;
+} pktcap_stream_t;
+
+/* a demuxed video packet as av_read_frame() returned it, then its data */
+typedef struct _pktcap_packet_t
+{
+    uint32_t magic;
+    uint32_t size; // whole record
+    int32_t stream;
+    int32_t flags;    // AV_PKT_FLAG_*
+    int64_t arrival;  // nanoseconds since the capture started
+    int64_t pts;      // stream time base, AV_NOPTS_VALUE: none
+    int64_t dts;
+    int64_t duration;
+    int64_t capture;  // sender wallclock (AV_PKT_DATA_PRFT), microseconds, 0: none
+    uint32_t data_size;
+    uint32_t reserved;
+} pktcap_packet_t;
+
+/* writer, shared by the stream threads: one write() per record */
+typedef struct _pktcap_t
+{
+    int fd;
+    int64_t start; // CLOCK_MONOTONIC, nanoseconds
+    uint64_t packets;
+    uint64_t bytes;
+    pthread_mutex_t lock;
+} pktcap_t;
+
+pktcap_t *pktcap_open(const char *path);
+int pktcap_add_stream(pktcap_t *cap, int stream, const AVStream *st, const char *url);
+/* arrival: CLOCK_MONOTONIC nanoseconds */
+int pktcap_write(pktcap_t *cap, int stream, const AVPacket *pkt, int64_t arrival, int64_t capture);
+void pktcap_close(pktcap_t *cap);
+
+/* reader: mmaps the capture, a record cut short by a crash ends it */
+typedef struct _pktcap_reader_t
+{
+    const uint8_t *map;
+    size_t size;
+    size_t offset; // next record
+    int64_t created;
+} pktcap_reader_t;
+
+/* either stream (with extradata and url) or packet (with data) is set */
+typedef struct _pktcap_record_t
+{
+    const pktcap_stream_t *stream;
+    const pktcap_packet_t *packet;
+    const uint8_t *data;
+    const char *url;
+} pktcap_record_t;
+
+int pktcap_reader_open(pktcap_reader_t *reader, const char *path);
+int pktcap_next(pktcap_reader_t *reader, pktcap_record_t *record); // 1: record, 0: end
+void pktcap_reader_close(pktcap_reader_t *reader);
+
+/* decoder parameters and time base of a captured stream */
+int pktcap_stream_params(const pktcap_record_t *record, AVCodecParameters *par, AVRational *time_base,
+                         AVRational *frame_rate);
+
+#endif //_FF_RKNN_PKTCAP_H_
@@ -237,11 +237,11 @@ static int process(int8_t* input, int* anchor, int grid_h, int grid_w, int heigh
   return validCount;
 }
 
-int post_process(int8_t* input0, int8_t* input1, int8_t* input2, int model_in_h, int model_in_w, float conf_threshold,
-                 float nms_threshold, float scale_w, float scale_h, std::vector<int32_t>& qnt_zps,
-                 std::vector<float>& qnt_scales, detect_result_group_t* group)
+static int init = -1;
+
+// Load the labels up front: post_process() runs on several stream threads.
+int initPostProcess()
 {
-  static int init = -1;
   if (init == -1) {
     int ret = 0;
     ret     = loadLabelName(LABEL_NALE_TXT_PATH, labels);
@@ -251,6 +251,24 @@ int post_process(int8_t* input0, int8_t* input1, int8_t* input2, int model_in_h,
 
     init = 0;
   }
+  return 0;
+}
+
+const char* postprocess_label(int cls_id)
+{
+  if (init != 0 || cls_id < 0 || cls_id >= OBJ_CLASS_NUM) {
+    return NULL;
+  }
+  return labels[cls_id];
+}
+
+int post_process(int8_t* input0, int8_t* input1, int8_t* input2, int model_in_h, int model_in_w, float conf_threshold,
+                 float nms_threshold, float scale_w, float scale_h, std::vector<int32_t>& qnt_zps,
+                 std::vector<float>& qnt_scales, detect_result_group_t* group)
+{
+  if (initPostProcess() < 0) {
+    return -1;
+  }
   memset(group, 0, sizeof(detect_result_group_t));
 
   std::vector<float> filterBoxes;
@@ -321,6 +339,9 @@ int post_process(int8_t* input0, int8_t* input1, int8_t* input2, int model_in_h,
     group->results[last_count].box.right  = (int)(clamp(x2, 0, model_in_w) / scale_w);
     group->results[last_count].box.bottom = (int)(clamp(y2, 0, model_in_h) / scale_h);
     group->results[last_count].prop       = obj_conf;
+    group->results[last_count].cls_id     = id;
+    group->results[last_count].sub_cls    = -1;
+    group->results[last_count].sub_prop   = 0;
     char* label                           = labels[id];
     strncpy(group->results[last_count].name, label, OBJ_NAME_MAX_SIZE);
 
@@ -342,4 +363,5 @@ void deinitPostProcess()
       labels[i] = nullptr;
     }
   }
+  init = -1;
 }
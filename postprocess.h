@@ -24,15 +24,25 @@ typedef struct __detect_result_t
     char name[OBJ_NAME_MAX_SIZE];
     BOX_RECT box;
     float prop;
+    int cls_id;
+    int sub_cls;    // second stage class, -1 when not classified
+    float sub_prop;
 } detect_result_t;
 
 typedef struct _detect_result_group_t
 {
     int id;
     int count;
+    int64_t pts; // source timestamp of the frame, microseconds
+    int64_t arrival; // stats_now() when its packet was read, 0: unknown
+    int64_t capture; // sender wallclock from RTCP, microseconds since the epoch, 0: unknown
     detect_result_t results[OBJ_NUMB_MAX_SIZE];
 } detect_result_group_t;
 
+int initPostProcess();
+// class name of a cls_id once initPostProcess() loaded the labels, NULL: none
+const char *postprocess_label(int cls_id);
+
 int post_process(int8_t *input0, int8_t *input1, int8_t *input2, int model_in_h, int model_in_w,
                  float conf_threshold, float nms_threshold, float scale_w, float scale_h,
                  std::vector<int32_t> &qnt_zps, std::vector<float> &qnt_scales,
@@ -0,0 +1,396 @@
+/*
+ * ff-rknn - annotated video recording
+ *
+ * The stream thread hands frames over through a bounded queue, the
+ * recorder thread converts them to the encoder pixel format, encodes and
+ * muxes. h264_rkmpp is tried first, libx264 and libopenh264 are there for
+ * boards or hosts without the Rockchip encoder.
+ */
+
+#include "recorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+static const char *encoder_names[] = {
+    "h264_rkmpp",
+    "libx264",
+    "libopenh264",
+};
+
+static void print_error(const char *what, int err)
+{
+    char msg[128];
+
+    av_strerror(err, msg, sizeof(msg));
+    fprintf(stderr, "recorder: %s: %s\n", what, msg);
+}
+
+/* the source format if the encoder takes it, its first software format otherwise */
+static enum AVPixelFormat encoder_pix_fmt(const AVCodec *codec, enum AVPixelFormat src_fmt)
+{
+    enum AVPixelFormat first = AV_PIX_FMT_NONE;
+
+    if (!codec->pix_fmts)
+        return AV_PIX_FMT_YUV420P;
+    for (const enum AVPixelFormat *p = codec->pix_fmts; *p != AV_PIX_FMT_NONE; p++) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(*p);
+
+        if (*p == src_fmt)
+            return src_fmt;
+        if (first == AV_PIX_FMT_NONE && desc && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+            first = *p;
+    }
+    return first == AV_PIX_FMT_NONE ? AV_PIX_FMT_YUV420P : first;
+}
+
+static void segment_name(recorder_t *r, char *name, int size)
+{
+    if (r->segment_us > 0)
+        snprintf(name, size, "%s-%03d%s", r->path, r->segment, r->ext);
+    else
+        snprintf(name, size, "%s%s", r->path, r->ext);
+}
+
+static int alloc_output(recorder_t *r)
+{
+    char name[sizeof(r->path) + 32];
+    int ret;
+
+    segment_name(r, name, sizeof(name));
+    ret = avformat_alloc_output_context2(&r->oc, NULL, NULL, name);
+    if (ret < 0 || !r->oc) {
+        print_error(name, ret);
+        r->oc = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int open_output(recorder_t *r)
+{
+    int ret;
+
+    r->st = avformat_new_stream(r->oc, NULL);
+    if (!r->st)
+        return -1;
+    r->st->time_base = r->enc->time_base;
+    ret = avcodec_parameters_from_context(r->st->codecpar, r->enc);
+    if (ret < 0) {
+        print_error("codec parameters", ret);
+        return -1;
+    }
+    if (!(r->oc->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_open(&r->oc->pb, r->oc->url, AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            print_error(r->oc->url, ret);
+            return -1;
+        }
+    }
+    ret = avformat_write_header(r->oc, NULL);
+    if (ret < 0) {
+        print_error("write header", ret);
+        /* no trailer for a file without header */
+        if (r->oc->pb)
+            avio_closep(&r->oc->pb);
+        return -1;
+    }
+    fprintf(stderr, "recorder: writing %s\n", r->oc->url);
+    return 0;
+}
+
+static void close_output(recorder_t *r)
+{
+    if (!r->oc)
+        return;
+    if (r->oc->pb) {
+        av_write_trailer(r->oc);
+        avio_closep(&r->oc->pb);
+    }
+    avformat_free_context(r->oc);
+    r->oc = NULL;
+    r->st = NULL;
+}
+
+static int open_encoder(recorder_t *r, const AVCodec *codec, AVRational frame_rate)
+{
+    AVDictionary *opts = NULL;
+    double fps = frame_rate.num > 0 && frame_rate.den > 0 ? av_q2d(frame_rate) : 25.0;
+    int ret;
+
+    r->enc = avcodec_alloc_context3(codec);
+    if (!r->enc)
+        return -1;
+    r->enc->width = r->width;
+    r->enc->height = r->height;
+    r->enc->pix_fmt = encoder_pix_fmt(codec, r->src_fmt);
+    r->enc->time_base = AVRational{ 1, AV_TIME_BASE };
+    r->enc->framerate = frame_rate.num > 0 ? frame_rate : AVRational{ 25, 1 };
+    r->enc->gop_size = (int)(fps * 2);
+    r->enc->max_b_frames = 0;
+    r->enc->bit_rate = (int64_t)(r->width * r->height * fps / 8);
+    if (r->oc->oformat->flags & AVFMT_GLOBALHEADER)
+        r->enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    /* private options, ignored by the encoders that do not know them */
+    av_dict_set(&opts, "preset", "veryfast", 0);
+    av_dict_set(&opts, "tune", "zerolatency", 0);
+    av_dict_set(&opts, "forced-idr", "1", 0);
+    ret = avcodec_open2(r->enc, codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        print_error(codec->name, ret);
+        avcodec_free_context(&r->enc);
+        return -1;
+    }
+    r->codec = codec;
+    fprintf(stderr, "recorder: %s %dx%d %s\n", codec->name, r->width, r->height,
+            av_get_pix_fmt_name(r->enc->pix_fmt));
+    return 0;
+}
+
+/* next segment once the forced keyframe comes out of the encoder */
+static void next_segment(recorder_t *r)
+{
+    close_output(r);
+    r->segment++;
+    if (alloc_output(r) < 0)
+        return;
+    if (open_output(r) < 0)
+        close_output(r);
+}
+
+static int write_packets(recorder_t *r)
+{
+    int ret;
+
+    while ((ret = avcodec_receive_packet(r->enc, r->pkt)) >= 0) {
+        if (r->force_key && (r->pkt->flags & AV_PKT_FLAG_KEY)) {
+            r->force_key = 0;
+            r->seg_start = r->pkt->pts;
+            next_segment(r);
+        }
+        if (!r->oc) {
+            av_packet_unref(r->pkt);
+            continue;
+        }
+        r->bytes += r->pkt->size;
+        r->pkt->stream_index = r->st->index;
+        av_packet_rescale_ts(r->pkt, r->enc->time_base, r->st->time_base);
+        ret = av_interleaved_write_frame(r->oc, r->pkt);
+        if (ret < 0)
+            print_error("write frame", ret);
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+static void encode_frame(recorder_t *r, recorder_frame_t *qf)
+{
+    const uint8_t *src[4];
+    int src_stride[4];
+    int64_t pts = qf->pts;
+    int ret;
+
+    if (av_frame_make_writable(r->frame) < 0)
+        return;
+    av_image_fill_arrays((uint8_t **)src, src_stride, qf->buf, r->src_fmt, r->width, r->height, 1);
+    r->sws = sws_getCachedContext(r->sws, r->width, r->height, r->src_fmt,
+                                  r->width, r->height, r->enc->pix_fmt,
+                                  SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    if (!r->sws)
+        return;
+    sws_scale(r->sws, src, src_stride, 0, r->height, r->frame->data, r->frame->linesize);
+
+    /* live sources without timestamps: wall clock, encoders want increasing pts */
+    if (pts == AV_NOPTS_VALUE)
+        pts = av_gettime_relative() - r->clock_start;
+    if (r->last_pts != AV_NOPTS_VALUE && pts <= r->last_pts)
+        pts = r->last_pts + 1;
+    r->last_pts = pts;
+
+    r->frame->pts = pts;
+    r->frame->pict_type = AV_PICTURE_TYPE_NONE;
+    if (r->seg_start == AV_NOPTS_VALUE)
+        r->seg_start = pts;
+    if (r->segment_us > 0 && !r->force_key && pts - r->seg_start >= r->segment_us) {
+        r->frame->pict_type = AV_PICTURE_TYPE_I;
+        r->force_key = 1;
+    }
+
+    ret = avcodec_send_frame(r->enc, r->frame);
+    if (ret < 0) {
+        print_error("send frame", ret);
+        return;
+    }
+    r->frames++;
+    write_packets(r);
+}
+
+static void *recorder_thread(void *arg)
+{
+    recorder_t *r = (recorder_t *)arg;
+
+    for (;;) {
+        recorder_frame_t *qf;
+
+        pthread_mutex_lock(&r->lock);
+        while (!r->count && !r->stop)
+            pthread_cond_wait(&r->cond, &r->lock);
+        if (!r->count) {
+            pthread_mutex_unlock(&r->lock);
+            break;
+        }
+        qf = &r->queue[r->head];
+        pthread_mutex_unlock(&r->lock);
+
+        encode_frame(r, qf);
+
+        pthread_mutex_lock(&r->lock);
+        r->head = (r->head + 1) % RECORDER_QUEUE;
+        r->count--;
+        pthread_mutex_unlock(&r->lock);
+    }
+
+    /* drain the encoder into the last segment */
+    if (avcodec_send_frame(r->enc, NULL) >= 0)
+        write_packets(r);
+    close_output(r);
+    return NULL;
+}
+
+int recorder_open(recorder_t *r, const char *filename, int stream_id, int width, int height,
+                  enum AVPixelFormat src_fmt, AVRational frame_rate, int64_t segment_us)
+{
+    const char *dot = strrchr(filename, '.');
+    const char *slash = strrchr(filename, '/');
+    int len;
+
+    memset((void *)r, 0, sizeof(*r));
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    r->width = width;
+    r->height = height;
+    r->src_fmt = src_fmt;
+    r->segment_us = segment_us;
+    r->seg_start = AV_NOPTS_VALUE;
+    r->last_pts = AV_NOPTS_VALUE;
+    r->clock_start = av_gettime_relative();
+
+    /* out.mp4 -> out[-s<id>][-<segment>].mp4, no extension: mkv */
+    if (!dot || (slash && dot < slash))
+        dot = filename + strlen(filename);
+    len = dot - filename;
+    if (len > (int)sizeof(r->path) - 16)
+        len = sizeof(r->path) - 16;
+    snprintf(r->path, sizeof(r->path), "%.*s", len, filename);
+    if (stream_id >= 0)
+        snprintf(r->path + strlen(r->path), 16, "-s%d", stream_id);
+    snprintf(r->ext, sizeof(r->ext), "%s", *dot ? dot : ".mkv");
+
+    r->frame_size = av_image_get_buffer_size(src_fmt, width, height, 1);
+    for (int i = 0; i < RECORDER_QUEUE; i++) {
+        r->queue[i].buf = (uint8_t *)malloc(r->frame_size);
+        if (!r->queue[i].buf)
+            return -1;
+    }
+
+    if (alloc_output(r) < 0)
+        return -1;
+    for (unsigned i = 0; i < sizeof(encoder_names) / sizeof(encoder_names[0]) && !r->enc; i++) {
+        const AVCodec *codec = avcodec_find_encoder_by_name(encoder_names[i]);
+
+        if (codec)
+            open_encoder(r, codec, frame_rate);
+    }
+    if (!r->enc) {
+        const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+
+        if (!codec || open_encoder(r, codec, frame_rate) < 0) {
+            fprintf(stderr, "recorder: no usable h264 encoder\n");
+            return -1;
+        }
+    }
+    if (open_output(r) < 0)
+        return -1;
+
+    r->frame = av_frame_alloc();
+    r->pkt = av_packet_alloc();
+    if (!r->frame || !r->pkt)
+        return -1;
+    r->frame->format = r->enc->pix_fmt;
+    r->frame->width = width;
+    r->frame->height = height;
+    if (av_frame_get_buffer(r->frame, 0) < 0)
+        return -1;
+
+    if (pthread_create(&r->thread, NULL, recorder_thread, r) != 0)
+        return -1;
+    r->thread_started = 1;
+    return 0;
+}
+
+/*
+ * Single producer: the slot past the queued ones is filled without the
+ * lock, the recorder thread only looks at queued slots.
+ */
+int recorder_push(recorder_t *r, const uint8_t *buf, int64_t pts)
+{
+    recorder_frame_t *qf;
+
+    pthread_mutex_lock(&r->lock);
+    if (r->count == RECORDER_QUEUE || r->stop) {
+        r->dropped++;
+        pthread_mutex_unlock(&r->lock);
+        return -1;
+    }
+    qf = &r->queue[(r->head + r->count) % RECORDER_QUEUE];
+    pthread_mutex_unlock(&r->lock);
+
+    memcpy(qf->buf, buf, r->frame_size);
+    qf->pts = pts;
+
+    pthread_mutex_lock(&r->lock);
+    r->count++;
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+void recorder_close(recorder_t *r)
+{
+    if (r->thread_started) {
+        pthread_mutex_lock(&r->lock);
+        r->stop = 1;
+        pthread_cond_signal(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->thread, NULL);
+        r->thread_started = 0;
+    } else {
+        close_output(r);
+    }
+    av_frame_free(&r->frame);
+    av_packet_free(&r->pkt);
+    avcodec_free_context(&r->enc);
+    if (r->sws)
+        sws_freeContext(r->sws);
+    r->sws = NULL;
+    for (int i = 0; i < RECORDER_QUEUE; i++) {
+        free(r->queue[i].buf);
+        r->queue[i].buf = NULL;
+    }
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+}
@@ -0,0 +1,78 @@
+#ifndef _FF_RKNN_RECORDER_H_
+#define _FF_RKNN_RECORDER_H_
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#define RECORDER_QUEUE 8
+
+typedef struct _recorder_frame_t
+{
+    uint8_t *buf;
+    int64_t pts; // microseconds
+} recorder_frame_t;
+
+/*
+ * Encoder + muxer sink for annotated frames. The stream thread copies its
+ * frame into a bounded queue and never waits: when the encoder falls
+ * behind the frame is dropped and counted. Output is MP4/MKV (from the
+ * file extension), optionally cut into segments of segment_us, each new
+ * segment starting on a forced keyframe.
+ */
+typedef struct _recorder_t
+{
+    char path[512]; // without extension
+    char ext[16];
+    int width;
+    int height;
+    enum AVPixelFormat src_fmt; // RGB24 or NV12
+    int frame_size;
+    int64_t segment_us; // 0: one file
+    int segment;
+    int64_t seg_start;
+
+    const AVCodec *codec;
+    AVCodecContext *enc;
+    AVFormatContext *oc;
+    AVStream *st;
+    AVFrame *frame;
+    AVPacket *pkt;
+    struct SwsContext *sws;
+    int64_t last_pts;
+    int64_t clock_start;
+    int force_key;
+
+    recorder_frame_t queue[RECORDER_QUEUE];
+    int head;
+    int count;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int thread_started;
+
+    std::atomic<uint64_t> frames; // read by -metrics while recording
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> bytes;
+} recorder_t;
+
+/* stream_id < 0: single stream, no -s<id> suffix in the file name */
+int recorder_open(recorder_t *r, const char *filename, int stream_id, int width, int height,
+                  enum AVPixelFormat src_fmt, AVRational frame_rate, int64_t segment_us);
+int recorder_push(recorder_t *r, const uint8_t *buf, int64_t pts);
+void recorder_close(recorder_t *r);
+
+#endif //_FF_RKNN_RECORDER_H_
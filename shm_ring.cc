@@ -0,0 +1,363 @@
+/*
+ * ff-rknn - shared memory frame and detection ring
+ *
+ * One memfd per stream: a header, SHM_RING_SLOTS slot records and the
+ * page aligned pixel slots. The writer never waits for readers; readers
+ * map the memfd read-only and validate every access with the slot
+ * seqlock, so any number of them can attach without copying pixels.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct _shm_hello_t
+{
+    uint32_t magic;
+    uint32_t count;
+    int32_t pid;
+} shm_hello_t;
+
+static int server_fd = -1;
+static pthread_t server_thread;
+static std::atomic<int> server_stop(0);
+static int server_fds[SHM_RING_MAX];
+static int server_count;
+static char server_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+static size_t page_align(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    return (size + page - 1) & ~(page - 1);
+}
+
+int shm_ring_create(shm_ring_t *ring, int stream_id, uint32_t format, int width, int height,
+                    int frame_size)
+{
+    shm_ring_header_t *hdr;
+    size_t data_offset = page_align(sizeof(shm_ring_header_t));
+    size_t slot_stride = page_align(frame_size);
+    char name[32];
+
+    memset(ring, 0, sizeof(*ring));
+    ring->size = data_offset + SHM_RING_SLOTS * slot_stride;
+    snprintf(name, sizeof(name), "ff-rknn-%d", stream_id);
+    ring->fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring->fd < 0) {
+        fprintf(stderr, "memfd_create: %s\n", strerror(errno));
+        return -1;
+    }
+    if (ftruncate(ring->fd, ring->size) < 0) {
+        fprintf(stderr, "memfd resize: %s\n", strerror(errno));
+        return -1;
+    }
+    /* readers can rely on the size */
+    fcntl(ring->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    ring->base = (uint8_t *)mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (ring->base == MAP_FAILED) {
+        ring->base = NULL;
+        fprintf(stderr, "memfd mmap: %s\n", strerror(errno));
+        return -1;
+    }
+    ring->hdr = hdr = (shm_ring_header_t *)ring->base;
+
+    hdr->version = SHM_RING_VERSION;
+    hdr->pid = getpid();
+    hdr->stream_id = stream_id;
+    hdr->slots = SHM_RING_SLOTS;
+    hdr->format = format;
+    hdr->width = width;
+    hdr->height = height;
+    hdr->frame_size = frame_size;
+    hdr->data_offset = data_offset;
+    hdr->slot_stride = slot_stride;
+    hdr->head.store(0);
+    for (int i = 0; i < SHM_RING_SLOTS; i++) {
+        hdr->slot[i].seqlock.store(0);
+        hdr->slot[i].dmabuf.fd = -1;
+    }
+    /* readers check the magic last */
+    std::atomic_thread_fence(std::memory_order_release);
+    hdr->magic = SHM_RING_MAGIC;
+    return 0;
+}
+
+static int16_t clamp16(int v)
+{
+    return v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v;
+}
+
+void shm_ring_publish(shm_ring_t *ring, const void *pixels, const detect_result_group_t *group,
+                      const shm_dmabuf_t *dmabuf)
+{
+    shm_ring_header_t *hdr = ring->hdr;
+    uint64_t seq = hdr->head.load(std::memory_order_relaxed) + 1;
+    shm_ring_slot_t *slot = &hdr->slot[(seq - 1) % hdr->slots];
+    uint32_t lock = slot->seqlock.load(std::memory_order_relaxed);
+    int count = group->count;
+
+    slot->seqlock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (count > OBJ_NUMB_MAX_SIZE)
+        count = OBJ_NUMB_MAX_SIZE;
+    slot->seq = seq;
+    slot->pts = group->pts;
+    slot->count = count;
+    for (int i = 0; i < count; i++) {
+        const detect_result_t *det_result = &group->results[i];
+        shm_det_t *det = &slot->dets[i];
+        float prop = det_result->prop < 0 ? 0 : det_result->prop > 1 ? 1 : det_result->prop;
+
+        det->left = clamp16(det_result->box.left);
+        det->top = clamp16(det_result->box.top);
+        det->right = clamp16(det_result->box.right);
+        det->bottom = clamp16(det_result->box.bottom);
+        det->cls_id = det_result->cls_id;
+        det->prop = (uint16_t)(prop * 65535.0f + 0.5f);
+    }
+    if (dmabuf) {
+        slot->dmabuf = *dmabuf;
+    } else {
+        memset(&slot->dmabuf, 0, sizeof(slot->dmabuf));
+        slot->dmabuf.fd = -1;
+    }
+    if (pixels)
+        memcpy(ring->base + hdr->data_offset + (seq - 1) % hdr->slots * hdr->slot_stride, pixels,
+               hdr->frame_size);
+
+    slot->seqlock.store(lock + 2, std::memory_order_release);
+    hdr->head.store(seq, std::memory_order_release);
+}
+
+void shm_ring_destroy(shm_ring_t *ring)
+{
+    shm_ring_unmap(ring);
+}
+
+static void send_rings(int client)
+{
+    char control[CMSG_SPACE(sizeof(int) * SHM_RING_MAX)];
+    shm_hello_t hello = { SHM_RING_MAGIC, (uint32_t)server_count, getpid() };
+    struct iovec iov = { &hello, sizeof(hello) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * server_count);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * server_count);
+    memcpy(CMSG_DATA(cmsg), server_fds, sizeof(int) * server_count);
+
+    if (sendmsg(client, &msg, MSG_NOSIGNAL) < 0)
+        fprintf(stderr, "shm: send to client: %s\n", strerror(errno));
+}
+
+static void *shm_server(void * /* arg */)
+{
+    struct pollfd pfd = { server_fd, POLLIN, 0 };
+
+    while (!server_stop.load()) {
+        int client;
+
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        client = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0)
+            continue;
+        send_rings(client);
+        close(client);
+    }
+    return NULL;
+}
+
+int shm_server_start(const char *path, shm_ring_t **rings, int count)
+{
+    struct sockaddr_un addr;
+
+    if (count > SHM_RING_MAX)
+        count = SHM_RING_MAX;
+    server_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (rings[i] && rings[i]->fd >= 0)
+            server_fds[server_count++] = rings[i]->fd;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "shm: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    strcpy(server_path, path);
+
+    server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server_fd < 0)
+        return -1;
+    unlink(path);
+    if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server_fd, 8) < 0) {
+        fprintf(stderr, "shm: %s: %s\n", path, strerror(errno));
+        close(server_fd);
+        server_fd = -1;
+        return -1;
+    }
+    server_stop.store(0);
+    if (pthread_create(&server_thread, NULL, shm_server, NULL) != 0) {
+        close(server_fd);
+        server_fd = -1;
+        return -1;
+    }
+    fprintf(stderr, "shm: %d ring(s) on %s\n", server_count, path);
+    return 0;
+}
+
+void shm_server_stop(void)
+{
+    if (server_fd < 0)
+        return;
+    server_stop.store(1);
+    pthread_join(server_thread, NULL);
+    close(server_fd);
+    unlink(server_path);
+    server_fd = -1;
+}
+
+int shm_ring_connect(const char *path, int *fds, int max, pid_t *pid)
+{
+    char control[CMSG_SPACE(sizeof(int) * SHM_RING_MAX)];
+    struct sockaddr_un addr;
+    shm_hello_t hello;
+    struct iovec iov = { &hello, sizeof(hello) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    int sock, count = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(hello) || hello.magic != SHM_RING_MAGIC) {
+        close(sock);
+        return -1;
+    }
+    close(sock);
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        int n;
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < n; i++) {
+            int fd;
+
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (count < max)
+                fds[count++] = fd;
+            else
+                close(fd);
+        }
+    }
+    if (pid)
+        *pid = hello.pid;
+    return count;
+}
+
+int shm_ring_map(shm_ring_t *ring, int fd)
+{
+    off_t size = lseek(fd, 0, SEEK_END);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = fd;
+    if (size < (off_t)sizeof(shm_ring_header_t))
+        return -1;
+    ring->size = size;
+    ring->base = (uint8_t *)mmap(NULL, ring->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ring->base == MAP_FAILED) {
+        ring->base = NULL;
+        return -1;
+    }
+    ring->hdr = (shm_ring_header_t *)ring->base;
+    if (ring->hdr->magic != SHM_RING_MAGIC || ring->hdr->version != SHM_RING_VERSION ||
+        ring->hdr->data_offset + ring->hdr->slots * ring->hdr->slot_stride > ring->size) {
+        shm_ring_unmap(ring);
+        return -1;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return 0;
+}
+
+/* latest slot, NULL while nothing is published or the writer is in it */
+const shm_ring_slot_t *shm_ring_begin(const shm_ring_t *ring, uint32_t *lock)
+{
+    const shm_ring_header_t *hdr = ring->hdr;
+    uint64_t seq = hdr->head.load(std::memory_order_acquire);
+    const shm_ring_slot_t *slot;
+
+    if (!seq)
+        return NULL;
+    slot = &hdr->slot[(seq - 1) % hdr->slots];
+    *lock = slot->seqlock.load(std::memory_order_acquire);
+    if (*lock & 1)
+        return NULL;
+    return slot;
+}
+
+/* 1: everything read from the slot since shm_ring_begin() is consistent */
+int shm_ring_end(const shm_ring_slot_t *slot, uint32_t lock)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->seqlock.load(std::memory_order_relaxed) == lock;
+}
+
+const uint8_t *shm_ring_pixels(const shm_ring_t *ring, const shm_ring_slot_t *slot)
+{
+    const shm_ring_header_t *hdr = ring->hdr;
+
+    return ring->base + hdr->data_offset + (slot - hdr->slot) * hdr->slot_stride;
+}
+
+void shm_ring_unmap(shm_ring_t *ring)
+{
+    if (ring->base)
+        munmap(ring->base, ring->size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    ring->base = NULL;
+    ring->hdr = NULL;
+    ring->fd = -1;
+}
@@ -0,0 +1,105 @@
+#ifndef _FF_RKNN_SHM_RING_H_
+#define _FF_RKNN_SHM_RING_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "postprocess.h"
+
+#define SHM_RING_MAGIC   0x524b5246 // "FRKR"
+#define SHM_RING_VERSION 1
+#define SHM_RING_SLOTS   4
+#define SHM_RING_MAX     32 // rings handed out per connection
+
+#define SHM_FMT_RGB24 1 // packed R, G, B bytes
+#define SHM_FMT_NV12  2 // Y plane, then interleaved UV, stride = width
+
+/* one detection, 12 bytes */
+typedef struct _shm_det_t
+{
+    int16_t left;
+    int16_t top;
+    int16_t right;
+    int16_t bottom;
+    uint16_t cls_id; // line of the labels file
+    uint16_t prop;   // score * 65535
+} shm_det_t;
+
+/*
+ * Decoder output buffer of the frame, only valid in the writer process:
+ * readers import it with pidfd_getfd(pidfd_open(header->pid), fd). The
+ * decoder recycles its buffers, so check the slot after using it.
+ */
+typedef struct _shm_dmabuf_t
+{
+    int32_t fd; // -1: software decoded
+    uint32_t fourcc;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t uv_offset;
+} shm_dmabuf_t;
+
+/*
+ * Slot metadata, protected by a seqlock: odd while the writer is in the
+ * slot. A reader copies what it needs (or uses the pixels in place) and
+ * keeps the result only if the seqlock did not move meanwhile.
+ */
+typedef struct _shm_ring_slot_t
+{
+    std::atomic<uint32_t> seqlock;
+    uint32_t count;
+    uint64_t seq; // frame sequence number, from 1
+    int64_t pts;  // microseconds, INT64_MIN: unknown
+    shm_dmabuf_t dmabuf;
+    shm_det_t dets[OBJ_NUMB_MAX_SIZE];
+} shm_ring_slot_t;
+
+typedef struct _shm_ring_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid; // writer, for pidfd_getfd() on the dma-buf fds
+    int32_t stream_id;
+    uint32_t slots;
+    uint32_t format; // SHM_FMT_*
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame_size;
+    uint32_t reserved;
+    uint64_t data_offset; // pixels of slot i at data_offset + i * slot_stride
+    uint64_t slot_stride;
+    std::atomic<uint64_t> head; // last published seq, 0: none yet
+    shm_ring_slot_t slot[SHM_RING_SLOTS];
+} shm_ring_header_t;
+
+/* process local view of a ring */
+typedef struct _shm_ring_t
+{
+    int fd;
+    size_t size;
+    shm_ring_header_t *hdr;
+    uint8_t *base;
+} shm_ring_t;
+
+/* writer */
+int shm_ring_create(shm_ring_t *ring, int stream_id, uint32_t format, int width, int height,
+                    int frame_size);
+void shm_ring_publish(shm_ring_t *ring, const void *pixels, const detect_result_group_t *group,
+                      const shm_dmabuf_t *dmabuf);
+void shm_ring_destroy(shm_ring_t *ring);
+
+/* unix socket handing the memfds out with SCM_RIGHTS to each client */
+int shm_server_start(const char *path, shm_ring_t **rings, int count);
+void shm_server_stop(void);
+
+/* reader */
+int shm_ring_connect(const char *path, int *fds, int max, pid_t *pid);
+int shm_ring_map(shm_ring_t *ring, int fd);
+const shm_ring_slot_t *shm_ring_begin(const shm_ring_t *ring, uint32_t *lock);
+int shm_ring_end(const shm_ring_slot_t *slot, uint32_t lock);
+const uint8_t *shm_ring_pixels(const shm_ring_t *ring, const shm_ring_slot_t *slot);
+void shm_ring_unmap(shm_ring_t *ring);
+
+#endif //_FF_RKNN_SHM_RING_H_
@@ -0,0 +1,205 @@
+/*
+ * ff-rknn - per stage latency histograms
+ *
+ * Bucket i < 64 holds the value i, above that each power of two 2^e is
+ * split in 32 linear buckets. Percentiles report the highest value of
+ * their bucket, like HdrHistogram. The periodic dump prints the window
+ * since the previous one, the dump at exit the whole run.
+ */
+
+#include "stats.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *stage_names[STATS_NB] = {
+    "demux", "decode", "rga model", "rga texture", "rga crop", "npu wait",
+    "inputs_set", "run", "outputs_get", "postprocess", "upload", "render",
+};
+
+static stats_hist_t hists[STATS_NB];
+
+/* last periodic dump, only touched by the stats thread */
+static uint64_t prev_counts[STATS_NB][STATS_BUCKETS];
+static uint64_t prev_sum[STATS_NB];
+
+static pthread_t stats_tid;
+static int stats_started;
+static std::atomic<int> stats_quit;
+
+int64_t stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int bucket_of(uint64_t v)
+{
+    int e;
+
+    if (v < (2U << STATS_SUB_BITS))
+        return v;
+    e = 63 - __builtin_clzll(v);
+    if (e >= STATS_MAX_BITS)
+        return STATS_BUCKETS - 1;
+    return ((e - STATS_SUB_BITS + 1) << STATS_SUB_BITS) +
+           (int)(v >> (e - STATS_SUB_BITS)) - (1 << STATS_SUB_BITS);
+}
+
+/* highest value that lands in bucket i */
+static uint64_t bucket_max(int i)
+{
+    int e, m;
+
+    if (i < (2 << STATS_SUB_BITS))
+        return i;
+    e = (i >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+    m = (i & ((1 << STATS_SUB_BITS) - 1)) + (1 << STATS_SUB_BITS);
+    return ((uint64_t)(m + 1) << (e - STATS_SUB_BITS)) - 1;
+}
+
+void stats_hist_add(stats_hist_t *h, int64_t ns)
+{
+    if (ns < 0)
+        ns = 0;
+    h->counts[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    h->sum.fetch_add(ns, std::memory_order_relaxed);
+}
+
+void stats_record(int stage, int64_t ns)
+{
+    stats_hist_add(&hists[stage], ns);
+}
+
+const char *stats_stage_name(int stage)
+{
+    return stage >= 0 && stage < STATS_NB ? stage_names[stage] : "?";
+}
+
+static uint64_t percentile(const uint64_t *counts, uint64_t total, double p)
+{
+    uint64_t target = (uint64_t)(total * p + 0.999999);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= target && seen)
+            return bucket_max(i);
+    }
+    return 0;
+}
+
+static uint64_t snapshot(stats_hist_t *h, uint64_t *counts)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        counts[i] = h->counts[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    return total;
+}
+
+static void print_row(FILE *fp, const char *name, const uint64_t *counts, uint64_t total,
+                      uint64_t sum)
+{
+    uint64_t max = 0;
+
+    for (int i = STATS_BUCKETS - 1; i >= 0 && !max; i--) {
+        if (counts[i])
+            max = bucket_max(i);
+    }
+    fprintf(fp, "%-12s %9llu %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, (unsigned long long)total,
+            sum / 1e6 / total, percentile(counts, total, 0.5) / 1e6,
+            percentile(counts, total, 0.9) / 1e6, percentile(counts, total, 0.99) / 1e6, max / 1e6);
+}
+
+uint64_t stats_hist_count(stats_hist_t *h)
+{
+    uint64_t counts[STATS_BUCKETS];
+
+    return snapshot(h, counts);
+}
+
+uint64_t stats_hist_percentile(stats_hist_t *h, double p)
+{
+    uint64_t counts[STATS_BUCKETS];
+    uint64_t total = snapshot(h, counts);
+
+    return total ? percentile(counts, total, p) : 0;
+}
+
+void stats_hist_print(FILE *fp, const char *name, stats_hist_t *h)
+{
+    uint64_t counts[STATS_BUCKETS];
+    uint64_t total = snapshot(h, counts);
+
+    if (total)
+        print_row(fp, name, counts, total, h->sum.load(std::memory_order_relaxed));
+}
+
+void stats_dump(FILE *fp, int window)
+{
+    static uint64_t counts[STATS_BUCKETS];
+
+    fprintf(fp, "%-12s %9s %9s %9s %9s %9s %9s  (ms)\n", window ? "stage/window" : "stage/total",
+            "count", "mean", "p50", "p90", "p99", "max");
+    for (int s = 0; s < STATS_NB; s++) {
+        uint64_t total = 0, sum;
+
+        sum = hists[s].sum.load(std::memory_order_relaxed);
+        for (int i = 0; i < STATS_BUCKETS; i++) {
+            uint64_t c = hists[s].counts[i].load(std::memory_order_relaxed);
+
+            counts[i] = window ? c - prev_counts[s][i] : c;
+            if (window)
+                prev_counts[s][i] = c;
+            total += counts[i];
+        }
+        if (window) {
+            uint64_t d = sum - prev_sum[s];
+
+            prev_sum[s] = sum;
+            sum = d;
+        }
+        if (total)
+            print_row(fp, stage_names[s], counts, total, sum);
+    }
+}
+
+static void *stats_thread(void *arg)
+{
+    int interval_ms = (int)(intptr_t)arg * 1000;
+
+    while (!stats_quit.load()) {
+        for (int ms = 0; ms < interval_ms && !stats_quit.load(); ms += 100)
+            usleep(100000);
+        if (!stats_quit.load())
+            stats_dump(stderr, 1);
+    }
+    return NULL;
+}
+
+int stats_start(int interval_s)
+{
+    if (interval_s <= 0)
+        return 0;
+    stats_quit.store(0);
+    if (pthread_create(&stats_tid, NULL, stats_thread, (void *)(intptr_t)interval_s) != 0)
+        return -1;
+    stats_started = 1;
+    return 0;
+}
+
+void stats_stop(void)
+{
+    if (!stats_started)
+        return;
+    stats_quit.store(1);
+    pthread_join(stats_tid, NULL);
+    stats_started = 0;
+}
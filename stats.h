@@ -0,0 +1,52 @@
+#ifndef _FF_RKNN_STATS_H_
+#define _FF_RKNN_STATS_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Log-linear latency histograms, 32 buckets per power of two (3% error)
+ * from 1 ns up to 2^40 ns, one per pipeline stage and shared by all
+ * streams: recording is two relaxed atomic adds.
+ */
+#define STATS_SUB_BITS 5
+#define STATS_MAX_BITS 40
+#define STATS_BUCKETS  ((STATS_MAX_BITS - STATS_SUB_BITS + 2) << STATS_SUB_BITS)
+
+enum {
+    STATS_DEMUX,       // av_read_frame
+    STATS_DECODE,      // avcodec_send_packet + avcodec_receive_frame, per frame
+    STATS_RGA_MODEL,   // frame to model input
+    STATS_RGA_TEXTURE, // frame to texture / burn-in buffer
+    STATS_RGA_CROP,    // -m2 crops
+    STATS_NPU_WAIT,    // npu_pool_acquire
+    STATS_INPUTS_SET,  // rknn_inputs_set
+    STATS_RUN,         // rknn_run
+    STATS_OUTPUTS_GET, // rknn_outputs_get
+    STATS_POSTPROCESS, // post_process
+    STATS_UPLOAD,      // texture upload of the fresh frames
+    STATS_RENDER,      // draw, overlay and present
+    STATS_NB
+};
+
+typedef struct _stats_hist_t
+{
+    std::atomic<uint64_t> counts[STATS_BUCKETS];
+    std::atomic<uint64_t> sum;
+} stats_hist_t;
+
+int64_t stats_now(void); // CLOCK_MONOTONIC, nanoseconds
+void stats_record(int stage, int64_t ns);
+const char *stats_stage_name(int stage);
+void stats_dump(FILE *fp, int window);
+int stats_start(int interval_s);
+void stats_stop(void);
+
+/* histograms kept elsewhere, e.g. per stream */
+void stats_hist_add(stats_hist_t *h, int64_t ns);
+uint64_t stats_hist_count(stats_hist_t *h);
+uint64_t stats_hist_percentile(stats_hist_t *h, double p);
+void stats_hist_print(FILE *fp, const char *name, stats_hist_t *h);
+
+#endif //_FF_RKNN_STATS_H_
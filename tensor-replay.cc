@@ -0,0 +1,146 @@
+/*
+ * tensor-replay - run the NPU outputs dumped by ff-rknn -dump through
+ * post_process() again, on any Linux box
+ *
+ *   tensor-replay [-s stream] [-p] [-v] dump.bin
+ *
+ * Every frame is decoded with the model size, thresholds and scales it
+ * was dumped with and checked against the detections of the live run:
+ * boxes, class and score must be bit-exact. Mismatched frames are listed
+ * (-v: with both detection lists) and make the exit status 1. -p prints
+ * "stream pts frame class score left top right bottom" per detection
+ * instead. Labels come from ./model/coco_80_labels_list.txt.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "postprocess.h"
+#include "tensordump.h"
+
+static int same_detections(const tensordump_view_t *v, const detect_result_group_t *group)
+{
+    if (group->count != v->frame->count)
+        return 0;
+    for (int i = 0; i < group->count; i++) {
+        const detect_result_t *det_result = &group->results[i];
+        const tensordump_det_t *det = &v->dets[i];
+
+        if (det_result->box.left != det->box[0] || det_result->box.top != det->box[1] ||
+            det_result->box.right != det->box[2] || det_result->box.bottom != det->box[3] ||
+            det_result->cls_id != det->cls_id ||
+            memcmp(&det_result->prop, &det->prop, sizeof(float)) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+static void print_frame(const char *what, const tensordump_view_t *v, const detect_result_group_t *group)
+{
+    const tensordump_frame_t *f = v->frame;
+
+    fprintf(stderr, "  %s:", what);
+    if (group) {
+        for (int i = 0; i < group->count; i++)
+            fprintf(stderr, " [%d %.9g %d %d %d %d]", group->results[i].cls_id, group->results[i].prop,
+                    group->results[i].box.left, group->results[i].box.top,
+                    group->results[i].box.right, group->results[i].box.bottom);
+    } else {
+        for (int i = 0; i < f->count; i++)
+            fprintf(stderr, " [%d %.9g %d %d %d %d]", v->dets[i].cls_id, v->dets[i].prop,
+                    v->dets[i].box[0], v->dets[i].box[1], v->dets[i].box[2], v->dets[i].box[3]);
+    }
+    fprintf(stderr, "\n");
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: tensor-replay [-s stream] [-p] [-v] dump.bin\n");
+}
+
+int main(int argc, char *argv[])
+{
+    tensordump_reader_t reader;
+    tensordump_view_t v;
+    detect_result_group_t group;
+    uint64_t frames = 0, mismatched = 0, skipped = 0;
+    int stream = -1, print = 0, verbose = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:pv")) != -1) {
+        switch (opt) {
+        case 's':
+            stream = atoi(optarg);
+            break;
+        case 'p':
+            print = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        return 1;
+    }
+    if (initPostProcess() < 0) {
+        fprintf(stderr, "Cannot load the labels, run from the ff-rknn directory\n");
+        return 1;
+    }
+    if (tensordump_reader_open(&reader, argv[optind]) < 0) {
+        fprintf(stderr, "Cannot read tensor dump %s\n", argv[optind]);
+        return 1;
+    }
+
+    while (tensordump_next(&reader, &v)) {
+        const tensordump_frame_t *f = v.frame;
+        std::vector<int32_t> zps;
+        std::vector<float> scales;
+
+        if (stream >= 0 && f->stream != stream)
+            continue;
+        /* post_process() decodes the three int8 heads of YOLOv5 */
+        if (f->n_outputs < 3 || v.tensors[0].type != RKNN_TENSOR_INT8) {
+            skipped++;
+            continue;
+        }
+        for (int i = 0; i < f->n_outputs; i++) {
+            zps.push_back(v.tensors[i].zp);
+            scales.push_back(v.tensors[i].scale);
+        }
+        post_process((int8_t *)v.data[0], (int8_t *)v.data[1], (int8_t *)v.data[2], f->model_height,
+                     f->model_width, f->conf_threshold, f->nms_threshold, f->scale_w, f->scale_h,
+                     zps, scales, &group);
+        frames++;
+
+        if (print) {
+            for (int i = 0; i < group.count; i++) {
+                detect_result_t *det_result = &group.results[i];
+
+                printf("%u %.6f %u %s %.2f %d %d %d %d\n", f->stream,
+                       f->pts == INT64_MIN ? -1.0 : f->pts / 1e6, f->frame, det_result->name,
+                       det_result->prop, det_result->box.left, det_result->box.top,
+                       det_result->box.right, det_result->box.bottom);
+            }
+        } else if (!same_detections(&v, &group)) {
+            mismatched++;
+            fprintf(stderr, "mismatch: stream %u frame %u pts %lld, %d detection(s) dumped, %d now\n",
+                    f->stream, f->frame, (long long)f->pts, f->count, group.count);
+            if (verbose) {
+                print_frame("dumped", &v, NULL);
+                print_frame("replay", &v, &group);
+            }
+        }
+    }
+    fprintf(stderr, "%llu frame(s) replayed, %llu mismatched, %llu skipped\n",
+            (unsigned long long)frames, (unsigned long long)mismatched, (unsigned long long)skipped);
+    tensordump_reader_close(&reader);
+    deinitPostProcess();
+    return mismatched ? 1 : 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * ff-rknn - NPU output tensor dump
+ *
+ * Each dumped frame is a single self-describing record: the post_process()
+ * arguments, the quantisation and shape of every output, the raw int8
+ * buffers as rknn_outputs_get() returned them and the detections. The
+ * record goes out in one writev() under the lock, so the frames of
+ * several streams never interleave, and a reader stops at the first
+ * record that is cut short.
+ */
+
+#include "tensordump.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAD(n) (((n) + 7) & ~(size_t)7)
+
+static const uint8_t zeros[8] = { 0 };
+
+static int writev_all(int fd, struct iovec *iov, int count)
+{
+    while (count) {
+        ssize_t n = writev(fd, iov, count);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        while (count && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static void iov_add(struct iovec *iov, int *count, const void *buf, size_t size)
+{
+    iov[*count].iov_base = (void *)buf;
+    iov[*count].iov_len = size;
+    (*count)++;
+}
+
+tensordump_t *tensordump_open(const char *path, int every)
+{
+    tensordump_t *dump = (tensordump_t *)calloc(1, sizeof(tensordump_t));
+    tensordump_header_t hdr;
+    struct iovec iov = { &hdr, sizeof(hdr) };
+    struct timespec ts;
+
+    if (!dump)
+        return NULL;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TENSORDUMP_MAGIC;
+    hdr.version = TENSORDUMP_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.created = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    dump->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (dump->fd < 0 || writev_all(dump->fd, &iov, 1) < 0) {
+        fprintf(stderr, "tensordump: %s: %s\n", path, strerror(errno));
+        if (dump->fd >= 0)
+            close(dump->fd);
+        free(dump);
+        return NULL;
+    }
+    dump->every = every > 0 ? every : 1;
+    pthread_mutex_init(&dump->lock, NULL);
+    return dump;
+}
+
+/* frame: stream, frame, pts, model size and thresholds filled by the caller */
+int tensordump_write(tensordump_t *dump, tensordump_frame_t *frame, const rknn_tensor_attr *attrs,
+                     const rknn_output *outputs, const detect_result_group_t *group)
+{
+    tensordump_tensor_t tensors[TENSORDUMP_MAX_OUTPUTS];
+    tensordump_det_t dets[OBJ_NUMB_MAX_SIZE];
+    struct iovec iov[3 + 2 * TENSORDUMP_MAX_OUTPUTS];
+    int n_iov = 0, ret;
+
+    if (frame->n_outputs > TENSORDUMP_MAX_OUTPUTS)
+        return -1;
+    frame->magic = TENSORDUMP_FRAME_MAGIC;
+    frame->count = group->count;
+    frame->size = sizeof(*frame) + frame->n_outputs * sizeof(tensordump_tensor_t) +
+                  group->count * sizeof(tensordump_det_t);
+    iov_add(iov, &n_iov, frame, sizeof(*frame));
+    iov_add(iov, &n_iov, tensors, frame->n_outputs * sizeof(tensordump_tensor_t));
+
+    memset(tensors, 0, sizeof(tensors));
+    for (int i = 0; i < frame->n_outputs; i++) {
+        tensordump_tensor_t *t = &tensors[i];
+        const rknn_tensor_attr *attr = &attrs[i];
+
+        t->index = attr->index;
+        t->n_dims = attr->n_dims < TENSORDUMP_MAX_DIMS ? attr->n_dims : TENSORDUMP_MAX_DIMS;
+        memcpy(t->dims, attr->dims, t->n_dims * sizeof(uint32_t));
+        t->fmt = attr->fmt;
+        t->type = attr->type;
+        t->qnt_type = attr->qnt_type;
+        t->fl = attr->fl;
+        t->zp = attr->zp;
+        t->scale = attr->scale;
+        t->size = outputs[i].size;
+        iov_add(iov, &n_iov, outputs[i].buf, outputs[i].size);
+        if (PAD(t->size) != t->size)
+            iov_add(iov, &n_iov, (void *)zeros, PAD(t->size) - t->size);
+        frame->size += PAD(t->size);
+    }
+
+    memset(dets, 0, sizeof(dets));
+    for (int i = 0; i < group->count; i++) {
+        const detect_result_t *det_result = &group->results[i];
+
+        dets[i].box[0] = det_result->box.left;
+        dets[i].box[1] = det_result->box.top;
+        dets[i].box[2] = det_result->box.right;
+        dets[i].box[3] = det_result->box.bottom;
+        dets[i].prop = det_result->prop;
+        dets[i].cls_id = det_result->cls_id;
+    }
+    iov_add(iov, &n_iov, dets, group->count * sizeof(tensordump_det_t));
+
+    pthread_mutex_lock(&dump->lock);
+    ret = writev_all(dump->fd, iov, n_iov);
+    if (ret == 0) {
+        dump->frames++;
+        dump->bytes += frame->size;
+    }
+    pthread_mutex_unlock(&dump->lock);
+    if (ret < 0)
+        fprintf(stderr, "tensordump: write failed: %s\n", strerror(errno));
+    return ret;
+}
+
+void tensordump_close(tensordump_t *dump)
+{
+    if (!dump)
+        return;
+    close(dump->fd);
+    pthread_mutex_destroy(&dump->lock);
+    free(dump);
+}
+
+int tensordump_reader_init(tensordump_reader_t *reader, const void *data, size_t size)
+{
+    const tensordump_header_t *hdr = (const tensordump_header_t *)data;
+
+    memset(reader, 0, sizeof(*reader));
+    if (size < sizeof(tensordump_header_t) || hdr->magic != TENSORDUMP_MAGIC ||
+        hdr->version != TENSORDUMP_VERSION || hdr->header_size > size)
+        return -1;
+    reader->map = (const uint8_t *)data;
+    reader->size = size;
+    reader->offset = hdr->header_size;
+    return 0;
+}
+
+int tensordump_reader_open(tensordump_reader_t *reader, const char *path)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(tensordump_header_t)) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    if (tensordump_reader_init(reader, map, st.st_size) < 0) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    reader->mapped = 1;
+    return 0;
+}
+
+int tensordump_next(tensordump_reader_t *reader, tensordump_view_t *view)
+{
+    const tensordump_frame_t *frame;
+    const uint8_t *p, *end;
+
+    if (reader->size - reader->offset < sizeof(tensordump_frame_t))
+        return 0;
+    frame = (const tensordump_frame_t *)(reader->map + reader->offset);
+    if (frame->magic != TENSORDUMP_FRAME_MAGIC || frame->size > reader->size - reader->offset ||
+        frame->n_outputs > TENSORDUMP_MAX_OUTPUTS || frame->count > OBJ_NUMB_MAX_SIZE)
+        return 0;
+
+    p = (const uint8_t *)(frame + 1);
+    end = (const uint8_t *)frame + frame->size;
+    view->frame = frame;
+    view->tensors = (const tensordump_tensor_t *)p;
+    p += frame->n_outputs * sizeof(tensordump_tensor_t);
+    if (p > end)
+        return 0;
+    for (int i = 0; i < frame->n_outputs; i++) {
+        if (PAD(view->tensors[i].size) > (size_t)(end - p))
+            return 0;
+        view->data[i] = (const int8_t *)p;
+        p += PAD(view->tensors[i].size);
+    }
+    view->dets = (const tensordump_det_t *)p;
+    if (p + frame->count * sizeof(tensordump_det_t) != end)
+        return 0;
+    reader->offset += frame->size;
+    return 1;
+}
+
+void tensordump_rewind(tensordump_reader_t *reader)
+{
+    reader->offset = ((const tensordump_header_t *)reader->map)->header_size;
+}
+
+void tensordump_reader_close(tensordump_reader_t *reader)
+{
+    if (reader->mapped)
+        munmap((void *)reader->map, reader->size);
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,113 @@
+#ifndef _FF_RKNN_TENSORDUMP_H_
+#define _FF_RKNN_TENSORDUMP_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "postprocess.h"
+#include "rknn_api.h"
+
+#define TENSORDUMP_MAGIC       0x44545246 // "FRTD"
+#define TENSORDUMP_FRAME_MAGIC 0x46545246 // "FRTF"
+#define TENSORDUMP_VERSION     1
+#define TENSORDUMP_MAX_DIMS    8
+#define TENSORDUMP_MAX_OUTPUTS 16
+
+typedef struct _tensordump_header_t
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t header_size; // frames start here
+    uint32_t reserved2;
+    int64_t created; // unix time, microseconds
+} tensordump_header_t;
+
+/*
+ * One inferred frame: this header, n_outputs tensor headers, the raw
+ * output buffers (each padded to 8 bytes) and the detections post_process()
+ * made of them live, so a replay can check it gets the same.
+ */
+typedef struct _tensordump_frame_t
+{
+    uint32_t magic;
+    uint32_t size; // whole frame record, this header included
+    int64_t pts;   // microseconds, INT64_MIN: unknown
+    uint32_t frame; // inferred frame number of the stream
+    uint16_t stream;
+    uint16_t n_outputs;
+    uint16_t model_width; // input size the outputs were computed for
+    uint16_t model_height;
+    uint16_t count; // detections
+    uint16_t reserved;
+    /* the other post_process() arguments */
+    float conf_threshold;
+    float nms_threshold;
+    float scale_w;
+    float scale_h;
+} tensordump_frame_t;
+
+/* the rknn_tensor_attr fields a decoder needs */
+typedef struct _tensordump_tensor_t
+{
+    uint32_t index;
+    uint32_t n_dims;
+    uint32_t dims[TENSORDUMP_MAX_DIMS];
+    uint8_t fmt;      // rknn_tensor_format
+    uint8_t type;     // rknn_tensor_type
+    uint8_t qnt_type; // rknn_tensor_qnt_type
+    int8_t fl;
+    int32_t zp;
+    float scale;
+    uint32_t size; // bytes of data
+} tensordump_tensor_t;
+
+/* detect_result_t without the name, 24 bytes */
+typedef struct _tensordump_det_t
+{
+    int32_t box[4]; // left, top, right, bottom
+    float prop;
+    int16_t cls_id;
+    int16_t reserved;
+} tensordump_det_t;
+
+/* writer, shared by the stream threads: one write() per frame */
+typedef struct _tensordump_t
+{
+    int fd;
+    int every; // dump every Nth inferred frame of each stream
+    uint64_t frames;
+    uint64_t bytes;
+    pthread_mutex_t lock;
+} tensordump_t;
+
+tensordump_t *tensordump_open(const char *path, int every);
+int tensordump_write(tensordump_t *dump, tensordump_frame_t *frame, const rknn_tensor_attr *attrs,
+                     const rknn_output *outputs, const detect_result_group_t *group);
+void tensordump_close(tensordump_t *dump);
+
+/* reader: mmaps the dump, a frame cut short by a crash ends it */
+typedef struct _tensordump_reader_t
+{
+    const uint8_t *map;
+    size_t size;
+    size_t offset; // next frame
+    int mapped;
+} tensordump_reader_t;
+
+typedef struct _tensordump_view_t
+{
+    const tensordump_frame_t *frame;
+    const tensordump_tensor_t *tensors;
+    const int8_t *data[TENSORDUMP_MAX_OUTPUTS];
+    const tensordump_det_t *dets;
+} tensordump_view_t;
+
+int tensordump_reader_open(tensordump_reader_t *reader, const char *path);
+int tensordump_reader_init(tensordump_reader_t *reader, const void *data, size_t size); // in memory
+int tensordump_next(tensordump_reader_t *reader, tensordump_view_t *view); // 1: frame, 0: end
+void tensordump_rewind(tensordump_reader_t *reader);
+void tensordump_reader_close(tensordump_reader_t *reader);
+
+#endif //_FF_RKNN_TENSORDUMP_H_
@@ -0,0 +1,209 @@
+/*
+ * ff-rknn - Chrome trace export
+ *
+ * Threads register a ring buffer on their first span (lock-free push on a
+ * list) and only ever write their own ring: the event first, then the
+ * head with release order. trace_flush() reads each ring up to its head,
+ * leaving out the slots a busy writer could lap meanwhile, and writes
+ * complete ("X") events with the stream, pts and NPU core as args. The
+ * file is replaced atomically, on SIGUSR1 and at exit.
+ */
+
+#include "trace.h"
+#include "stats.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define TRACE_MARGIN 1024 // ring slots left out of a flush while the writer runs
+
+typedef struct _trace_buf_t
+{
+    trace_event_t events[TRACE_EVENTS];
+    std::atomic<uint64_t> head; // events ever written
+    int tid;
+    char name[32];
+    struct _trace_buf_t *next;
+} trace_buf_t;
+
+int trace_enabled;
+
+static const char *trace_path;
+static int64_t trace_origin;
+static std::atomic<trace_buf_t *> buffers(NULL);
+static __thread trace_buf_t *local;
+
+static pthread_t trace_tid;
+static int trace_started;
+static std::atomic<int> trace_quit;
+static std::atomic<int> flush_requested;
+
+static trace_buf_t *local_buf(void)
+{
+    trace_buf_t *b = local;
+
+    if (b)
+        return b;
+    b = (trace_buf_t *)calloc(1, sizeof(trace_buf_t));
+    if (!b)
+        return NULL;
+    b->tid = syscall(SYS_gettid);
+    b->next = buffers.load();
+    while (!buffers.compare_exchange_weak(b->next, b))
+        ;
+    local = b;
+    return b;
+}
+
+void trace_thread_name(const char *fmt, ...)
+{
+    trace_buf_t *b;
+    va_list ap;
+
+    if (!trace_enabled || !(b = local_buf()))
+        return;
+    va_start(ap, fmt);
+    vsnprintf(b->name, sizeof(b->name), fmt, ap);
+    va_end(ap);
+}
+
+void trace_add(int stage, int stream, int64_t pts, int core, int64_t begin, int64_t end)
+{
+    trace_buf_t *b = local_buf();
+    trace_event_t *e;
+    uint64_t head;
+
+    if (!b)
+        return;
+    head = b->head.load(std::memory_order_relaxed);
+    e = &b->events[head % TRACE_EVENTS];
+    e->begin = begin;
+    e->end = end;
+    e->pts = pts;
+    e->stage = stage;
+    e->stream = stream;
+    e->core = core;
+    b->head.store(head + 1, std::memory_order_release);
+}
+
+static const char *span_name(int stage)
+{
+    if (stage < STATS_NB)
+        return stats_stage_name(stage);
+    if (stage == TRACE_CLASSIFY)
+        return "classify";
+    if (stage == TRACE_OUTPUT)
+        return "output";
+    return "?";
+}
+
+static void write_event(FILE *fp, const trace_buf_t *b, const trace_event_t *e, int pid)
+{
+    fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{",
+            span_name(e->stage), (e->begin - trace_origin) / 1e3, (e->end - e->begin) / 1e3, pid, b->tid);
+    if (e->stream >= 0)
+        fprintf(fp, "\"stream\":%d", e->stream);
+    if (e->pts != INT64_MIN)
+        fprintf(fp, "%s\"pts\":%lld", e->stream >= 0 ? "," : "", (long long)e->pts);
+    if (e->core >= 0)
+        fprintf(fp, "%s\"core\":%d", e->stream >= 0 || e->pts != INT64_MIN ? "," : "", e->core);
+    fputs("}}", fp);
+}
+
+int trace_flush(void)
+{
+    char tmp[4096];
+    uint64_t count = 0;
+    int pid = getpid();
+    FILE *fp;
+
+    if (!trace_enabled)
+        return 0;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", trace_path);
+    fp = fopen(tmp, "w");
+    if (!fp) {
+        fprintf(stderr, "trace: cannot write %s\n", tmp);
+        return -1;
+    }
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"ff-rknn\"}}",
+            pid);
+    for (trace_buf_t *b = buffers.load(); b; b = b->next) {
+        uint64_t head = b->head.load(std::memory_order_acquire);
+        uint64_t first = head > TRACE_EVENTS - TRACE_MARGIN ? head - (TRACE_EVENTS - TRACE_MARGIN) : 0;
+
+        if (b->name[0])
+            fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                        "\"args\":{\"name\":\"%s\"}}", pid, b->tid, b->name);
+        for (uint64_t i = first; i < head; i++)
+            write_event(fp, b, &b->events[i % TRACE_EVENTS], pid);
+        count += head - first;
+    }
+    fputs("\n]}\n", fp);
+    if (fclose(fp) != 0 || rename(tmp, trace_path) < 0) {
+        fprintf(stderr, "trace: cannot write %s\n", trace_path);
+        return -1;
+    }
+    fprintf(stderr, "trace: %llu spans written to %s\n", (unsigned long long)count, trace_path);
+    return 0;
+}
+
+static void sigusr1_handler(int /* sig */)
+{
+    flush_requested.store(1);
+}
+
+/* the JSON is written here, not in the signal handler */
+static void *trace_thread(void * /* arg */)
+{
+    while (!trace_quit.load()) {
+        usleep(100000);
+        if (flush_requested.exchange(0))
+            trace_flush();
+    }
+    return NULL;
+}
+
+int trace_start(const char *path)
+{
+    trace_path = path;
+    trace_origin = stats_now();
+    trace_enabled = 1;
+    trace_quit.store(0);
+    if (pthread_create(&trace_tid, NULL, trace_thread, NULL) != 0)
+        return -1;
+    trace_started = 1;
+    signal(SIGUSR1, sigusr1_handler);
+    return 0;
+}
+
+/* after the traced threads are gone: last flush and free the rings */
+void trace_stop(void)
+{
+    trace_buf_t *b;
+
+    if (!trace_enabled)
+        return;
+    if (trace_started) {
+        trace_quit.store(1);
+        pthread_join(trace_tid, NULL);
+        trace_started = 0;
+    }
+    trace_flush();
+    trace_enabled = 0;
+    b = buffers.exchange(NULL);
+    while (b) {
+        trace_buf_t *next = b->next;
+
+        free(b);
+        b = next;
+    }
+    local = NULL;
+}
@@ -0,0 +1,44 @@
+#ifndef _FF_RKNN_TRACE_H_
+#define _FF_RKNN_TRACE_H_
+
+#include <stdint.h>
+
+/*
+ * Pipeline spans in Chrome trace-event JSON (chrome://tracing, Perfetto).
+ * Every thread appends to a ring of its own, nothing is shared on the
+ * hot path; with tracing off a span costs the trace_enabled test.
+ */
+#define TRACE_EVENTS 65536 // per thread, the oldest are overwritten
+
+typedef struct _trace_event_t
+{
+    int64_t begin; // stats_now() nanoseconds
+    int64_t end;
+    int64_t pts;   // microseconds, INT64_MIN: none
+    int16_t stage; // STATS_* or TRACE_*
+    int16_t stream;
+    int16_t core;  // NPU core, -1: none / auto
+} trace_event_t;
+
+/* spans that have no histogram */
+enum {
+    TRACE_CLASSIFY = 100, // -m2 second stage of one frame
+    TRACE_OUTPUT,         // texture, burn-in and sinks of one frame
+};
+
+extern int trace_enabled;
+
+int trace_start(const char *path);
+void trace_thread_name(const char *fmt, ...);
+void trace_add(int stage, int stream, int64_t pts, int core, int64_t begin, int64_t end);
+int trace_flush(void);
+void trace_stop(void);
+
+static inline void trace_span(int stage, int stream, int64_t pts, int core, int64_t begin,
+                              int64_t end)
+{
+    if (trace_enabled)
+        trace_add(stage, stream, pts, core, begin, end);
+}
+
+#endif //_FF_RKNN_TRACE_H_